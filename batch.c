@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "batch.h"
+
+/*
+batch.c - Multi-Image Processing Helpers
+
+Implements the output buffers, image list parsing and the ordered thread pool
+declared in batch.h.
+*/
+
+static void outbuf_reserve(struct OutBuf *buf, size_t extra) {
+    if (buf->len + extra + 1 <= buf->cap) {
+        return;
+    }
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + extra + 1) {
+        cap *= 2;
+    }
+    char *grown = realloc(buf->data, cap);
+    if (!grown) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    buf->data = grown;
+    buf->cap = cap;
+}
+
+void outbuf_printf(struct OutBuf *buf, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int needed = vsnprintf(buf->data ? buf->data + buf->len : NULL, buf->data ? buf->cap - buf->len : 0, fmt, ap);
+    va_end(ap);
+    if (needed < 0) {
+        return;
+    }
+
+    // Retry once the buffer is large enough
+    if (!buf->data || buf->len + needed + 1 > buf->cap) {
+        outbuf_reserve(buf, needed);
+        va_start(ap, fmt);
+        vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+        va_end(ap);
+    }
+    buf->len += needed;
+}
+
+void outbuf_write(struct OutBuf *buf, const void *data, size_t len) {
+    outbuf_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+void outbuf_free(struct OutBuf *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+void outbuf_json_string(struct OutBuf *buf, const char *s) {
+    outbuf_write(buf, "\"", 1);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', c };
+            outbuf_write(buf, escaped, 2);
+        } else if (c < 0x20 || c >= 0x7F) {
+            // Names come from raw 8.3 bytes; keep the output plain ASCII
+            outbuf_printf(buf, "\\u%04x", c);
+        } else {
+            outbuf_write(buf, s, 1);
+        }
+    }
+    outbuf_write(buf, "\"", 1);
+}
+
+void outbuf_csv_field(struct OutBuf *buf, const char *s) {
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        outbuf_write(buf, s, strlen(s));
+        return;
+    }
+    outbuf_write(buf, "\"", 1);
+    for (; *s; s++) {
+        if (*s == '"') {
+            outbuf_write(buf, "\"", 1);
+        }
+        outbuf_write(buf, s, 1);
+    }
+    outbuf_write(buf, "\"", 1);
+}
+
+static int image_list_add(struct ImageList *list, const char *path) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        char **grown = realloc(list->paths, capacity * sizeof(char *));
+        if (!grown) {
+            fprintf(stderr, "Memory allocation error\n");
+            return -1;
+        }
+        list->paths = grown;
+        list->capacity = capacity;
+    }
+    list->paths[list->count] = strdup(path);
+    if (!list->paths[list->count]) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+// Add every non-empty line of a list file
+static int image_list_read(struct ImageList *list, const char *list_path) {
+    FILE *file = strcmp(list_path, "-") == 0 ? stdin : fopen(list_path, "r");
+    if (!file) {
+        fprintf(stderr, "Error opening %s: %s\n", list_path, strerror(errno));
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    int rc = 0;
+    while (rc == 0 && (line_len = getline(&line, &line_cap, file)) != -1) {
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+            line[--line_len] = '\0';
+        }
+        if (line_len > 0) {
+            rc = image_list_add(list, line);
+        }
+    }
+
+    free(line);
+    if (file != stdin) {
+        fclose(file);
+    }
+    return rc;
+}
+
+int output_format_parse(const char *name, enum OutputFormat *format) {
+    if (strcmp(name, "text") == 0) {
+        *format = FORMAT_TEXT;
+    } else if (strcmp(name, "jsonl") == 0) {
+        *format = FORMAT_JSONL;
+    } else if (strcmp(name, "csv") == 0) {
+        *format = FORMAT_CSV;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *output_format_name(enum OutputFormat format) {
+    return format == FORMAT_JSONL ? "jsonl" : format == FORMAT_CSV ? "csv" : "text";
+}
+
+int image_list_parse(struct ImageList *list, int argc, char *argv[], int first) {
+    memset(list, 0, sizeof(*list));
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    list->threads = cpus > 0 ? (int)cpus : 1;
+
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            list->threads = atoi(argv[++i]);
+            if (list->threads < 1) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (output_format_parse(argv[++i], &list->format) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            if (image_list_read(list, argv[++i]) != 0) {
+                return -1;
+            }
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            return -1;
+        } else if (image_list_add(list, argv[i]) != 0) {
+            return -1;
+        }
+    }
+
+    return list->count > 0 ? 0 : -1;
+}
+
+void image_list_free(struct ImageList *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    memset(list, 0, sizeof(*list));
+}
+
+// Shared state of one image_list_run call
+struct Pool {
+    const struct ImageList *list;
+    image_job_fn job;
+    struct OutBuf *outputs;
+    int *status;
+    char *done;
+    size_t next;                // Next image to claim
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+};
+
+static void *pool_worker(void *arg) {
+    struct Pool *pool = arg;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        size_t index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (index >= pool->list->count) {
+            return NULL;
+        }
+
+        int status = pool->job(pool->list->paths[index], pool->list->format, &pool->outputs[index]);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->status[index] = status;
+        pool->done[index] = 1;
+        pthread_cond_broadcast(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+int image_list_run(const struct ImageList *list, image_job_fn job) {
+    struct Pool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.list = list;
+    pool.job = job;
+    pool.outputs = calloc(list->count, sizeof(struct OutBuf));
+    pool.status = calloc(list->count, sizeof(int));
+    pool.done = calloc(list->count, 1);
+    if (!pool.outputs || !pool.status || !pool.done) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(pool.outputs);
+        free(pool.status);
+        free(pool.done);
+        return 1;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+
+    size_t thread_count = (size_t)list->threads < list->count ? (size_t)list->threads : list->count;
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    size_t started = 0;
+    for (; threads && started < thread_count; started++) {
+        if (pthread_create(&threads[started], NULL, pool_worker, &pool) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        pool_worker(&pool);  // No threads available; do the work here
+    }
+
+    // Emit each buffer as soon as it and everything before it are finished
+    int failed = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.done[i]) {
+            pthread_cond_wait(&pool.finished, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        if (list->count > 1 && list->format == FORMAT_TEXT) {
+            printf("%s%s:\n", i > 0 ? "\n" : "", list->paths[i]);
+        }
+        fwrite(pool.outputs[i].data ? pool.outputs[i].data : "", 1, pool.outputs[i].len, stdout);
+        outbuf_free(&pool.outputs[i]);
+        failed |= pool.status[i];
+    }
+    fflush(stdout);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.finished);
+    free(pool.outputs);
+    free(pool.status);
+    free(pool.done);
+    return failed;
+}
@@ -0,0 +1,67 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+/*
+batch.h - Multi-Image Processing Helpers
+
+Tools that accept many images collect them from the command line and from list
+files, then hand them to a fixed pool of worker threads. Each image is processed
+into its own output buffer, and the buffers are emitted strictly in input order as
+soon as every earlier image has finished, so the output is identical whatever the
+thread count.
+*/
+
+// Growable in-memory output buffer
+struct OutBuf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+void outbuf_printf(struct OutBuf *buf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void outbuf_write(struct OutBuf *buf, const void *data, size_t len);
+void outbuf_free(struct OutBuf *buf);
+
+// Append s as a quoted, escaped JSON string or CSV field
+void outbuf_json_string(struct OutBuf *buf, const char *s);
+void outbuf_csv_field(struct OutBuf *buf, const char *s);
+
+// Output layouts selectable with --format
+enum OutputFormat {
+    FORMAT_TEXT,                // Human-readable layout
+    FORMAT_JSONL,               // One JSON object per line
+    FORMAT_CSV                  // Header row plus one row per record
+};
+
+// Map between a format and its --format name; parse returns 0, or -1 if unknown
+int output_format_parse(const char *name, enum OutputFormat *format);
+const char *output_format_name(enum OutputFormat format);
+
+// Images and options gathered from the command line
+struct ImageList {
+    char **paths;
+    size_t count;
+    size_t capacity;
+    int threads;                // Worker threads; defaults to the online CPU count
+    enum OutputFormat format;
+};
+
+// Parse "[-j threads] [-f list_file]... [--format text|jsonl|csv] <disk_image>..."
+// starting at argv[first]. A list file holds one image path per line; "-" reads
+// the list from stdin.
+// Returns 0, or -1 on a usage or read error.
+int image_list_parse(struct ImageList *list, int argc, char *argv[], int first);
+void image_list_free(struct ImageList *list);
+
+// Process one image into out in the given format; returns the image's exit status
+typedef int (*image_job_fn)(const char *image, enum OutputFormat format, struct OutBuf *out);
+
+// Run job over every image in parallel, writing each buffer to stdout in list order.
+// In text format with more than one image, each section is headed by "<image>:";
+// machine-readable records carry the image path themselves.
+// Returns non-zero if any job did.
+int image_list_run(const struct ImageList *list, image_job_fn job);
+
+#endif
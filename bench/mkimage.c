@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../fat12.h"
+
+/*
+mkimage.c - Synthetic FAT Image Generator
+
+This program builds FAT12, FAT16 or FAT32 images for benchmarking. The FAT width,
+geometry, directory tree, file count, how full the data area is and how
+fragmented the files are can all be chosen, and the same options and seed always
+produce the same image. The width must suit the cluster count: FAT12 below 4085
+clusters, FAT16 below 65525 and FAT32 from there on.
+
+The directory tree is complete: every directory down to the given depth has the
+same number of subdirectories. Files are dealt to the directories in turn (the
+root only while it has free entries) with sizes spread around the average that
+reaches the requested fill ratio, and their contents are pseudo-random. Clusters
+are allocated in order; with fragmentation p, each next cluster of a file or
+directory is instead taken from a random free spot with probability p percent.
+A FAT32 root directory is a chain like any other, allocated first.
+
+Usage: ./mkimage [-T 12|16|32] [-S total_sectors] [-c sectors_per_cluster] [-d depth]
+                 [-w subdirs] [-n files] [-f fill_percent] [-F fragmentation_percent]
+                 [-s seed] <output_image>
+*/
+
+#define SECTOR_SIZE 512
+#define ROOT_ENTRIES 224        // FAT12 and FAT16; FAT32 has no fixed root region
+#define FAT32_RESERVED 32       // Boot sector, FSInfo at 1 and the backup boot sector at 6
+
+// A directory being filled in
+struct Dir {
+    uint32_t cluster;           // First cluster, 0 for the root
+    uint32_t last_cluster;      // Cluster new entries go into
+    uint32_t entries;
+};
+
+// The image under construction
+struct Builder {
+    uint8_t *image;
+    size_t size;
+    uint32_t fat_bits;
+    uint32_t cluster_size;
+    uint32_t clusters;          // Data clusters, numbered from 2
+    uint8_t *fat;
+    struct DirEntry *root;
+    uint8_t *data;
+    uint8_t *used;              // One flag per cluster
+    uint32_t free_count;
+    uint32_t cursor;            // Where the next in-order search starts
+    int fragmentation;
+    uint64_t rng;
+};
+
+static uint64_t next_random(struct Builder *b) {
+    // xorshift64*
+    b->rng ^= b->rng >> 12;
+    b->rng ^= b->rng << 25;
+    b->rng ^= b->rng >> 27;
+    return b->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static void set_fat(struct Builder *b, uint32_t cluster, uint32_t value) {
+    if (b->fat_bits != 12) {
+        uint8_t *p = b->fat + (size_t)cluster * b->fat_bits / 8;
+        for (uint32_t i = 0; i < b->fat_bits / 8; i++) {
+            p[i] = (value & 0x0FFFFFFF) >> (8 * i);
+        }
+        return;
+    }
+    uint8_t *p = b->fat + cluster + cluster / 2;
+    if (cluster & 1) {
+        p[0] = (p[0] & 0x0F) | ((value & 0x0F) << 4);
+        p[1] = value >> 4;
+    } else {
+        p[0] = value & 0xFF;
+        p[1] = (p[1] & 0xF0) | ((value >> 8) & 0x0F);
+    }
+}
+
+static uint8_t *cluster_data(struct Builder *b, uint32_t cluster) {
+    return b->data + (size_t)(cluster - 2) * b->cluster_size;
+}
+
+// Take a free cluster following previous, or a random one when fragmenting;
+// returns 0 when the disk is full
+static uint32_t allocate(struct Builder *b, uint32_t previous) {
+    if (b->free_count == 0) {
+        return 0;
+    }
+
+    uint32_t start = previous ? previous + 1 : b->cursor;
+    if ((int)(next_random(b) % 100) < b->fragmentation) {
+        start = 2 + next_random(b) % b->clusters;
+    }
+    for (uint32_t i = 0; i < b->clusters; i++) {
+        uint32_t cluster = 2 + (start - 2 + i) % b->clusters;
+        if (!b->used[cluster]) {
+            b->used[cluster] = 1;
+            b->free_count--;
+            set_fat(b, cluster, FAT12_EOC_MARK);
+            if (previous) {
+                set_fat(b, previous, cluster);
+            } else {
+                b->cursor = cluster + 1;
+            }
+            return cluster;
+        }
+    }
+    return 0;
+}
+
+static void fill_entry(struct DirEntry *entry, const char *name, const char *ext, uint8_t attributes,
+                       uint32_t cluster, uint32_t size) {
+    memset(entry, 0, sizeof(*entry));
+    memset(entry->filename, ' ', 8);
+    memset(entry->extension, ' ', 3);
+    memcpy(entry->filename, name, strlen(name) < 8 ? strlen(name) : 8);
+    memcpy(entry->extension, ext, strlen(ext) < 3 ? strlen(ext) : 3);
+    entry->attributes = attributes;
+    entry->creation_time = entry->last_write_time = (12 << 11);      // 12:00:00
+    entry->creation_date = entry->last_write_date = (44 << 9) | (1 << 5) | 1;  // 2024-01-01
+    entry->starting_cluster = cluster & 0xFFFF;
+    entry->first_cluster_high = cluster >> 16;  // Always 0 below FAT32
+    entry->file_size = size;
+}
+
+// Slot for a new entry in dir, growing a subdirectory by a cluster when it is full;
+// NULL when the root is full or the disk is
+static struct DirEntry *add_entry(struct Builder *b, struct Dir *dir) {
+    if (dir->cluster == 0) {
+        return dir->entries < ROOT_ENTRIES ? &b->root[dir->entries++] : NULL;
+    }
+
+    uint32_t per_cluster = b->cluster_size / sizeof(struct DirEntry);
+    if (dir->entries > 0 && dir->entries % per_cluster == 0) {
+        uint32_t cluster = allocate(b, dir->last_cluster);
+        if (cluster == 0) {
+            return NULL;
+        }
+        memset(cluster_data(b, cluster), 0, b->cluster_size);
+        dir->last_cluster = cluster;
+    }
+    struct DirEntry *slots = (struct DirEntry *)cluster_data(b, dir->last_cluster);
+    return &slots[dir->entries++ % per_cluster];
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t fat_bits = 12, total_sectors = 2880, sectors_per_cluster = 1, depth = 2, width = 2, files = 64;
+    int fill = 50, fragmentation = 0;
+    uint64_t seed = 1;
+    const char *output = NULL;
+
+    // Check command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0' && i + 1 < argc) {
+            unsigned long value = strtoul(argv[++i], NULL, 10);
+            switch (argv[i - 1][1]) {
+                case 'T': fat_bits = value; break;
+                case 'S': total_sectors = value; break;
+                case 'c': sectors_per_cluster = value; break;
+                case 'd': depth = value; break;
+                case 'w': width = value; break;
+                case 'n': files = value; break;
+                case 'f': fill = value; break;
+                case 'F': fragmentation = value; break;
+                case 's': seed = value; break;
+                default: output = NULL; i = argc; break;
+            }
+        } else if (!output && argv[i][0] != '-') {
+            output = argv[i];
+        } else {
+            output = NULL;
+            break;
+        }
+    }
+    if (!output || (fat_bits != 12 && fat_bits != 16 && fat_bits != 32) || sectors_per_cluster == 0 || sectors_per_cluster > 128 ||
+        (sectors_per_cluster & (sectors_per_cluster - 1)) != 0 || fill > 100 || fragmentation > 100 ||
+        total_sectors < 64 || total_sectors > 0xFFFFFF) {
+        fprintf(stderr, "Usage: %s [-T 12|16|32] [-S total_sectors] [-c sectors_per_cluster] [-d depth]\n"
+                        "       [-w subdirs] [-n files] [-f fill_percent] [-F fragmentation_percent] [-s seed]\n"
+                        "       <output_image>\n",
+                argv[0]);
+        return 1;
+    }
+
+    // Size the FAT for the clusters that remain once the FATs themselves are placed
+    uint32_t reserved = fat_bits == 32 ? FAT32_RESERVED : 1;
+    uint32_t root_entries = fat_bits == 32 ? 0 : ROOT_ENTRIES;
+    uint32_t root_sectors = root_entries * sizeof(struct DirEntry) / SECTOR_SIZE;
+    uint32_t fat_sectors = 1, clusters;
+    for (;;) {
+        clusters = (total_sectors - reserved - 2 * fat_sectors - root_sectors) / sectors_per_cluster;
+        uint32_t needed = ((uint64_t)(clusters + 2) * fat_bits / 8 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        if (needed <= fat_sectors) break;
+        fat_sectors = needed;
+    }
+    uint32_t min_clusters = fat_bits == 12 ? 1 : fat_bits == 16 ? 4085 : 65525;
+    uint32_t max_clusters = fat_bits == 12 ? 4084 : fat_bits == 16 ? 65524 : 0x0FFFFFF5;
+    if (clusters < min_clusters || clusters > max_clusters) {
+        fprintf(stderr, "Error: %u clusters do not make a FAT%u volume; change the size (-S) or clusters (-c)\n",
+                clusters, fat_bits);
+        return 1;
+    }
+
+    struct Builder b;
+    memset(&b, 0, sizeof(b));
+    b.size = (size_t)total_sectors * SECTOR_SIZE;
+    b.image = calloc(1, b.size);
+    b.used = calloc(clusters + 2, 1);
+    if (!b.image || !b.used) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+    b.fat_bits = fat_bits;
+    b.cluster_size = sectors_per_cluster * SECTOR_SIZE;
+    b.clusters = clusters;
+    b.free_count = clusters;
+    b.cursor = 2;
+    b.fragmentation = fragmentation;
+    b.rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+    b.fat = b.image + reserved * SECTOR_SIZE;
+    b.root = (struct DirEntry *)(b.image + (reserved + 2 * fat_sectors) * SECTOR_SIZE);
+    b.data = b.image + (size_t)(reserved + 2 * fat_sectors + root_sectors) * SECTOR_SIZE;
+
+    // Boot sector
+    struct BootSector *bs = (struct BootSector *)b.image;
+    memcpy(bs->jmp, "\xEB\x3C\x90", 3);
+    memcpy(bs->oem, "MKIMAGE ", 8);
+    bs->bytes_per_sector = SECTOR_SIZE;
+    bs->sectors_per_cluster = sectors_per_cluster;
+    bs->reserved_sectors = reserved;
+    bs->num_fats = 2;
+    bs->root_dir_entries = root_entries;
+    if (total_sectors < 0x10000 && fat_bits != 32) {
+        bs->total_sectors_16 = total_sectors;
+    } else {
+        bs->total_sectors_32 = total_sectors;
+    }
+    bs->media_type = 0xF0;
+    bs->sectors_per_track = 18;
+    bs->num_heads = 2;
+    struct BootSectorTail *ext = &bs->ext;
+    if (fat_bits == 32) {
+        bs->fat32.fat_size_32 = fat_sectors;
+        bs->fat32.fs_info = 1;
+        bs->fat32.backup_boot_sector = 6;
+        ext = &bs->fat32.ext;
+    } else {
+        bs->fat_size_16 = fat_sectors;
+    }
+    ext->boot_signature = 0x29;
+    ext->volume_id = (uint32_t)seed;
+    memcpy(ext->volume_label, "BENCH      ", 11);
+    char fs_type[9];
+    snprintf(fs_type, sizeof(fs_type), "FAT%-5u", fat_bits);
+    memcpy(ext->fs_type, fs_type, 8);
+    b.image[510] = 0x55;
+    b.image[511] = 0xAA;
+    uint32_t mask = fat_bits == 32 ? 0x0FFFFFFF : (1u << fat_bits) - 1;
+    set_fat(&b, 0, (mask & ~0xFFu) | bs->media_type);
+    set_fat(&b, 1, FAT12_EOC_MARK);
+
+    // Directory tree, breadth-first; the root is directory 0
+    uint32_t dir_count = 1, level_size = 1;
+    for (uint32_t level = 0; level < depth; level++) {
+        level_size *= width;
+        dir_count += level_size;
+    }
+    struct Dir *dirs = calloc(dir_count, sizeof(*dirs));
+    if (!dirs) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+    if (fat_bits == 32) {
+        dirs[0].cluster = dirs[0].last_cluster = allocate(&b, 0);
+        bs->fat32.root_cluster = dirs[0].cluster;
+    }
+    uint32_t made = 1;
+    for (uint32_t parent = 0; parent < made && made < dir_count; parent++) {
+        for (uint32_t w = 0; w < width && made < dir_count; w++) {
+            struct DirEntry *slot = add_entry(&b, &dirs[parent]);
+            uint32_t cluster = slot ? allocate(&b, 0) : 0;
+            if (cluster == 0) {
+                fprintf(stderr, "Error: no room for directory %u\n", made);
+                return 1;
+            }
+            char name[16];
+            snprintf(name, sizeof(name), "D%07u", made);
+            fill_entry(slot, name, "", FAT12_ATTR_DIRECTORY, cluster, 0);
+
+            struct DirEntry *entries = (struct DirEntry *)cluster_data(&b, cluster);
+            memset(entries, 0, b.cluster_size);
+            fill_entry(&entries[0], ".", "", FAT12_ATTR_DIRECTORY, cluster, 0);
+            // ".." names the root as cluster 0, even when it is a chain
+            fill_entry(&entries[1], "..", "", FAT12_ATTR_DIRECTORY, parent ? dirs[parent].cluster : 0, 0);
+            dirs[made].cluster = cluster;
+            dirs[made].last_cluster = cluster;
+            dirs[made].entries = 2;
+            made++;
+        }
+    }
+
+    // Files, sized around the average that reaches the fill ratio
+    uint64_t budget = (uint64_t)clusters * b.cluster_size * fill / 100;
+    uint64_t in_use = (uint64_t)(clusters - b.free_count) * b.cluster_size;
+    uint64_t average = files && budget > in_use ? (budget - in_use) / files : 0;
+    uint32_t written = 0;
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < files; i++) {
+        uint32_t size = average ? average / 2 + next_random(&b) % (average + 1) : 0;
+        if ((uint64_t)size > (uint64_t)b.free_count * b.cluster_size) {
+            size = (uint64_t)b.free_count * b.cluster_size;
+        }
+
+        // Deal files to the directories in turn, passing over a full root
+        struct DirEntry *slot = NULL;
+        for (uint32_t tries = 0; !slot && tries < dir_count; tries++) {
+            slot = add_entry(&b, &dirs[(i + tries) % dir_count]);
+        }
+        if (!slot) {
+            fprintf(stderr, "Error: no room for file %u\n", i + 1);
+            return 1;
+        }
+
+        uint32_t first = 0, previous = 0;
+        for (uint32_t offset = 0; offset < size; offset += b.cluster_size) {
+            uint32_t cluster = allocate(&b, previous);
+            if (cluster == 0) {
+                size = offset;
+                break;
+            }
+            uint8_t *p = cluster_data(&b, cluster);
+            for (uint32_t j = 0; j < b.cluster_size; j += 8) {
+                uint64_t r = next_random(&b);
+                memcpy(p + j, &r, 8);
+            }
+            first = first ? first : cluster;
+            previous = cluster;
+        }
+
+        char name[16];
+        snprintf(name, sizeof(name), "F%07u", i + 1);
+        fill_entry(slot, name, "DAT", 0, first, size);
+        written++;
+        bytes += size;
+    }
+
+    // FAT32 keeps a free count and allocation hint in FSInfo, and a backup boot sector
+    if (fat_bits == 32) {
+        uint8_t *info = b.image + SECTOR_SIZE;
+        memcpy(info, "RRaA", 4);
+        memcpy(info + 484, "rrAa", 4);
+        memcpy(info + 488, &b.free_count, 4);
+        memcpy(info + 492, &b.cursor, 4);
+        info[510] = 0x55;
+        info[511] = 0xAA;
+        memcpy(b.image + 6 * SECTOR_SIZE, b.image, 2 * SECTOR_SIZE);
+    }
+
+    // Mirror the FAT into the second copy and write the image out
+    memcpy(b.fat + (size_t)fat_sectors * SECTOR_SIZE, b.fat, (size_t)fat_sectors * SECTOR_SIZE);
+    FILE *out = fopen(output, "wb");
+    if (!out || fwrite(b.image, 1, b.size, out) != b.size || fclose(out) != 0) {
+        perror("Error writing image");
+        return 1;
+    }
+
+    printf("%s: %u files (%llu bytes) in %u directories, %u of %u clusters used\n", output, written,
+           (unsigned long long)bytes, dir_count - 1, clusters - b.free_count, clusters);
+    free(dirs);
+    free(b.used);
+    free(b.image);
+    return 0;
+}
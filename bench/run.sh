@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# run.sh - Benchmark Suite
+#
+# Generates synthetic images with bench/mkimage and times diskinfo, disklist,
+# diskget (one file and the whole tree) and diskput against each of them with
+# bench/runbench, printing one JSON line per benchmark on stdout. Run it from
+# the repository root after building, or through `make bench`.
+#
+# REPS sets the repetitions per benchmark (5 by default).
+
+set -e
+root=$(pwd)
+reps=${REPS:-5}
+unset DISKD_SOCKET                      # Measure the tools, not the daemon
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+mkdir "$work/out"
+head -c 65536 "$root/TestDisks/disk3.IMA" > "$work/PUT.BIN"
+
+# Name and generator options of each configuration
+while read -r name options; do
+    [ -n "$name" ] || continue
+    image="$work/$name.IMA"
+    "$root/bench/mkimage" $options "$image" >&2
+
+    "$root/bench/runbench" -r "$reps" -l "$name/diskinfo" "$root/diskinfo" "$image"
+    "$root/bench/runbench" -r "$reps" -l "$name/disklist" "$root/disklist" "$image"
+    (
+        cd "$work/out"
+        "$root/bench/runbench" -r "$reps" -l "$name/diskget" "$root/diskget" "$image" /F0000001.DAT
+        "$root/bench/runbench" -r "$reps" -l "$name/diskget-r" -p "find '$work/out' -mindepth 1 -delete" \
+            "$root/diskget" "$image" -r
+    )
+
+    # Every put starts from the generated image
+    cp "$image" "$work/$name.orig"
+    (
+        cd "$work"
+        "$root/bench/runbench" -r "$reps" -l "$name/diskput" \
+            -p "cp '$work/$name.orig' '$image' && rm -f '$image.idx' '$image.wal'" \
+            "$root/diskput" "$image" /D0000001/PUT.BIN
+    )
+done <<CONFIGS
+floppy      -S 2880 -c 1 -d 2 -w 2 -n 64 -f 50 -F 0
+fragmented  -S 2880 -c 1 -d 2 -w 2 -n 64 -f 90 -F 60
+deep        -S 2880 -c 1 -d 6 -w 2 -n 400 -f 60 -F 10
+large       -S 60000 -c 16 -d 3 -w 4 -n 1000 -f 70 -F 10
+CONFIGS
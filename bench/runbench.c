@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/*
+runbench.c - Benchmark Timing Harness
+
+This program runs a command repeatedly and prints one JSON line describing it:
+wall time (minimum, median and maximum over the repetitions), user and system
+CPU time and page faults (medians), peak resident set size (the largest seen),
+the I/O counters from /proc/<pid>/io of the last run, and the number of system
+calls made, counted in one extra run under ptrace. Counters the system will not
+give out are reported as -1. The command reads from and writes to /dev/null.
+
+A preparation command, run through the shell before every repetition and not
+timed, restores whatever the command changes, such as an image written by diskput.
+
+Usage: ./runbench [-r repetitions] [-l label] [-p prepare_command] <command> [args...]
+*/
+
+// What one run measured
+struct Sample {
+    double wall_ms;
+    double user_ms;
+    double sys_ms;
+    long max_rss_kb;
+    long minor_faults;
+    long major_faults;
+    int status;
+};
+
+// Counters from /proc/<pid>/io, -1 when unreadable
+struct IoCounters {
+    long long rchar, wchar, syscr, syscw, read_bytes, write_bytes;
+};
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static double timeval_ms(const struct timeval *tv) {
+    return tv->tv_sec * 1e3 + tv->tv_usec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_longs(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Start argv with its output discarded, optionally stopping for a tracer first
+static pid_t launch(char *argv[], int traced) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0) {
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            close(null);
+        }
+        if (traced) {
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+            raise(SIGSTOP);
+        }
+        execvp(argv[0], argv);
+        perror("Error running command");
+        _exit(127);
+    }
+    return pid;
+}
+
+static void read_io(pid_t pid, struct IoCounters *io) {
+    memset(io, 0xFF, sizeof(*io));  // All -1
+    char path[64], name[32];
+    long long value;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+    while (fscanf(fp, "%31[^:]: %lld\n", name, &value) == 2) {
+        if (strcmp(name, "rchar") == 0) io->rchar = value;
+        else if (strcmp(name, "wchar") == 0) io->wchar = value;
+        else if (strcmp(name, "syscr") == 0) io->syscr = value;
+        else if (strcmp(name, "syscw") == 0) io->syscw = value;
+        else if (strcmp(name, "read_bytes") == 0) io->read_bytes = value;
+        else if (strcmp(name, "write_bytes") == 0) io->write_bytes = value;
+    }
+    fclose(fp);
+}
+
+// Time one run. The child is left unreaped until its /proc/<pid>/io has been read.
+static int run_once(char *argv[], struct Sample *sample, struct IoCounters *io) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = launch(argv, 0);
+    if (pid < 0) {
+        perror("Error starting command");
+        return -1;
+    }
+
+    siginfo_t info;
+    if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0) {
+        perror("Error waiting for command");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    read_io(pid, io);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("Error waiting for command");
+        return -1;
+    }
+    sample->wall_ms = elapsed_ms(&start, &end);
+    sample->user_ms = timeval_ms(&usage.ru_utime);
+    sample->sys_ms = timeval_ms(&usage.ru_stime);
+    sample->max_rss_kb = usage.ru_maxrss;
+    sample->minor_faults = usage.ru_minflt;
+    sample->major_faults = usage.ru_majflt;
+    sample->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return 0;
+}
+
+// Count the system calls of one run by stopping at every entry and exit; -1 if
+// tracing is not allowed here
+static long count_syscalls(char *argv[]) {
+    pid_t pid = launch(argv, 1);
+    if (pid < 0) {
+        return -1;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) {
+        return -1;
+    }
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL)) != 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+
+    // Stops alternate between entry and exit; the final exit_group has no exit stop
+    long stops = 0;
+    int signal = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)signal) != 0 || waitpid(pid, &status, 0) < 0) {
+            return -1;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) break;
+        signal = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            stops++;
+        } else if (WSTOPSIG(status) != SIGTRAP) {
+            signal = WSTOPSIG(status);  // Deliver the child's own signals
+        }
+    }
+    return (stops + 1) / 2;
+}
+
+static int prepare(const char *command) {
+    if (command && system(command) != 0) {
+        fprintf(stderr, "Error: preparation command failed: %s\n", command);
+        return -1;
+    }
+    return 0;
+}
+
+// Print s as a JSON string
+static void print_json_string(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            printf("\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            printf("\\u%04x", *s);
+        } else {
+            putchar(*s);
+        }
+    }
+    putchar('"');
+}
+
+int main(int argc, char *argv[]) {
+    int reps = 5;
+    const char *label = NULL, *prep = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "+r:l:p:")) != -1) {
+        switch (opt) {
+            case 'r': reps = atoi(optarg); break;
+            case 'l': label = optarg; break;
+            case 'p': prep = optarg; break;
+            default: reps = 0; break;
+        }
+    }
+    if (optind >= argc || reps < 1) {
+        fprintf(stderr, "Usage: %s [-r repetitions] [-l label] [-p prepare_command] <command> [args...]\n", argv[0]);
+        return 1;
+    }
+    char **command = argv + optind;
+
+    // Timed runs
+    struct Sample *samples = calloc(reps, sizeof(*samples));
+    double *values = calloc(reps, sizeof(*values));
+    long *counts = calloc(reps, sizeof(*counts));
+    if (!samples || !values || !counts) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+    struct IoCounters io;
+    for (int i = 0; i < reps; i++) {
+        if (prepare(prep) != 0 || run_once(command, &samples[i], &io) != 0) {
+            return 1;
+        }
+    }
+
+    // One traced run for the system call count
+    long syscalls = -1;
+    if (prepare(prep) == 0) {
+        syscalls = count_syscalls(command);
+    }
+
+    // Summarize; the exit status is the first nonzero one, so failures are not hidden
+    int status = 0;
+    long max_rss = 0;
+    for (int i = 0; i < reps; i++) {
+        if (status == 0) status = samples[i].status;
+        if (samples[i].max_rss_kb > max_rss) max_rss = samples[i].max_rss_kb;
+    }
+
+    printf("{\"label\":");
+    print_json_string(label ? label : command[0]);
+    printf(",\"command\":");
+    char joined[4096] = "";
+    for (char **arg = command; *arg; arg++) {
+        size_t used = strlen(joined);
+        snprintf(joined + used, sizeof(joined) - used, "%s%s", arg == command ? "" : " ", *arg);
+    }
+    print_json_string(joined);
+    printf(",\"reps\":%d,\"exit_status\":%d", reps, status);
+
+    for (int i = 0; i < reps; i++) values[i] = samples[i].wall_ms;
+    qsort(values, reps, sizeof(*values), compare_doubles);
+    printf(",\"wall_ms_min\":%.3f,\"wall_ms_median\":%.3f,\"wall_ms_max\":%.3f", values[0], values[reps / 2],
+           values[reps - 1]);
+    for (int i = 0; i < reps; i++) values[i] = samples[i].user_ms;
+    qsort(values, reps, sizeof(*values), compare_doubles);
+    printf(",\"user_ms\":%.3f", values[reps / 2]);
+    for (int i = 0; i < reps; i++) values[i] = samples[i].sys_ms;
+    qsort(values, reps, sizeof(*values), compare_doubles);
+    printf(",\"sys_ms\":%.3f", values[reps / 2]);
+    for (int i = 0; i < reps; i++) counts[i] = samples[i].minor_faults;
+    qsort(counts, reps, sizeof(*counts), compare_longs);
+    printf(",\"minor_faults\":%ld", counts[reps / 2]);
+    for (int i = 0; i < reps; i++) counts[i] = samples[i].major_faults;
+    qsort(counts, reps, sizeof(*counts), compare_longs);
+    printf(",\"major_faults\":%ld,\"max_rss_kb\":%ld,\"syscalls\":%ld", counts[reps / 2], max_rss, syscalls);
+    printf(",\"read_syscalls\":%lld,\"write_syscalls\":%lld,\"rchar\":%lld,\"wchar\":%lld"
+           ",\"read_bytes\":%lld,\"write_bytes\":%lld}\n",
+           io.syscr, io.syscw, io.rchar, io.wchar, io.read_bytes, io.write_bytes);
+
+    free(samples);
+    free(values);
+    free(counts);
+    return 0;
+}
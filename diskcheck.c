@@ -0,0 +1,597 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "fat12.h"
+#include "batch.h"
+
+/*
+diskcheck.c - FAT Image Integrity Checker
+
+This program checks FAT12, FAT16 and FAT32 images for damage and, with -r, repairs it. It checks
+the boot sector against the image and the FAT, compares every FAT copy with the
+first, and then walks the directory tree once, following every chain through a
+FAT decoded up front. Each cluster records the file or directory that first
+reached it, so a chain that reaches one of its own clusters again is a loop and
+one that reaches another's is a cross-link, both found in time linear in the
+size of the FAT. Chains that run into free, reserved, bad or out-of-range
+entries, files whose size disagrees with their chain length, wrong "." and ".."
+entries, and clusters in use that no file or directory reaches (lost clusters)
+are reported too.
+
+Repairs follow what the first FAT copy and the first owner of each cluster say:
+broken chains end at their last good cluster, later owners lose the clusters
+they share, sizes are cut to the chain (and chains to the size), entries that
+cannot be salvaged are deleted, lost clusters are freed and the other FAT
+copies are rewritten from the first. All repairs to one image form a single
+journaled transaction (see diskput -t). Boot sector problems are only reported.
+
+Any number of images may be given, directly or through list files (-f), and are
+checked on a pool of worker threads (-j). The exit status follows fsck: 0 when
+every image is clean, 1 when problems were found and all repaired, 4 when some
+were left, 8 when an image could not be checked; each image adds its bits.
+
+Usage: ./diskcheck [-r] [-j threads] [-f list_file] [--format text|jsonl|csv] [--stats] <disk_image>...
+*/
+
+#define CHECK_CLEAN       0
+#define CHECK_REPAIRED    1
+#define CHECK_UNCORRECTED 4
+#define CHECK_FAILED      8
+
+#define RELEASED          0xFFFFFFFFu  // Owner of clusters cut from a chain, free to claim
+
+static int repair;
+
+struct Check {
+    struct Fat12Image img;
+    struct Fat12FatCache fat;   // Loaded only when repairing
+    uint32_t *next;             // Every FAT entry, decoded once and kept in step with repairs
+    uint32_t *owner;            // Item that first reached each cluster, 0 for none or RELEASED
+    uint32_t limit;             // One past the last data cluster
+    char **paths;               // Path of item i + 1
+    size_t path_count;
+    size_t path_capacity;
+    uint32_t files;
+    uint32_t directories;
+    uint32_t lost;
+    uint32_t problems;
+    uint32_t repaired;
+    enum OutputFormat format;
+    struct OutBuf *out;
+};
+
+// Report a problem at path; action says what the repair does, NULL if it does nothing
+static void problem(struct Check *c, const char *path, const char *action, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void problem(struct Check *c, const char *path, const char *action, const char *fmt, ...) {
+    c->problems++;
+    c->repaired += repair && action != NULL;
+    if (c->format != FORMAT_TEXT) {
+        return;
+    }
+
+    char message[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+    outbuf_printf(c->out, "%s: %s", path[0] ? path : "/", message);
+    if (repair && action) {
+        outbuf_printf(c->out, "; %s", action);
+    }
+    outbuf_printf(c->out, "\n");
+}
+
+// Change a FAT entry in the decoded view, and in the cache written back when repairing
+static void set_next(struct Check *c, uint32_t cluster, uint32_t value) {
+    c->next[cluster] = value;
+    if (repair) {
+        fat12_fat_set(&c->fat, cluster, value);
+    }
+}
+
+// Write a changed directory entry back when repairing
+static int write_entry(struct Check *c, off_t offset, const struct DirEntry *entry) {
+    return repair ? fat12_write_meta(&c->img, offset, entry, sizeof(*entry)) : 0;
+}
+
+// Check what the boot sector says against the image itself and the FAT
+static void check_boot(struct Check *c) {
+    const struct BootSector *bs = c->img.bs;
+    const struct Fat12Geometry *geo = &c->img.geo;
+
+    if (c->img.base[510] != 0x55 || c->img.base[511] != 0xAA) {
+        problem(c, "", NULL, "boot sector signature is missing");
+    }
+    uint64_t claimed = (uint64_t)geo->total_sectors * geo->bytes_per_sector;
+    if (claimed > c->img.size) {
+        problem(c, "", NULL, "image is %llu bytes shorter than its boot sector says",
+                (unsigned long long)(claimed - c->img.size));
+    }
+
+    uint32_t clusters = (geo->total_sectors - geo->data_offset / geo->bytes_per_sector) / geo->sectors_per_cluster;
+    uint32_t fat_entries = (uint32_t)((uint64_t)geo->fat_size * 8 / geo->fat_bits);
+    if ((uint64_t)clusters + 2 > fat_entries) {
+        problem(c, "", NULL, "each FAT holds %u entries, too few for %u clusters", fat_entries, clusters + 2);
+    }
+    if (clusters >= FAT12_BAD - 1) {
+        problem(c, "", NULL, "%u clusters are too many for FAT32", clusters);
+    }
+
+    // The first FAT entry repeats the media descriptor in its low byte, with every
+    // other bit set; compared as decoded, where high values read as their FAT32 forms
+    uint32_t mask = c->img.codec->mask;
+    uint32_t media = (mask & ~0xFFu) | bs->media_type;
+    if (media >= mask - 8) {
+        media |= FAT12_EOC_MARK & ~mask;
+    }
+    if (c->next[0] != media) {
+        int digits = geo->fat_bits / 4;
+        problem(c, "", "rewritten", "FAT entry 0 is 0x%0*X, not 0x%0*X for media descriptor 0x%02X", digits,
+                c->next[0] & mask, digits, media & mask, bs->media_type);
+        set_next(c, 0, media);
+    }
+}
+
+// Compare every FAT copy with the first over the entries in use
+static void check_fat_copies(struct Check *c) {
+    FAT12_PHASE(FAT12_PHASE_FAT);
+    const struct Fat12Geometry *geo = &c->img.geo;
+    uint32_t bytes = (uint32_t)(((uint64_t)c->limit * geo->fat_bits + 7) / 8);
+    uint32_t *other = NULL;
+    for (uint32_t copy = 1; copy < geo->num_fats; copy++) {
+        const uint8_t *fat = c->img.fat + (size_t)copy * geo->fat_size;
+        FAT12_STAT_READ(geo->fat_offset + (uint64_t)copy * geo->fat_size, bytes);
+        if (memcmp(fat, c->img.fat, bytes) == 0) {
+            continue;
+        }
+
+        if (!other && !(other = malloc(c->limit * sizeof(*other)))) {
+            fprintf(stderr, "Memory allocation error\n");
+            return;
+        }
+        c->img.codec->decode(fat, 0, c->limit, other);
+        uint32_t differing = 0;
+        for (uint32_t i = 0; i < c->limit; i++) {
+            differing += other[i] != c->next[i];
+        }
+        problem(c, "", "copied from FAT 1", "FAT %u differs from FAT 1 in %u of %u entries", copy + 1, differing,
+                c->limit);
+        if (repair) {
+            memset(c->fat.dirty, 1, c->fat.sectors);  // Flushing rewrites every copy
+        }
+    }
+    free(other);
+}
+
+// Give a new file or directory a number for the ownership array
+static uint32_t add_item(struct Check *c, const char *path) {
+    if (c->path_count == c->path_capacity) {
+        size_t capacity = c->path_capacity ? c->path_capacity * 2 : 64;
+        char **grown = realloc(c->paths, capacity * sizeof(*grown));
+        if (!grown) {
+            fprintf(stderr, "Memory allocation error\n");
+            return 0;
+        }
+        c->paths = grown;
+        c->path_capacity = capacity;
+    }
+    if (!(c->paths[c->path_count] = strdup(path))) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 0;
+    }
+    return ++c->path_count;
+}
+
+// Claim the chain starting at first, whose first cluster is free to claim, ending
+// it early where it breaks, loops or runs into another chain. Returns its length.
+static uint32_t walk_chain(struct Check *c, uint32_t first, uint32_t item) {
+    const char *path = c->paths[item - 1];
+    uint32_t cluster = first, length = 1;
+    c->owner[first] = item;
+    for (;;) {
+        uint32_t next = c->next[cluster];
+        if (next >= FAT12_EOC) {
+            return length;
+        }
+        int in_range = next >= 2 && next < c->limit;
+        if (in_range && (c->owner[next] == 0 || c->owner[next] == RELEASED)) {
+            c->owner[next] = item;
+            cluster = next;
+            length++;
+            continue;
+        }
+
+        char action[64];
+        snprintf(action, sizeof(action), "chain ended at cluster %u", cluster);
+        if (in_range && c->owner[next] == item) {
+            problem(c, path, action, "chain loops back to cluster %u after %u cluster(s)", next, length);
+        } else if (in_range) {
+            problem(c, path, action, "cluster %u is also used by %s", next, c->paths[c->owner[next] - 1]);
+        } else if (next == 0) {
+            problem(c, path, action, "cluster %u is marked free", cluster);
+        } else if (next == FAT12_BAD) {
+            problem(c, path, action, "cluster %u is marked bad", cluster);
+        } else {
+            problem(c, path, action, "cluster %u links to cluster %u, outside the data area", cluster, next);
+        }
+        set_next(c, cluster, FAT12_EOC_MARK);
+        return length;
+    }
+}
+
+// Give up every cluster of a chain after the first keep, ending it there. The
+// clusters given up may be the tail of a later file cross-linked into this chain,
+// so they are released for it to claim; those still unclaimed at the end are freed.
+static void trim_chain(struct Check *c, uint32_t first, uint32_t keep) {
+    uint32_t cluster = first;
+    for (uint32_t i = 1; i < keep; i++) {
+        cluster = c->next[cluster];
+    }
+    uint32_t next = keep > 0 ? c->next[cluster] : first;
+    if (keep > 0) {
+        set_next(c, cluster, FAT12_EOC_MARK);
+    }
+    while (next >= 2 && next < c->limit) {
+        c->owner[next] = RELEASED;
+        next = c->next[next];
+    }
+}
+
+// Pending directory of the walk
+struct PendingDir {
+    uint32_t cluster;           // 0 for the root
+    uint32_t parent;            // Its parent's cluster, 0 for the root
+    const char *path;           // Owned by the item list; "" for the root
+};
+
+// Check one entry of a directory at offset in the image, named by its long name when
+// it has one; a subdirectory to walk is stored in *subdir (cluster 0 when there is none)
+static int check_entry(struct Check *c, const struct DirEntry *entry, const char *long_name, off_t offset,
+                       const struct PendingDir *dir, struct PendingDir *subdir) {
+    subdir->cluster = 0;
+    char short_name[13];
+    fat12_entry_name(entry, short_name);
+    const char *name = long_name[0] ? long_name : short_name;
+    char *path = malloc(strlen(dir->path) + strlen(name) + 2);
+    if (!path) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    sprintf(path, "%s/%s", dir->path, name);
+
+    int is_dir = (entry->attributes & FAT12_ATTR_DIRECTORY) != 0;
+    struct DirEntry fixed = *entry;
+    uint32_t first = fat12_entry_cluster(&c->img, entry);
+    const char *drop = is_dir ? "entry deleted" : "emptied";
+    int rc = 0;
+    if (is_dir) {
+        c->directories++;
+    } else {
+        c->files++;
+    }
+
+    if (first == 0 && is_dir) {
+        problem(c, path, drop, "directory has no clusters");
+    } else if (first == 0 && entry->file_size > 0) {
+        problem(c, path, "size set to 0", "size is %u bytes but there are no clusters", entry->file_size);
+    } else if (first != 0 && (first < 2 || first >= c->limit)) {
+        problem(c, path, drop, "starts at cluster %u, outside the data area", first);
+    } else if (first != 0 && c->owner[first] != 0 && c->owner[first] != RELEASED) {
+        problem(c, path, drop, "starts at cluster %u, which %s already uses", first, c->paths[c->owner[first] - 1]);
+    } else if (first != 0) {
+        uint32_t item = add_item(c, path);
+        if (item == 0) {
+            free(path);
+            return -1;
+        }
+        uint32_t length = walk_chain(c, first, item);
+        uint32_t needed = (entry->file_size + c->img.geo.cluster_size - 1) / c->img.geo.cluster_size;
+        if (is_dir) {
+            *subdir = (struct PendingDir){first, dir->cluster, c->paths[item - 1]};
+        } else if (length > needed) {
+            problem(c, path, "extra clusters freed", "%u cluster(s) hold only %u bytes", length,
+                    entry->file_size);
+            trim_chain(c, first, needed);
+            fat12_set_entry_cluster(&c->img, &fixed, needed > 0 ? first : 0);
+        } else if (length < needed) {
+            problem(c, path, "size cut to the chain", "size is %u bytes but the chain has only %u cluster(s)",
+                    entry->file_size, length);
+            fixed.file_size = length * c->img.geo.cluster_size;
+        }
+        free(path);
+        return memcmp(&fixed, entry, sizeof(fixed)) != 0 ? write_entry(c, offset, &fixed) : 0;
+    }
+
+    // Only the problems above reach here, and none leaves a chain worth keeping
+    if (first != 0 || is_dir || entry->file_size > 0) {
+        if (is_dir) {
+            fixed.filename[0] = (char)FAT12_ENTRY_DELETED;
+        }
+        fat12_set_entry_cluster(&c->img, &fixed, 0);
+        fixed.file_size = 0;
+        rc = write_entry(c, offset, &fixed);
+    }
+    free(path);
+    return rc;
+}
+
+// Check that a "." or ".." entry names the right cluster
+static int check_dot(struct Check *c, const struct DirEntry *entry, off_t offset, const struct PendingDir *dir) {
+    int dotdot = entry->filename[1] == '.';
+    uint32_t expected = dotdot ? dir->parent : dir->cluster;
+    uint32_t named = fat12_entry_cluster(&c->img, entry);
+    if (named == expected) {
+        return 0;
+    }
+    problem(c, dir->path, "corrected", "\"%s\" names cluster %u instead of %u", dotdot ? ".." : ".", named,
+            expected);
+    struct DirEntry fixed = *entry;
+    fat12_set_entry_cluster(&c->img, &fixed, expected);
+    return write_entry(c, offset, &fixed);
+}
+
+// Check every entry of one directory, adding its subdirectories to the stack
+static int check_directory(struct Check *c, const struct PendingDir *dir, struct PendingDir **stack, size_t *top,
+                           size_t *capacity) {
+    const struct Fat12Geometry *geo = &c->img.geo;
+    uint32_t cluster = fat12_dir_cluster(&c->img, dir->cluster);
+    off_t offset = cluster ? fat12_cluster_offset(&c->img, cluster) : (off_t)geo->root_dir_offset;
+    uint32_t count = cluster ? geo->cluster_size / sizeof(struct DirEntry) : geo->root_dir_entries;
+    struct Fat12LfnState lfn;
+    memset(&lfn, 0, sizeof(lfn));
+    char long_name[FAT12_NAME_MAX];
+
+    for (;;) {
+        FAT12_STAT_READ(offset, count * sizeof(struct DirEntry));
+        const struct DirEntry *entries = (const struct DirEntry *)(c->img.base + offset);
+        for (uint32_t i = 0; i < count; i++) {
+            const struct DirEntry *entry = &entries[i];
+            off_t entry_offset = offset + (off_t)i * sizeof(struct DirEntry);
+            if ((uint8_t)entry->filename[0] == FAT12_ENTRY_FREE) {
+                return 0;
+            }
+            if ((uint8_t)entry->filename[0] == FAT12_ENTRY_DELETED || entry->attributes == FAT12_ATTR_LFN ||
+                (entry->attributes & FAT12_ATTR_VOLUME_ID)) {
+                if (entry->attributes == FAT12_ATTR_LFN && (uint8_t)entry->filename[0] != FAT12_ENTRY_DELETED) {
+                    fat12_lfn_feed(&lfn, entry);
+                } else {
+                    lfn.count = 0;
+                }
+                continue;
+            }
+            fat12_lfn_take(&lfn, entry, long_name);
+            if (entry->filename[0] == '.') {
+                if (dir->cluster && check_dot(c, entry, entry_offset, dir) != 0) {
+                    return -1;
+                }
+                continue;
+            }
+
+            struct PendingDir subdir;
+            if (check_entry(c, entry, long_name, entry_offset, dir, &subdir) != 0) {
+                return -1;
+            }
+            if (subdir.cluster == 0) {
+                continue;
+            }
+            if (*top == *capacity) {
+                size_t grown_capacity = *capacity ? *capacity * 2 : 64;
+                struct PendingDir *grown = realloc(*stack, grown_capacity * sizeof(*grown));
+                if (!grown) {
+                    fprintf(stderr, "Memory allocation error\n");
+                    return -1;
+                }
+                *stack = grown;
+                *capacity = grown_capacity;
+            }
+            (*stack)[(*top)++] = subdir;
+        }
+
+        // The chain was already claimed and cut where it broke, so this ends
+        if (cluster == 0 || c->next[cluster] >= FAT12_EOC) {
+            return 0;
+        }
+        cluster = c->next[cluster];
+        offset = fat12_cluster_offset(&c->img, cluster);
+    }
+}
+
+// Walk the whole tree from the root, claiming every chain
+static int check_tree(struct Check *c) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    struct PendingDir *stack = malloc(64 * sizeof(*stack));
+    size_t top = 0, capacity = 64;
+    if (!stack) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    stack[top++] = (struct PendingDir){0, 0, ""};
+
+    // A FAT32 root is a chain like any other directory's and is claimed first
+    uint32_t root = c->img.geo.root_cluster;
+    if (root != 0) {
+        uint32_t item = add_item(c, "");
+        if (item == 0) {
+            free(stack);
+            return -1;
+        }
+        walk_chain(c, root, item);
+    }
+
+    int rc = 0;
+    while (rc == 0 && top > 0) {
+        struct PendingDir dir = stack[--top];
+        rc = check_directory(c, &dir, &stack, &top, &capacity);
+    }
+    free(stack);
+    return rc;
+}
+
+// Free the clusters in use that no file or directory reached, and those released
+// by trimmed chains that nothing claimed; bad clusters stay marked
+static void check_lost(struct Check *c) {
+    FAT12_PHASE(FAT12_PHASE_FAT);
+    for (uint32_t cluster = 2; cluster < c->limit; cluster++) {
+        if (c->owner[cluster] == RELEASED) {
+            c->owner[cluster] = 0;
+            set_next(c, cluster, 0);
+        } else if (c->owner[cluster] == 0 && c->next[cluster] != 0 && c->next[cluster] != FAT12_BAD) {
+            c->lost++;
+            set_next(c, cluster, 0);
+        }
+    }
+    if (c->lost > 0) {
+        problem(c, "", "freed", "%u lost cluster(s) in use by no file or directory", c->lost);
+    }
+}
+
+// Run every check on an open image, repairing inside a transaction when asked
+static int check_image(struct Check *c, const char *path) {
+    c->limit = c->img.geo.total_clusters + 2;
+    c->next = malloc(c->limit * sizeof(*c->next));
+    c->owner = calloc(c->limit, sizeof(*c->owner));
+    if (!c->next || !c->owner) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    {
+        FAT12_PHASE(FAT12_PHASE_FAT);
+        FAT12_STAT_READ(c->img.geo.fat_offset, ((uint64_t)c->limit * c->img.geo.fat_bits + 7) / 8);
+        c->img.codec->decode(c->img.fat, 0, c->limit, c->next);
+    }
+
+    struct Fat12Index index;
+    int indexed = 0;
+    struct Fat12Journal journal;
+    if (repair) {
+        indexed = fat12_index_open(&index, &c->img, path) == 0;
+        if (indexed) {
+            fat12_index_close(&index);
+        }
+        if (fat12_fat_load(&c->img, &c->fat) != 0 || fat12_journal_begin(&journal, &c->img, path) != 0) {
+            return -1;
+        }
+    }
+
+    check_fat_copies(c);
+    check_boot(c);
+    int rc = check_tree(c);
+    if (rc == 0) {
+        check_lost(c);
+    }
+
+    if (repair) {
+        if (rc == 0 && c->repaired > 0) {
+            rc = fat12_fat_flush(&c->img, &c->fat) != 0 || fat12_journal_commit(&journal) != 0 ? -1 : 0;
+        }
+        fat12_journal_end(&journal);
+        if (rc == 0 && c->repaired > 0 && indexed && fat12_index_build(&c->img, path, NULL) != 0) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+// Report the outcome for one image
+static void render(const struct Check *c, const char *path, int status, struct OutBuf *out) {
+    uint32_t used = 0;
+    for (uint32_t cluster = 2; cluster < c->limit; cluster++) {
+        used += c->next[cluster] != 0;
+    }
+
+    if (c->format == FORMAT_TEXT) {
+        outbuf_printf(out, "%u file(s) and %u directories, %u of %u clusters in use: ", c->files, c->directories,
+                      used, c->limit - 2);
+        if (c->problems == 0) {
+            outbuf_printf(out, "clean\n");
+        } else if (repair) {
+            outbuf_printf(out, "%u problem(s), %u repaired\n", c->problems, c->repaired);
+        } else {
+            outbuf_printf(out, "%u problem(s)\n", c->problems);
+        }
+        return;
+    }
+
+    if (c->format == FORMAT_JSONL) {
+        outbuf_printf(out, "{\"image\":");
+        outbuf_json_string(out, path);
+        outbuf_printf(out, ",\"status\":%d,\"files\":%u,\"directories\":%u,\"used_clusters\":%u,"
+                      "\"total_clusters\":%u,\"lost_clusters\":%u,\"problems\":%u,\"repaired\":%u}\n",
+                      status, c->files, c->directories, used, c->limit - 2, c->lost, c->problems, c->repaired);
+    } else {
+        outbuf_csv_field(out, path);
+        outbuf_printf(out, ",%d,%u,%u,%u,%u,%u,%u,%u\n", status, c->files, c->directories, used, c->limit - 2,
+                      c->lost, c->problems, c->repaired);
+    }
+}
+
+// Check one image into out; returns its fsck-style status
+static int check_one(const char *path, enum OutputFormat format, struct OutBuf *out) {
+    // A journal left by an interrupted commit is finished before anything else
+    char wal[4200];
+    snprintf(wal, sizeof(wal), "%s.wal", path);
+    int pending = access(wal, F_OK) == 0;
+
+    struct Check c;
+    memset(&c, 0, sizeof(c));
+    c.format = format;
+    c.out = out;
+    if (fat12_open(&c.img, path, repair) != 0) {
+        return CHECK_FAILED;
+    }
+    if (pending && repair && fat12_journal_recover(&c.img, path) != 0) {
+        fat12_close(&c.img);
+        return CHECK_FAILED;
+    }
+    if (pending && !repair) {
+        problem(&c, "", NULL, "an interrupted commit is waiting in %s", wal);
+    }
+
+    int status;
+    if (check_image(&c, path) != 0) {
+        status = CHECK_FAILED;
+    } else {
+        status = c.problems == 0 ? CHECK_CLEAN : c.repaired == c.problems ? CHECK_REPAIRED : CHECK_UNCORRECTED;
+        render(&c, path, status, out);
+    }
+
+    for (size_t i = 0; i < c.path_count; i++) {
+        free(c.paths[i]);
+    }
+    free(c.paths);
+    free(c.next);
+    free(c.owner);
+    fat12_fat_release(&c.fat);
+    fat12_close(&c.img);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    fat12_stats_option(&argc, argv);
+
+    // Check command line arguments
+    repair = argc > 1 && strcmp(argv[1], "-r") == 0;
+    struct ImageList images;
+    if (image_list_parse(&images, argc, argv, repair ? 2 : 1) != 0) {
+        fprintf(stderr,
+                "Usage: %s [-r] [-j threads] [-f list_file] [--format text|jsonl|csv] [--stats] <disk_image>...\n",
+                argv[0]);
+        image_list_free(&images);
+        return CHECK_FAILED;
+    }
+
+    if (images.format == FORMAT_CSV) {
+        printf("image,status,files,directories,used_clusters,total_clusters,lost_clusters,problems,repaired\n");
+    }
+
+    int status = image_list_run(&images, check_one);
+    image_list_free(&images);
+    return status;
+}
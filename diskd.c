@@ -0,0 +1,607 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "fat12.h"
+#include "batch.h"
+#include "report.h"
+#include "putsession.h"
+#include "diskd.h"
+
+/*
+diskd.c - FAT12 Image Server
+
+This program keeps FAT12 images open between requests so that repeated runs of the
+tools do not pay for opening, mapping and walking the same image every time. Each
+image it serves stays mapped with an in-memory directory index (see diskindex) and
+the diskinfo and disklist output already rendered, in a cache of the most recently
+used images; the least recently used image is dropped once the cache is full.
+
+Requests arrive over a local Unix socket (see diskd.h for the protocol), each
+connection on its own thread. Any number of requests may read one image at once;
+a put takes the image exclusively, is committed as a transaction through the
+image's write-ahead journal, and afterwards the index is rebuilt and the rendered
+reports dropped. An image changed by anything else is noticed by its size,
+modification time or inode and simply reloaded.
+
+The tools use the daemon when $DISKD_SOCKET names its socket and work locally
+otherwise, printing exactly what they would print on their own.
+
+With --stats, the I/O counts and timings of every request served are printed
+when the daemon shuts down.
+
+Usage: ./diskd [-s socket] [-n cached_images] [--stats]
+*/
+
+// Report kinds and formats cached per image
+#define REPORT_INFO 0
+#define REPORT_LIST 1
+#define FORMAT_COUNT 3
+
+// A rendered report and the image name it was rendered under
+struct CachedReport {
+    int ready;
+    int status;
+    char *name;
+    struct OutBuf output;
+};
+
+// One image kept open between requests
+struct CachedImage {
+    char *path;
+    dev_t dev;                  // Identity of the file when it was loaded
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct Fat12Image img;
+    struct Fat12Index index;
+    int indexed;
+    struct CachedReport reports[2][FORMAT_COUNT];
+    pthread_rwlock_t lock;      // Shared while serving reads, exclusive for put
+    pthread_mutex_t render_lock;
+    int refs;                   // Requests using the image; guarded by cache_lock
+    int retired;                // No longer in the cache; the last release frees it
+    uint64_t last_used;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct CachedImage **cache;
+static size_t cache_count;
+static size_t cache_limit = 16;
+static uint64_t cache_clock;
+
+static volatile sig_atomic_t stopping;
+
+static int send_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Send a status line and its payload
+static int send_reply(int fd, int status, const void *data, size_t len) {
+    static const char *const words[] = {"OK", "FAIL", "ERR"};
+    char line[64];
+    int n = snprintf(line, sizeof(line), "%s %zu\n", words[status], len);
+    if (send_all(fd, line, n) != 0) {
+        return -1;
+    }
+    return send_all(fd, data, len);
+}
+
+static int send_message(int fd, int status, const char *message) {
+    return send_reply(fd, status, message, strlen(message));
+}
+
+static int same_file(const struct CachedImage *image, const struct stat *st) {
+    return image->dev == st->st_dev && image->ino == st->st_ino && image->size == st->st_size &&
+           image->mtime.tv_sec == st->st_mtim.tv_sec && image->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void remember_identity(struct CachedImage *image, const struct stat *st) {
+    image->dev = st->st_dev;
+    image->ino = st->st_ino;
+    image->size = st->st_size;
+    image->mtime = st->st_mtim;
+}
+
+// Drop every rendered report, for instance after the image changed
+static void clear_reports(struct CachedImage *image) {
+    for (int kind = 0; kind < 2; kind++) {
+        for (int format = 0; format < FORMAT_COUNT; format++) {
+            struct CachedReport *report = &image->reports[kind][format];
+            free(report->name);
+            outbuf_free(&report->output);
+            memset(report, 0, sizeof(*report));
+        }
+    }
+}
+
+static void image_free(struct CachedImage *image) {
+    clear_reports(image);
+    if (image->indexed) {
+        fat12_index_close(&image->index);
+    }
+    fat12_close(&image->img);
+    pthread_rwlock_destroy(&image->lock);
+    pthread_mutex_destroy(&image->render_lock);
+    free(image->path);
+    free(image);
+}
+
+// Open and map an image and index its directory tree; returns NULL on failure
+static struct CachedImage *image_load(const char *path, const struct stat *st) {
+    struct CachedImage *image = calloc(1, sizeof(*image));
+    if (!image || !(image->path = strdup(path))) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(image);
+        return NULL;
+    }
+    if (fat12_open(&image->img, path, 0) != 0) {
+        free(image->path);
+        free(image);
+        return NULL;
+    }
+    image->indexed = fat12_index_build_memory(&image->index, &image->img) == 0;
+    remember_identity(image, st);
+    pthread_rwlock_init(&image->lock, NULL);
+    pthread_mutex_init(&image->render_lock, NULL);
+    return image;
+}
+
+// Take an image out of the cache; the caller holds cache_lock
+static void cache_remove(size_t i) {
+    struct CachedImage *image = cache[i];
+    cache[i] = cache[--cache_count];
+    image->retired = 1;
+    if (image->refs == 0) {
+        image_free(image);
+    }
+}
+
+// Find or load the image at path and take a reference to it. Returns NULL after
+// putting the reason in reply.
+static struct CachedImage *cache_acquire(const char *path, struct OutBuf *reply) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        outbuf_printf(reply, "Error opening disk image: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i]->path, path) != 0) continue;
+        if (same_file(cache[i], &st)) {
+            struct CachedImage *image = cache[i];
+            image->refs++;
+            image->last_used = ++cache_clock;
+            pthread_mutex_unlock(&cache_lock);
+            return image;
+        }
+        cache_remove(i);  // Changed since it was loaded
+        break;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    // Load outside the lock so other images are served meanwhile
+    struct CachedImage *image = image_load(path, &st);
+    if (!image) {
+        outbuf_printf(reply, "Error: cannot open disk image %s\n", path);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i]->path, path) != 0) continue;
+        if (same_file(cache[i], &st)) {
+            // Another request loaded the same image first
+            image_free(image);
+            image = cache[i];
+            image->refs++;
+            image->last_used = ++cache_clock;
+            pthread_mutex_unlock(&cache_lock);
+            return image;
+        }
+        cache_remove(i);
+        break;
+    }
+
+    // Evict the least recently used images that are not in use
+    while (cache_count >= cache_limit) {
+        size_t victim = cache_count;
+        for (size_t i = 0; i < cache_count; i++) {
+            if (cache[i]->refs == 0 && (victim == cache_count || cache[i]->last_used < cache[victim]->last_used)) {
+                victim = i;
+            }
+        }
+        if (victim == cache_count) break;  // Everything is busy; grow past the limit for now
+        cache_remove(victim);
+    }
+    struct CachedImage **grown = realloc(cache, (cache_count + 1) * sizeof(*cache));
+    if (!grown) {
+        pthread_mutex_unlock(&cache_lock);
+        image_free(image);
+        outbuf_printf(reply, "Memory allocation error\n");
+        return NULL;
+    }
+    cache = grown;
+    cache[cache_count++] = image;
+    image->refs = 1;
+    image->last_used = ++cache_clock;
+    pthread_mutex_unlock(&cache_lock);
+    return image;
+}
+
+static void cache_release(struct CachedImage *image) {
+    pthread_mutex_lock(&cache_lock);
+    if (--image->refs == 0 && image->retired) {
+        image_free(image);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// info and list: argument "<format> <image name as given>"
+static int serve_report(int fd, struct CachedImage *image, int kind, const char *arg) {
+    char format_name[16];
+    enum OutputFormat format;
+    const char *name = strchr(arg, ' ');
+    size_t format_len = name ? (size_t)(name - arg) : strlen(arg);
+    name = name ? name + 1 : image->path;
+    if (format_len >= sizeof(format_name)) {
+        return send_message(fd, DISKD_ERR, "Error: unknown output format\n");
+    }
+    memcpy(format_name, arg, format_len);
+    format_name[format_len] = '\0';
+    if (output_format_parse(format_name, &format) != 0) {
+        return send_message(fd, DISKD_ERR, "Error: unknown output format\n");
+    }
+
+    // Render once per format and name; later requests copy the cached output
+    struct OutBuf output = {0};
+    pthread_rwlock_rdlock(&image->lock);
+    pthread_mutex_lock(&image->render_lock);
+    struct CachedReport *report = &image->reports[kind][format];
+    if (!report->ready || strcmp(report->name, name) != 0) {
+        free(report->name);
+        outbuf_free(&report->output);
+        report->name = strdup(name);
+        if (kind == REPORT_INFO) {
+            report->status = info_render(&image->img, name, format, &report->output);
+        } else {
+            report->status = list_render(&image->img, image->indexed ? &image->index : NULL, name, format,
+                                         &report->output);
+        }
+        report->ready = report->name != NULL;
+    }
+    int status = report->status;
+    outbuf_write(&output, report->output.data, report->output.len);
+    pthread_mutex_unlock(&image->render_lock);
+    pthread_rwlock_unlock(&image->lock);
+
+    int rc;
+    if (status == 0) {
+        rc = send_reply(fd, DISKD_OK, output.data, output.len);
+    } else {
+        rc = send_message(fd, DISKD_ERR, "Error: cannot read the directory tree\n");
+    }
+    outbuf_free(&output);
+    return rc;
+}
+
+// get: argument is the file's path in the image
+static int serve_get(int fd, struct CachedImage *image, const char *path) {
+    pthread_rwlock_rdlock(&image->lock);
+
+    const struct Fat12IndexRecord *record = image->indexed ? fat12_index_find(&image->index, path) : NULL;
+    const struct DirEntry *entry = NULL;
+    if (record) {
+        entry = fat12_index_entry(&image->img, record);
+    } else if (fat12_lookup(&image->img, path, &entry, NULL) != 0) {
+        entry = NULL;
+    }
+    if (!entry || (entry->attributes & 0x10)) {
+        pthread_rwlock_unlock(&image->lock);
+        return send_message(fd, DISKD_FAIL, "File not found.\n");
+    }
+
+    // Resolve the extents and make sure they cover the file before replying
+    uint32_t cluster_size = image->img.geo.cluster_size;
+    uint32_t clusters = (entry->file_size + cluster_size - 1) / cluster_size;
+    struct Fat12Extent *extents = NULL;
+    size_t extent_count = record ? record->extent_count : 0;
+    if (!record && fat12_chain_extents(&image->img, fat12_entry_cluster(&image->img, entry), clusters, &extents, &extent_count) != 0) {
+        pthread_rwlock_unlock(&image->lock);
+        return send_message(fd, DISKD_ERR, "Error reading file: bad cluster chain\n");
+    }
+    const struct Fat12Extent *runs = record ? image->index.extents + record->first_extent : extents;
+    uint64_t available = 0;
+    for (size_t i = 0; i < extent_count; i++) {
+        available += (uint64_t)runs[i].count * cluster_size;
+    }
+    if (available < entry->file_size) {
+        free(extents);
+        pthread_rwlock_unlock(&image->lock);
+        return send_message(fd, DISKD_ERR, "Error reading file: cluster chain ends early\n");
+    }
+
+    // Stream each extent straight from the image to the socket
+    char line[64];
+    int n = snprintf(line, sizeof(line), "OK %u\n", entry->file_size);
+    int rc = send_all(fd, line, n);
+    uint32_t bytes_remaining = entry->file_size;
+    for (size_t i = 0; rc == 0 && i < extent_count && bytes_remaining > 0; i++) {
+        uint64_t extent_bytes = (uint64_t)runs[i].count * cluster_size;
+        uint32_t to_write = bytes_remaining < extent_bytes ? bytes_remaining : extent_bytes;
+        rc = fat12_transfer(&image->img, fat12_cluster_offset(&image->img, runs[i].cluster), to_write, fd);
+        bytes_remaining -= to_write;
+    }
+    free(extents);
+    pthread_rwlock_unlock(&image->lock);
+    return rc;
+}
+
+// locate: argument is a destination path; a put there would get as far as its host
+// file if the directory part names an existing directory
+static int serve_locate(int fd, struct CachedImage *image, const char *dest) {
+    const char *filename = strrchr(dest, '/');
+    if (!filename || filename == dest) {
+        return send_reply(fd, DISKD_OK, NULL, 0);
+    }
+    char dirpath[4096];
+    if ((size_t)(filename - dest) >= sizeof(dirpath)) {
+        return send_message(fd, DISKD_FAIL, "The directory not found.\n");
+    }
+    memcpy(dirpath, dest, filename - dest);
+    dirpath[filename - dest] = '\0';
+
+    pthread_rwlock_rdlock(&image->lock);
+    const struct Fat12IndexRecord *record = image->indexed ? fat12_index_find(&image->index, dirpath) : NULL;
+    const struct DirEntry *entry = NULL;
+    if (record) {
+        entry = fat12_index_entry(&image->img, record);
+    } else if (fat12_lookup(&image->img, dirpath, &entry, NULL) != 0) {
+        entry = NULL;
+    }
+    int found = entry && (entry->attributes & 0x10) && fat12_entry_cluster(&image->img, entry) != 0;
+    pthread_rwlock_unlock(&image->lock);
+    return found ? send_reply(fd, DISKD_OK, NULL, 0) : send_message(fd, DISKD_FAIL, "The directory not found.\n");
+}
+
+// put: argument is the destination path; the payload follows the request line
+static int serve_put(int fd, FILE *in, const char *image_path, const char *dest, uint64_t size) {
+    // Take the whole payload first so the connection stays in step whatever happens
+    struct stat st;
+    int stat_error = stat(image_path, &st) != 0 ? errno : 0;
+    if (stat_error || size > (uint64_t)st.st_size) {
+        for (uint64_t i = 0; i < size && getc(in) != EOF; i++) {
+        }
+        if (stat_error) {
+            char message[256];
+            snprintf(message, sizeof(message), "Error opening disk image: %s\n", strerror(stat_error));
+            return send_message(fd, DISKD_ERR, message);
+        }
+        return send_message(fd, DISKD_FAIL, "No enough free space in the disk image.\n");
+    }
+    char *payload = malloc(size + 1);
+    if (!payload) {
+        return send_message(fd, DISKD_ERR, "Memory allocation error\n");
+    }
+    if (fread(payload, 1, size, in) != size) {
+        free(payload);
+        return -1;
+    }
+
+    struct OutBuf reply = {0};
+    struct CachedImage *image = cache_acquire(image_path, &reply);
+    if (!image) {
+        free(payload);
+        int rc = send_reply(fd, DISKD_ERR, reply.data, reply.len);
+        outbuf_free(&reply);
+        return rc;
+    }
+
+    // Readers of this image wait until the new contents are indexed
+    pthread_rwlock_wrlock(&image->lock);
+    struct PutSession session;
+    int rc = -1;
+    if (session_open(&session, image->path, 0, 1) == 0) {
+        session.messages = &reply;
+        FILE *input = fmemopen(payload, size ? size : 1, "rb");
+        rc = input ? put_stream(&session, input, size, dest) : -1;
+        if (input) {
+            fclose(input);
+        }
+        if (session_close(&session) != 0) {
+            rc = -1;
+        }
+    }
+
+    clear_reports(image);
+    if (image->indexed) {
+        fat12_index_close(&image->index);
+    }
+    image->indexed = fat12_index_build_memory(&image->index, &image->img) == 0;
+    if (fstat(image->img.fd, &st) == 0) {
+        pthread_mutex_lock(&cache_lock);
+        remember_identity(image, &st);
+        pthread_mutex_unlock(&cache_lock);
+    }
+    pthread_rwlock_unlock(&image->lock);
+    cache_release(image);
+    free(payload);
+
+    if (rc == 0) {
+        rc = send_reply(fd, DISKD_OK, NULL, 0);
+    } else if (reply.len > 0) {
+        rc = send_reply(fd, DISKD_FAIL, reply.data, reply.len);
+    } else {
+        rc = send_message(fd, DISKD_ERR, "Error: the file could not be written to the disk image\n");
+    }
+    outbuf_free(&reply);
+    return rc;
+}
+
+// Handle one request line; returns -1 when the connection should be closed
+static int serve_request(int fd, FILE *in, char *line) {
+    char *fields[4];
+    for (int i = 0; i < 4; i++) {
+        fields[i] = strsep(&line, "\t");
+        if (!fields[i]) {
+            return send_message(fd, DISKD_ERR, "Error: malformed request\n") == 0 ? 0 : -1;
+        }
+    }
+    const char *verb = fields[0], *image_path = fields[1], *arg = fields[2];
+    uint64_t size = strtoull(fields[3], NULL, 10);
+
+    if (strcmp(verb, "put") == 0) {
+        return serve_put(fd, in, image_path, arg, size);
+    }
+    int kind = strcmp(verb, "info") == 0 ? REPORT_INFO : strcmp(verb, "list") == 0 ? REPORT_LIST : -1;
+    int locate = strcmp(verb, "locate") == 0;
+    if (kind < 0 && !locate && strcmp(verb, "get") != 0) {
+        return send_message(fd, DISKD_ERR, "Error: unknown request\n");
+    }
+
+    struct OutBuf reply = {0};
+    struct CachedImage *image = cache_acquire(image_path, &reply);
+    if (!image) {
+        int rc = send_reply(fd, DISKD_ERR, reply.data, reply.len);
+        outbuf_free(&reply);
+        return rc;
+    }
+    int rc = locate ? serve_locate(fd, image, arg)
+             : kind < 0 ? serve_get(fd, image, arg) : serve_report(fd, image, kind, arg);
+    cache_release(image);
+    return rc;
+}
+
+static void *serve_connection(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    int in_fd = dup(fd);
+    FILE *in = in_fd >= 0 ? fdopen(in_fd, "rb") : NULL;
+    if (!in) {
+        if (in_fd >= 0) close(in_fd);
+        close(fd);
+        return NULL;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_cap, in)) > 0) {
+        if (line[line_len - 1] == '\n') {
+            line[--line_len] = '\0';
+        }
+        if (serve_request(fd, in, line) != 0) break;
+    }
+
+    free(line);
+    fclose(in);
+    close(fd);
+    return NULL;
+}
+
+static void stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+int main(int argc, char *argv[]) {
+    fat12_stats_option(&argc, argv);
+    const char *socket_path = getenv("DISKD_SOCKET");
+    if (!socket_path || socket_path[0] == '\0') {
+        socket_path = DISKD_DEFAULT_SOCKET;
+    }
+
+    // Check command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            cache_limit = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-s socket] [-n cached_images] [--stats]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        fprintf(stderr, "Error creating socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Replace a socket left behind by a daemon that is gone, but not a live one
+    if (connect(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "Error: diskd is already serving %s\n", socket_path);
+        close(listener);
+        return 1;
+    }
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path);
+    }
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        fprintf(stderr, "Error listening on %s: %s\n", socket_path, strerror(errno));
+        close(listener);
+        return 1;
+    }
+
+    // Clients that hang up must not take the daemon with them; SIGINT and SIGTERM
+    // interrupt accept so the socket can be removed
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    fprintf(stderr, "diskd: serving on %s\n", socket_path);
+    while (!stopping) {
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "Error accepting connection: %s\n", strerror(errno));
+            break;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, serve_connection, (void *)(intptr_t)fd) != 0) {
+            close(fd);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
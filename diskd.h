@@ -0,0 +1,52 @@
+#ifndef DISKD_H
+#define DISKD_H
+
+#include <stdint.h>
+
+#include "batch.h"
+
+/*
+diskd.h - Image Server Protocol
+
+diskd keeps recently used images mapped, with their FAT, directory index and
+rendered reports, and serves the tools over a local Unix socket. Each request is
+one line of tab-separated fields,
+
+    <verb>\t<absolute image path>\t<argument>\t<payload size>\n
+
+followed by the payload bytes (put only). Verbs and their argument:
+    info  output format (text, jsonl or csv), a space, and the image name to
+          show in records
+    list  same as info
+    get   path of the file in the image
+    put   destination path in the image; the payload is the file contents
+    locate  destination path in the image; succeeds when its directory exists,
+            so a client can report a missing directory before a missing host file
+Every reply is a status line "OK <n>\n", "FAIL <n>\n" or "ERR <n>\n" followed by
+n bytes: the result, a message for the user, or a diagnostic. A connection may
+carry any number of requests.
+*/
+
+// Socket used when neither -s nor $DISKD_SOCKET names one
+#define DISKD_DEFAULT_SOCKET "/tmp/diskd.sock"
+
+// Reply status codes
+#define DISKD_OK   0            // Payload is the result
+#define DISKD_FAIL 1            // Payload is a message for stdout, as the tool would print it
+#define DISKD_ERR  2            // Payload is a diagnostic for stderr
+
+// Connect to the daemon named by $DISKD_SOCKET. Returns the socket, or -1 (silently)
+// when client mode is off or no daemon answers, in which case the tool works locally.
+int diskd_connect(void);
+
+// Send one request on fd. On DISKD_OK the payload is written to a new file at
+// out_path if one is given, otherwise appended to reply; other payloads always go
+// to reply. Returns the reply status, or -1 with a diagnostic if the exchange failed.
+int diskd_request(int fd, const char *verb, const char *image, const char *arg, int in_fd, uint64_t in_size,
+                  struct OutBuf *reply, const char *out_path);
+
+// Have the daemon render a diskinfo ("info") or disklist ("list") report into out.
+// Returns the image's exit status, or -1 when there is no daemon to ask.
+int diskd_report(const char *verb, const char *image, enum OutputFormat format, struct OutBuf *out);
+
+#endif
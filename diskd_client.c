@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "batch.h"
+#include "diskd.h"
+
+/*
+diskd_client.c - Image Server Client
+
+The client side of the diskd protocol, linked into every tool. A tool first tries
+diskd_connect; only when $DISKD_SOCKET is set and a daemon is listening there does
+it forward its request, and otherwise it does the work itself as before.
+*/
+
+static int send_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int diskd_connect(void) {
+    const char *path = getenv("DISKD_SOCKET");
+    if (!path || path[0] == '\0') {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Read the "<STATUS> <n>\n" line of a reply
+static int read_status(int fd, int *status, uint64_t *size) {
+    char line[64];
+    size_t len = 0;
+    while (len < sizeof(line) - 1) {
+        ssize_t n = read(fd, line + len, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        if (line[len] == '\n') break;
+        len++;
+    }
+    line[len] = '\0';
+
+    char word[8];
+    unsigned long long n;
+    if (sscanf(line, "%7s %llu", word, &n) != 2) {
+        return -1;
+    }
+    if (strcmp(word, "OK") == 0) {
+        *status = DISKD_OK;
+    } else if (strcmp(word, "FAIL") == 0) {
+        *status = DISKD_FAIL;
+    } else if (strcmp(word, "ERR") == 0) {
+        *status = DISKD_ERR;
+    } else {
+        return -1;
+    }
+    *size = n;
+    return 0;
+}
+
+int diskd_request(int fd, const char *verb, const char *image, const char *arg, int in_fd, uint64_t in_size,
+                  struct OutBuf *reply, const char *out_path) {
+    // The daemon has its own working directory, so send the image's absolute path
+    char absolute[PATH_MAX];
+    if (realpath(image, absolute)) {
+        image = absolute;
+    }
+    if (strpbrk(image, "\t\n") || strpbrk(arg, "\t\n")) {
+        fprintf(stderr, "Error: path cannot be sent to diskd\n");
+        return -1;
+    }
+
+    // Send the request line and the payload
+    struct OutBuf request = {0};
+    outbuf_printf(&request, "%s\t%s\t%s\t%llu\n", verb, image, arg, (unsigned long long)in_size);
+    int rc = send_all(fd, request.data, request.len);
+    outbuf_free(&request);
+
+    char buffer[65536];
+    uint64_t remaining = in_size;
+    while (rc == 0 && remaining > 0) {
+        ssize_t n = read(in_fd, buffer, remaining < sizeof(buffer) ? remaining : sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Error reading input file: %s\n", n < 0 ? strerror(errno) : "unexpected end of file");
+            return -1;
+        }
+        rc = send_all(fd, buffer, n);
+        remaining -= n;
+    }
+
+    int status;
+    uint64_t size;
+    if (rc != 0 || read_status(fd, &status, &size) != 0) {
+        fprintf(stderr, "Error: lost connection to diskd\n");
+        return -1;
+    }
+
+    // Receive the payload into the output file or the reply buffer
+    int output = -1;
+    if (status == DISKD_OK && out_path) {
+        output = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (output < 0) {
+            perror("Error creating output file");
+            return -1;
+        }
+    }
+    rc = 0;
+    while (size > 0) {
+        ssize_t n = read(fd, buffer, size < sizeof(buffer) ? size : sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Error: lost connection to diskd\n");
+            rc = -1;
+            break;
+        }
+        if (output >= 0) {
+            if (rc == 0 && write_all(output, buffer, n) != 0) {
+                fprintf(stderr, "Error writing to output file: %s\n", strerror(errno));
+                rc = -1;
+            }
+        } else {
+            outbuf_write(reply, buffer, n);
+        }
+        size -= n;
+    }
+    if (output >= 0 && close(output) != 0 && rc == 0) {
+        fprintf(stderr, "Error writing to output file: %s\n", strerror(errno));
+        rc = -1;
+    }
+    return rc == 0 ? status : -1;
+}
+
+int diskd_report(const char *verb, const char *image, enum OutputFormat format, struct OutBuf *out) {
+    int fd = diskd_connect();
+    if (fd < 0) {
+        return -1;
+    }
+
+    // Records name the image as it was given, so pass that along with the format
+    struct OutBuf arg = {0}, reply = {0};
+    outbuf_printf(&arg, "%s %s", output_format_name(format), image);
+    int status = diskd_request(fd, verb, image, arg.data, -1, 0, &reply, NULL);
+    close(fd);
+    outbuf_free(&arg);
+
+    if (status == DISKD_OK || status == DISKD_FAIL) {
+        outbuf_write(out, reply.data, reply.len);
+    } else if (status == DISKD_ERR) {
+        fwrite(reply.data, 1, reply.len, stderr);
+    }
+    outbuf_free(&reply);
+    return status == DISKD_OK ? 0 : 1;
+}
@@ -0,0 +1,598 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "fat12.h"
+
+/*
+diskdefrag.c - FAT Image Defragmenter
+
+This program makes the cluster chain of every file and subdirectory in a FAT12,
+FAT16 or FAT32 image contiguous. It walks the directory tree against an in-memory copy of the
+FAT, collecting each chain in tree order: a directory, then the files it lists,
+then its subdirectories, each in turn.
+
+By default chains that are already contiguous stay where they are and only
+fragmented ones move, each into the first run long enough for it (preferably
+where it already starts) among free clusters and those the moving chains give
+up. If no such run exists, or with -c, the whole tree is compacted towards the
+start of the data area in tree order, which also leaves the free space as one
+run. Clusters in use that belong to no chain (bad or lost clusters) never move,
+and neither does the root directory chain of a FAT32 image.
+
+The plan is a mapping from old to new clusters. Moves that form a chain are
+done from its free end backwards, so nothing is overwritten before it has been
+copied; cycles are broken with a one-cluster staging buffer. Then the FAT,
+starting clusters in directory entries and the "." and ".." entries of moved
+directories are rewritten. Everything is staged and committed as a single
+transaction through the image's write-ahead journal (see diskput -t), so an
+interrupted run leaves the image either as it was or fully defragmented.
+
+With -a nothing is changed: the fragmentation of every file and directory and of
+the free space is reported instead.
+
+Usage: ./diskdefrag [-a | -c] [--stats] <disk_image>
+*/
+
+#define NONE 0xFFFFFFFFu
+
+// Cluster states during planning
+#define CLUSTER_FREE  0
+#define CLUSTER_CHAIN 1         // Part of a file or directory chain
+#define CLUSTER_FIXED 2         // In use by nothing we can find; never moved
+
+// A file or subdirectory with a non-empty chain
+struct Item {
+    char *path;
+    uint64_t entry_offset;      // Image offset of its directory entry before any move
+    uint32_t parent;            // Item of its directory, NONE for the root
+    uint32_t first;             // Its chain in Defrag.chains
+    uint32_t length;
+    uint32_t size;
+    int is_dir;
+};
+
+struct Defrag {
+    struct Fat12Image img;
+    struct Fat12FatCache fat;
+    uint32_t limit;             // One past the last data cluster
+    uint8_t *state;             // CLUSTER_* per cluster
+    uint32_t root_clusters;     // Fixed clusters holding a FAT32 root directory
+    struct Item *items;         // In tree order
+    size_t item_count;
+    size_t item_capacity;
+    uint32_t *chains;
+    size_t chain_count;
+    size_t chain_capacity;
+    uint32_t *new_of;           // Planned place of each chain cluster
+};
+
+static int grow(void **items, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t capacity_new = *capacity ? *capacity * 2 : 64;
+    while (capacity_new < needed) {
+        capacity_new *= 2;
+    }
+    void *grown = realloc(*items, capacity_new * item_size);
+    if (!grown) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    *items = grown;
+    *capacity = capacity_new;
+    return 0;
+}
+
+// Record an item and its chain, read from the cached FAT. A cluster reached twice
+// means a loop or a cross-link, which only a repair can untangle.
+static int add_item(struct Defrag *d, const struct DirEntry *entry, const char *path, uint32_t parent) {
+    if (grow((void **)&d->items, &d->item_capacity, d->item_count + 1, sizeof(*d->items)) != 0) {
+        return -1;
+    }
+    struct Item *item = &d->items[d->item_count];
+    item->path = strdup(path);
+    if (!item->path) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    item->entry_offset = (const uint8_t *)entry - d->img.base;
+    item->parent = parent;
+    item->first = d->chain_count;
+    item->length = 0;
+    item->size = entry->file_size;
+    item->is_dir = (entry->attributes & FAT12_ATTR_DIRECTORY) != 0;
+    d->item_count++;
+
+    uint32_t cluster = fat12_entry_cluster(&d->img, entry);
+    while (fat12_valid_cluster(&d->img, cluster)) {
+        if (d->state[cluster] != CLUSTER_FREE) {
+            fprintf(stderr, "Error: cluster %u is linked more than once (at %s); the image needs repair\n",
+                    cluster, path);
+            return -1;
+        }
+        if (grow((void **)&d->chains, &d->chain_capacity, d->chain_count + 1, sizeof(*d->chains)) != 0) {
+            return -1;
+        }
+        d->state[cluster] = CLUSTER_CHAIN;
+        d->chains[d->chain_count++] = cluster;
+        item->length++;
+        cluster = fat12_fat_get(&d->fat, cluster);
+    }
+    return 0;
+}
+
+// Pending directory of the depth-first walk
+struct PendingDir {
+    uint32_t cluster;
+    uint32_t parent;            // Item of the directory listing it, NONE for the root
+    const struct DirEntry *entry;  // NULL for the root
+    char *path;
+};
+
+// Collect every chain in tree order: each directory, its files, then its subdirectories
+static int collect(struct Defrag *d) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    // No directory entry points at a FAT32 root, so its chain stays where it is
+    for (uint32_t cluster = d->img.geo.root_cluster; fat12_valid_cluster(&d->img, cluster) &&
+         d->state[cluster] == CLUSTER_FREE; cluster = fat12_fat_get(&d->fat, cluster)) {
+        d->state[cluster] = CLUSTER_FIXED;
+        d->root_clusters++;
+    }
+
+    struct PendingDir *stack = NULL, *subdirs = NULL;
+    size_t top = 0, stack_capacity = 0, subdir_capacity = 0;
+    char *root_path = strdup("");
+    int rc = root_path ? grow((void **)&stack, &stack_capacity, 1, sizeof(*stack)) : -1;
+    if (rc == 0) {
+        stack[top++] = (struct PendingDir){0, NONE, NULL, root_path};
+    } else {
+        free(root_path);
+    }
+
+    while (rc == 0 && top > 0) {
+        struct PendingDir dir = stack[--top];
+        uint32_t self = NONE;
+        if (dir.entry) {
+            self = d->item_count;
+            rc = add_item(d, dir.entry, dir.path, dir.parent);
+        }
+
+        size_t subdir_count = 0;
+        struct Fat12DirIter it;
+        fat12_dir_open(&it, &d->img, &d->fat, dir.cluster);
+        const struct DirEntry *entry;
+        char name[FAT12_NAME_MAX];
+        while (rc == 0 && (entry = fat12_dir_next_named(&it, name)) != NULL) {
+            if (entry->filename[0] == '.') continue;  // "." and ".."
+            uint32_t first = fat12_entry_cluster(&d->img, entry);
+            if (!fat12_valid_cluster(&d->img, first)) continue;  // Empty file
+
+            if (!name[0]) {
+                fat12_entry_name(entry, name);
+            }
+            char *path = malloc(strlen(dir.path) + strlen(name) + 2);
+            if (!path) {
+                fprintf(stderr, "Memory allocation error\n");
+                rc = -1;
+                break;
+            }
+            sprintf(path, "%s/%s", dir.path, name);
+
+            if (entry->attributes & FAT12_ATTR_DIRECTORY) {
+                rc = grow((void **)&subdirs, &subdir_capacity, subdir_count + 1, sizeof(*subdirs));
+                if (rc == 0) {
+                    subdirs[subdir_count++] = (struct PendingDir){first, self, entry, path};
+                } else {
+                    free(path);
+                }
+            } else {
+                rc = add_item(d, entry, path, self);
+                free(path);
+            }
+        }
+
+        // Push the subdirectories so the first one is walked next
+        if (rc == 0) {
+            rc = grow((void **)&stack, &stack_capacity, top + subdir_count, sizeof(*stack));
+        }
+        for (size_t i = subdir_count; i-- > 0;) {
+            if (rc == 0) {
+                stack[top++] = subdirs[i];
+            } else {
+                free(subdirs[i].path);
+            }
+        }
+        free(dir.path);
+    }
+
+    for (size_t i = 0; i < top; i++) {
+        free(stack[i].path);
+    }
+    free(stack);
+    free(subdirs);
+    return rc;
+}
+
+// Mark clusters that are in use but belong to no chain, so nothing is moved onto them
+static void mark_fixed(struct Defrag *d) {
+    for (uint32_t cluster = 2; cluster < d->limit; cluster++) {
+        if (d->state[cluster] == CLUSTER_FREE && fat12_fat_get(&d->fat, cluster) != 0) {
+            d->state[cluster] = CLUSTER_FIXED;
+        }
+    }
+}
+
+// Where a chain cluster ends up (itself unless the plan moves it)
+static uint32_t mapped(const struct Defrag *d, uint32_t cluster) {
+    return d->new_of[cluster] ? d->new_of[cluster] : cluster;
+}
+
+// Runs of consecutive clusters in an item's chain, after the plan if there is one
+static uint32_t item_extents(const struct Defrag *d, const struct Item *item) {
+    uint32_t extents = 0, previous = 0;
+    for (uint32_t k = 0; k < item->length; k++) {
+        uint32_t cluster = mapped(d, d->chains[item->first + k]);
+        extents += k == 0 || cluster != previous + 1;
+        previous = cluster;
+    }
+    return extents;
+}
+
+// Find length clusters in a row that are neither reserved nor taken, trying hint first
+static uint32_t find_target(const struct Defrag *d, const uint8_t *blocked, uint32_t length, uint32_t hint) {
+    uint32_t run = 0;
+    if (hint + length <= d->limit) {
+        for (; run < length && !blocked[hint + run]; run++) {
+        }
+        if (run == length) {
+            return hint;
+        }
+    }
+    run = 0;
+    for (uint32_t cluster = 2; cluster < d->limit; cluster++) {
+        run = blocked[cluster] ? 0 : run + 1;
+        if (run == length) {
+            return cluster + 1 - length;
+        }
+    }
+    return 0;
+}
+
+// Move only fragmented chains, keeping contiguous ones in place. Returns -1 when
+// some chain finds no run long enough.
+static int plan_minimal(struct Defrag *d) {
+    // Fixed clusters and contiguous chains stay; everything else is available
+    uint8_t *blocked = calloc(d->limit, 1);
+    if (!blocked) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    for (uint32_t cluster = 2; cluster < d->limit; cluster++) {
+        blocked[cluster] = d->state[cluster] == CLUSTER_FIXED;
+    }
+    for (size_t i = 0; i < d->item_count; i++) {
+        const struct Item *item = &d->items[i];
+        if (item_extents(d, item) == 1) {
+            for (uint32_t k = 0; k < item->length; k++) {
+                blocked[d->chains[item->first + k]] = 1;
+            }
+        }
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < d->item_count && rc == 0; i++) {
+        const struct Item *item = &d->items[i];
+        if (item_extents(d, item) == 1) continue;
+
+        uint32_t start = find_target(d, blocked, item->length, d->chains[item->first]);
+        if (start == 0) {
+            rc = -1;
+            break;
+        }
+        for (uint32_t k = 0; k < item->length; k++) {
+            d->new_of[d->chains[item->first + k]] = start + k;
+            blocked[start + k] = 1;
+        }
+    }
+
+    free(blocked);
+    if (rc != 0) {
+        memset(d->new_of, 0, d->limit * sizeof(*d->new_of));
+    }
+    return rc;
+}
+
+// Lay every chain out back to back in tree order from the start of the data area
+static void plan_compact(struct Defrag *d) {
+    uint32_t next = 2;
+    for (size_t i = 0; i < d->chain_count; i++) {
+        while (d->state[next] == CLUSTER_FIXED) {
+            next++;
+        }
+        d->new_of[d->chains[i]] = next++;
+    }
+}
+
+// Stage data as the new contents of cluster to
+static int copy_cluster(struct Defrag *d, const void *data, uint32_t to) {
+    return fat12_write_meta(&d->img, fat12_cluster_offset(&d->img, to), data, d->img.geo.cluster_size);
+}
+
+// Carry out the plan, staging every cluster write; returns the number moved or -1
+static long move_clusters(struct Defrag *d) {
+    FAT12_PHASE(FAT12_PHASE_DATA);
+    uint32_t cluster_size = d->img.geo.cluster_size;
+    uint32_t *source_of = calloc(d->limit, sizeof(uint32_t));
+    uint8_t *done = calloc(d->limit, 1);
+    uint8_t *staging = malloc(cluster_size);
+    if (!source_of || !done || !staging) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(source_of);
+        free(done);
+        free(staging);
+        return -1;
+    }
+
+    // A cluster that moves is a source; its target receives it
+    for (uint32_t cluster = 2; cluster < d->limit; cluster++) {
+        if (d->new_of[cluster] && d->new_of[cluster] != cluster) {
+            source_of[d->new_of[cluster]] = cluster;
+        }
+    }
+#define MOVING(c) (d->new_of[c] && d->new_of[c] != (c))
+
+    // Chains of moves start at a target that is not itself moving away: fill it,
+    // then the cluster just copied from, and so on back along the chain
+    long moved = 0;
+    int rc = 0;
+    for (uint32_t target = 2; target < d->limit && rc == 0; target++) {
+        if (!source_of[target] || MOVING(target)) continue;
+        for (uint32_t to = target; rc == 0 && source_of[to] && !done[source_of[to]]; to = source_of[to]) {
+            uint32_t from = source_of[to];
+            FAT12_STAT_READ(fat12_cluster_offset(&d->img, from), cluster_size);
+            rc = copy_cluster(d, fat12_cluster(&d->img, from), to);
+            done[from] = 1;
+            moved++;
+        }
+    }
+
+    // What is left are cycles; stage one cluster of each and rotate the rest
+    for (uint32_t start = 2; start < d->limit && rc == 0; start++) {
+        if (!MOVING(start) || done[start]) continue;
+        FAT12_STAT_READ(fat12_cluster_offset(&d->img, start), cluster_size);
+        memcpy(staging, fat12_cluster(&d->img, start), cluster_size);
+        uint32_t to = start;
+        while (rc == 0 && source_of[to] != start) {
+            uint32_t from = source_of[to];
+            FAT12_STAT_READ(fat12_cluster_offset(&d->img, from), cluster_size);
+            rc = copy_cluster(d, fat12_cluster(&d->img, from), to);
+            done[from] = 1;
+            moved++;
+            to = from;
+        }
+        if (rc == 0) {
+            rc = copy_cluster(d, staging, to);
+            done[start] = 1;
+            moved++;
+        }
+    }
+#undef MOVING
+
+    free(source_of);
+    free(done);
+    free(staging);
+    return rc == 0 ? moved : -1;
+}
+
+// Image offset of bytes that were at offset before the clusters moved
+static off_t moved_offset(const struct Defrag *d, uint64_t offset) {
+    if (offset < d->img.geo.data_offset) {
+        return offset;  // Root directory
+    }
+    uint32_t cluster = 2 + (offset - d->img.geo.data_offset) / d->img.geo.cluster_size;
+    uint32_t within = (offset - d->img.geo.data_offset) % d->img.geo.cluster_size;
+    return fat12_cluster_offset(&d->img, mapped(d, cluster)) + within;
+}
+
+// Set the starting cluster of the entry at offset, if it differs
+static int set_start(struct Defrag *d, off_t offset, uint32_t cluster) {
+    struct DirEntry entry;
+    memcpy(&entry, d->img.base + offset, sizeof(entry));
+    if (fat12_entry_cluster(&d->img, &entry) == cluster) {
+        return 0;
+    }
+    fat12_set_entry_cluster(&d->img, &entry, cluster);
+    return fat12_write_meta(&d->img, offset, &entry, sizeof(entry));
+}
+
+// Relink every chain in the FAT cache and point directory entries at the new places
+static int rewrite_metadata(struct Defrag *d) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    for (size_t i = 0; i < d->chain_count; i++) {
+        if (mapped(d, d->chains[i]) != d->chains[i]) {
+            fat12_fat_set(&d->fat, d->chains[i], 0);
+        }
+    }
+    for (size_t i = 0; i < d->item_count; i++) {
+        const struct Item *item = &d->items[i];
+        for (uint32_t k = 0; k < item->length; k++) {
+            uint32_t cluster = mapped(d, d->chains[item->first + k]);
+            uint32_t next = k + 1 < item->length ? mapped(d, d->chains[item->first + k + 1]) : FAT12_EOC_MARK;
+            uint32_t current = fat12_fat_get(&d->fat, cluster);
+            if (current != next && !(next == FAT12_EOC_MARK && current >= FAT12_EOC)) {
+                fat12_fat_set(&d->fat, cluster, next);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < d->item_count; i++) {
+        const struct Item *item = &d->items[i];
+        uint32_t first = mapped(d, d->chains[item->first]);
+        if (set_start(d, moved_offset(d, item->entry_offset), first) != 0) {
+            return -1;
+        }
+        if (!item->is_dir) continue;
+
+        // A directory's "." names itself and ".." its parent (0 for the root)
+        const struct DirEntry *entries = (const struct DirEntry *)fat12_cluster(&d->img, first);
+        uint32_t parent = item->parent == NONE ? 0 : mapped(d, d->chains[d->items[item->parent].first]);
+        off_t offset = fat12_cluster_offset(&d->img, first);
+        if (entries[0].filename[0] == '.' && entries[0].filename[1] == ' ' &&
+            set_start(d, offset, first) != 0) {
+            return -1;
+        }
+        if (entries[1].filename[0] == '.' && entries[1].filename[1] == '.' &&
+            set_start(d, offset + sizeof(struct DirEntry), parent) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Report the fragmentation of every item and of the free space
+static void analyze(const struct Defrag *d) {
+    printf("%-40s %10s %8s %9s\n", "Path", "Size", "Clusters", "Fragments");
+    uint32_t fragmented = 0, extents = 0;
+    for (size_t i = 0; i < d->item_count; i++) {
+        const struct Item *item = &d->items[i];
+        uint32_t count = item_extents(d, item);
+        extents += count;
+        fragmented += count > 1;
+        char size[16];
+        snprintf(size, sizeof(size), "%u", item->size);
+        printf("%-40s %10s %8u %9u\n", item->path, item->is_dir ? "<DIR>" : size, item->length, count);
+    }
+
+    uint32_t free_clusters = 0, free_runs = 0, largest = 0, run = 0, fixed = 0;
+    for (uint32_t cluster = 2; cluster < d->limit; cluster++) {
+        fixed += d->state[cluster] == CLUSTER_FIXED;
+        if (d->state[cluster] == CLUSTER_FREE) {
+            free_clusters++;
+            free_runs += run == 0;
+            run++;
+            largest = run > largest ? run : largest;
+        } else {
+            run = 0;
+        }
+    }
+
+    printf("\n%zu file(s) and directories, %u fragmented (%.1f%%), %u fragment(s) in %zu cluster(s).\n",
+           d->item_count, fragmented, d->item_count ? 100.0 * fragmented / d->item_count : 0.0, extents,
+           d->chain_count);
+    printf("Free space: %u cluster(s) in %u run(s), the largest %u cluster(s) long.\n", free_clusters, free_runs,
+           largest);
+    if (fixed > d->root_clusters) {
+        printf("%u cluster(s) in use by no file or directory.\n", fixed - d->root_clusters);
+    }
+}
+
+static void defrag_free(struct Defrag *d) {
+    for (size_t i = 0; i < d->item_count; i++) {
+        free(d->items[i].path);
+    }
+    free(d->items);
+    free(d->chains);
+    free(d->state);
+    free(d->new_of);
+    fat12_fat_release(&d->fat);
+}
+
+int main(int argc, char *argv[]) {
+    fat12_stats_option(&argc, argv);
+
+    // Check command line arguments
+    int analyze_only = argc == 3 && strcmp(argv[1], "-a") == 0;
+    int compact = argc == 3 && strcmp(argv[1], "-c") == 0;
+    if (argc != 2 && !analyze_only && !compact) {
+        fprintf(stderr, "Usage: %s [-a | -c] [--stats] <disk_image>\n", argv[0]);
+        return 1;
+    }
+    const char *image = argv[argc - 1];
+
+    // Open the image, finishing any interrupted commit, and cache its FAT
+    struct Defrag d;
+    memset(&d, 0, sizeof(d));
+    if (fat12_open(&d.img, image, !analyze_only) != 0) {
+        return 1;
+    }
+    if (!analyze_only && fat12_journal_recover(&d.img, image) != 0) {
+        fat12_close(&d.img);
+        return 1;
+    }
+    d.limit = d.img.geo.total_clusters + 2;
+    d.state = calloc(d.limit, 1);
+    d.new_of = calloc(d.limit, sizeof(uint32_t));
+    if (!d.state || !d.new_of || fat12_fat_load(&d.img, &d.fat) != 0) {
+        if (!d.state || !d.new_of) {
+            fprintf(stderr, "Memory allocation error\n");
+        }
+        defrag_free(&d);
+        fat12_close(&d.img);
+        return 1;
+    }
+
+    if (collect(&d) != 0) {
+        defrag_free(&d);
+        fat12_close(&d.img);
+        return 1;
+    }
+    mark_fixed(&d);
+
+    if (analyze_only) {
+        analyze(&d);
+        defrag_free(&d);
+        fat12_close(&d.img);
+        return 0;
+    }
+
+    // Plan the new layout
+    uint32_t fragmented = 0;
+    for (size_t i = 0; i < d.item_count; i++) {
+        fragmented += item_extents(&d, &d.items[i]) > 1;
+    }
+    if (compact || plan_minimal(&d) != 0) {
+        plan_compact(&d);
+    }
+
+    // Stage the moves and the new metadata, then commit them together
+    struct Fat12Index index;
+    int indexed = fat12_index_open(&index, &d.img, image) == 0;
+    if (indexed) {
+        fat12_index_close(&index);
+    }
+    struct Fat12Journal journal;
+    long moved = -1;
+    int rc = fat12_journal_begin(&journal, &d.img, image);
+    if (rc == 0) {
+        moved = move_clusters(&d);
+        rc = moved < 0 || rewrite_metadata(&d) != 0 || fat12_fat_flush(&d.img, &d.fat) != 0 ||
+             fat12_journal_commit(&journal) != 0 ? -1 : 0;
+        fat12_journal_end(&journal);
+    }
+
+    // Keep an index that was valid before in step with the new layout
+    if (rc == 0 && moved > 0 && indexed && fat12_index_build(&d.img, image, NULL) != 0) {
+        rc = -1;
+    }
+
+    if (rc == 0) {
+        uint32_t remaining = 0;
+        for (size_t i = 0; i < d.item_count; i++) {
+            remaining += item_extents(&d, &d.items[i]) > 1;
+        }
+        printf("Moved %ld cluster(s); %u of %zu file(s) and directories were fragmented.\n", moved, fragmented,
+               d.item_count);
+        if (remaining > 0) {
+            printf("%u remain split around clusters in use by no file or directory%s.\n", remaining,
+                   d.root_clusters ? " or by the root directory" : "");
+        }
+    }
+
+    defrag_free(&d);
+    fat12_close(&d.img);
+    return rc == 0 ? 0 : 1;
+}
@@ -4,208 +4,394 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fat12.h"
+#include "batch.h"
+#include "diskd.h"
 
 /*
 diskget.c - FAT12 File System File Extraction Utility
 
-This program extracts a specified file from the root directory of a FAT12 file system image
-and copies it to the current working directory. It parses the boot sector, navigates the 
-root directory to find the file, and then follows the FAT chain to read and write the file contents.
+This program extracts a specified file from a FAT12 file system image and copies it
+to the current working directory. It maps the image through libfat12, resolves the
+path through the root directory and any subdirectories, and then resolves the FAT
+chain into extents of physically adjacent clusters, transferring each extent to
+the output file with a single call. When a valid sidecar index built by diskindex
+exists, the path and its extents come straight from the index. When $DISKD_SOCKET
+names a running diskd, a single file is fetched through it instead.
+
+With -r a whole subtree (or the entire image) is extracted in one run. The tree is
+walked first to create the host directories and collect every file; the files are
+then copied in order of their first cluster so the image is read close to
+sequentially instead of seeking back and forth between directories.
+
+With -o a single file is written to the given host path instead, or to stdout for
+"-", so it can feed a compressor or hasher directly without a copy on local disk.
+Data goes from the image to the output in the kernel where it can: copy_file_range
+into a file, splice of the image's cached pages into a pipe, and otherwise one
+write per extent straight from the mapping. Output to stdout is always produced
+locally, with no success message and failures reported on stderr, so nothing but
+the file's data reaches the pipe.
+
+--queue-depth=<n> copies into host files through a queue of n chunks in flight on
+io_uring (see fat12_queue.c), falling back to pread/pwrite where it is missing.
+
+--stats prints I/O counts and timings per phase to stderr when the copy is done.
 
-Usage: ./diskget <disk_image> <filename>
+Usage: ./diskget [--stats] [--queue-depth=<n>] <disk_image> [/path/to/]<filename> [-o <host_path>|-]
+       ./diskget [--stats] [--queue-depth=<n>] <disk_image> -r [/path/to/dir]
 */
 
-#pragma pack(push, 1)
-struct BootSector {
-    uint8_t jmp[3];
-    char oem[8];
-    uint16_t bytes_per_sector;
-    uint8_t sectors_per_cluster;
-    uint16_t reserved_sectors;
-    uint8_t num_fats;
-    uint16_t root_dir_entries;
-    uint16_t total_sectors_16;
-    uint8_t media_type;
-    uint16_t fat_size_16;
-    uint16_t sectors_per_track;
-    uint16_t num_heads;
-    uint32_t hidden_sectors;
-    uint32_t total_sectors_32;
+// A file found during a subtree walk, waiting to be copied
+struct PendingFile {
+    const struct DirEntry *entry;
+    uint32_t cluster;           // Its first cluster, the extraction order
+    char *host_path;
 };
 
-struct DirEntry {
-    char filename[8];
-    char extension[3];
-    uint8_t attributes;
-    uint8_t reserved[10];
-    uint16_t time;
-    uint16_t date;
-    uint16_t starting_cluster;
-    uint32_t file_size;
+struct DirQueueItem {
+    uint32_t cluster;
+    char *host_path;
 };
-#pragma pack(pop)
 
-// Function to read a FAT entry
-uint16_t read_fat_entry(FILE *disk, struct BootSector *bs, uint16_t cluster) {
-    uint32_t fat_offset = bs->reserved_sectors * bs->bytes_per_sector + cluster * 3 / 2;
-    uint16_t fat_entry;
+// Copy queue set up by --queue-depth, or NULL
+static struct Fat12Queue *copy_queue;
 
-    if (fseek(disk, fat_offset, SEEK_SET) != 0) {
-        fprintf(stderr, "Error seeking to FAT entry: %s\n", strerror(errno));
-        return 0xFFF;  // Return an invalid cluster number
+// Write one file's data to output; returns 0 on success. The chain's extents are
+// resolved from the FAT unless an index already supplies them.
+static int write_file_data(const struct Fat12Image *img, const struct DirEntry *entry,
+                           const struct Fat12Extent *known, size_t known_count, int output) {
+    FAT12_PHASE(FAT12_PHASE_DATA);
+    // Queued copies write at explicit offsets, so they need a regular file
+    struct stat st;
+    struct Fat12Queue *queue = copy_queue && fstat(output, &st) == 0 && S_ISREG(st.st_mode) ? copy_queue : NULL;
+
+    // Resolve the whole chain up front and merge physically adjacent clusters
+    uint32_t cluster_size = img->geo.cluster_size;
+    uint32_t clusters = (entry->file_size + cluster_size - 1) / cluster_size;
+    struct Fat12Extent *extents = NULL;
+    size_t extent_count = known_count;
+    if (!known && fat12_chain_extents(img, fat12_entry_cluster(img, entry), clusters, &extents, &extent_count) != 0) {
+        return -1;
     }
+    const struct Fat12Extent *runs = known ? known : extents;
 
-    if (fread(&fat_entry, 2, 1, disk) != 1) {
-        fprintf(stderr, "Error reading FAT entry: %s\n", strerror(errno));
-        return 0xFFF;  // Return an invalid cluster number
+    // Transfer each extent with a single call, or queue it
+    uint32_t bytes_remaining = entry->file_size;
+    int rc = 0;
+    for (size_t i = 0; i < extent_count && bytes_remaining > 0; i++) {
+        uint64_t extent_bytes = (uint64_t)runs[i].count * cluster_size;
+        uint32_t to_write = bytes_remaining < extent_bytes ? bytes_remaining : extent_bytes;
+        off_t offset = fat12_cluster_offset(img, runs[i].cluster);
+        if (queue) {
+            FAT12_STAT_READ(offset, to_write);
+            rc = fat12_queue_copy(queue, img->fd, offset, output, entry->file_size - bytes_remaining, to_write);
+        } else {
+            rc = fat12_transfer(img, offset, to_write, output);
+        }
+        if (rc != 0) {
+            break;
+        }
+        bytes_remaining -= to_write;
+    }
+    free(extents);
+    if (queue && fat12_queue_drain(queue) != 0) {
+        rc = -1;
     }
 
-    // Extract the 12-bit FAT entry
-    if (cluster & 1) {
-        return fat_entry >> 4;
-    } else {
-        return fat_entry & 0x0FFF;
+    if (rc == 0 && bytes_remaining > 0) {
+        fprintf(stderr, "Error reading file: cluster chain ends early\n");
+        rc = -1;
     }
+    return rc;
 }
 
-int main(int argc, char *argv[]) {
-    // Check command line arguments
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <disk_image> <filename>\n", argv[0]);
-        return 1;
+// Copy one file into a new host file; returns 0 on success
+static int extract_file(const struct Fat12Image *img, const struct DirEntry *entry, const struct Fat12Extent *known,
+                        size_t known_count, const char *host_path) {
+    int output = open(host_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output < 0) {
+        perror("Error creating output file");
+        return -1;
     }
 
-    // Open the disk image
-    FILE *disk = fopen(argv[1], "rb");
-    if (!disk) {
-        perror("Error opening disk image");
-        return 1;
+    int rc = write_file_data(img, entry, known, known_count, output);
+    if (close(output) != 0 && rc == 0) {
+        fprintf(stderr, "Error writing to output file: %s\n", strerror(errno));
+        rc = -1;
     }
+    return rc;
+}
 
-    // Read the boot sector
-    struct BootSector bs;
-    if (fread(&bs, sizeof(bs), 1, disk) != 1) {
-        fprintf(stderr, "Error reading boot sector: %s\n", strerror(errno));
-        fclose(disk);
-        return 1;
+// Turn an entry's long name, or else its 8.3 name, into one host path component.
+// A corrupt 8.3 name may hold '/' or NUL bytes, which become '_'. Returns -1 for a
+// name that would still leave the directory it belongs in ("", "." or "..").
+static int host_name(const struct DirEntry *entry, char *name) {
+    if (!name[0]) {
+        struct DirEntry clean = *entry;
+        for (size_t i = 0; i < sizeof(clean.filename); i++) {
+            if (clean.filename[i] == '\0' || clean.filename[i] == '/') clean.filename[i] = '_';
+        }
+        for (size_t i = 0; i < sizeof(clean.extension); i++) {
+            if (clean.extension[i] == '\0' || clean.extension[i] == '/') clean.extension[i] = '_';
+        }
+        fat12_entry_name(&clean, name);
+    }
+    if (!name[0] || strchr(name, '/') || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return -1;
     }
+    return 0;
+}
 
-    // Calculate important offsets
-    uint32_t root_dir_start = (bs.reserved_sectors + bs.num_fats * bs.fat_size_16) * bs.bytes_per_sector;
-    uint32_t data_start = root_dir_start + bs.root_dir_entries * 32;
+static int compare_pending(const void *a, const void *b) {
+    const struct PendingFile *x = a, *y = b;
+    return (x->cluster > y->cluster) - (x->cluster < y->cluster);
+}
 
-    // Seek to the start of the root directory
-    if (fseek(disk, root_dir_start, SEEK_SET) != 0) {
-        fprintf(stderr, "Error seeking to root directory: %s\n", strerror(errno));
-        fclose(disk);
-        return 1;
+// Append to a growable array, doubling its capacity as needed
+static int reserve(void **items, size_t *capacity, size_t count, size_t item_size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    void *grown = realloc(*items, new_capacity * item_size);
+    if (!grown) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    *items = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// Walk the directory tree below start_cluster breadth-first, creating host
+// directories and collecting files; then copy the files in physical order
+static int extract_tree(const struct Fat12Image *img, uint32_t start_cluster, const char *host_root, uint32_t *copied) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    struct PendingFile *files = NULL;
+    size_t file_count = 0, file_capacity = 0;
+    struct DirQueueItem *queue = NULL;
+    size_t queue_size = 0, queue_capacity = 0, front = 0;
+    int rc = 0;
+
+    // Directories already walked, keyed by first cluster
+    uint8_t *visited = calloc(img->geo.total_clusters + 2, 1);
+    if (!visited || reserve((void **)&queue, &queue_capacity, 0, sizeof(*queue)) != 0) {
+        free(visited);
+        return -1;
     }
+    queue[queue_size].cluster = start_cluster;
+    queue[queue_size].host_path = strdup(host_root);
+    queue_size++;
 
-    // Search for the file in the root directory
-    struct DirEntry entry;
-    int found = 0;
-    for (int i = 0; i < bs.root_dir_entries; i++) {
-        if (fread(&entry, sizeof(entry), 1, disk) != 1) {
-            if (feof(disk)) {
-                break;  // End of directory reached
-            }
-            fprintf(stderr, "Error reading directory entry: %s\n", strerror(errno));
-            fclose(disk);
-            return 1;
+    while (front < queue_size && rc == 0) {
+        uint32_t cluster = queue[front].cluster;
+        char *path = queue[front].host_path;
+        front++;
+
+        if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Error creating directory %s: %s\n", path, strerror(errno));
+            free(path);
+            rc = -1;
+            break;
         }
 
-        // Construct the filename (8.3 format)
-        char filename[13];
-        int j;
-        // Copy filename, removing spaces
-        for (j = 0; j < 8 && entry.filename[j] != ' '; j++) {
-            filename[j] = tolower(entry.filename[j]);
+        // Each directory is walked once, so a corrupt tree cannot loop forever
+        if ((cluster != 0 && !fat12_valid_cluster(img, cluster)) || visited[cluster]) {
+            free(path);
+            continue;
         }
-        // Add dot if extension exists
-        if (entry.extension[0] != ' ') {
-            filename[j++] = '.';
-            for (int k = 0; k < 3 && entry.extension[k] != ' '; k++) {
-                filename[j++] = tolower(entry.extension[k]);
+        visited[cluster] = 1;
+
+        struct Fat12DirIter it;
+        fat12_dir_open(&it, img, NULL, cluster);
+
+        const struct DirEntry *entry;
+        char name[FAT12_NAME_MAX];
+        while (rc == 0 && (entry = fat12_dir_next_named(&it, name)) != NULL) {
+            if (entry->filename[0] == '.') continue;  // "." and ".."
+
+            // Host files take the long name when there is one
+            if (host_name(entry, name) != 0) {
+                fprintf(stderr, "Skipping %s/%s: not usable as a host file name\n", path, name);
+                continue;
+            }
+            char *child_path = malloc(strlen(path) + strlen(name) + 2);
+            if (!child_path) {
+                fprintf(stderr, "Memory allocation error\n");
+                rc = -1;
+                break;
+            }
+            sprintf(child_path, "%s/%s", path, name);
+
+            uint32_t cluster = fat12_entry_cluster(img, entry);
+            if (entry->attributes & 0x10) {
+                if (cluster < 2 || reserve((void **)&queue, &queue_capacity, queue_size, sizeof(*queue)) != 0) {
+                    free(child_path);
+                    rc = cluster < 2 ? 0 : -1;
+                    continue;
+                }
+                queue[queue_size].cluster = cluster;
+                queue[queue_size].host_path = child_path;
+                queue_size++;
+            } else {
+                if (reserve((void **)&files, &file_capacity, file_count, sizeof(*files)) != 0) {
+                    free(child_path);
+                    rc = -1;
+                    break;
+                }
+                files[file_count].entry = entry;
+                files[file_count].cluster = cluster;
+                files[file_count].host_path = child_path;
+                file_count++;
             }
-        }
-        filename[j] = '\0';
-
-        // Convert input filename to lowercase for comparison
-        char input_filename[13];
-        strncpy(input_filename, argv[2], sizeof(input_filename) - 1);
-        input_filename[sizeof(input_filename) - 1] = '\0';
-        for (int k = 0; input_filename[k]; k++) {
-            input_filename[k] = tolower(input_filename[k]);
         }
 
-        if (strcmp(filename, input_filename) == 0) {
-            found = 1;
-            break;
+        free(path);
+    }
+
+    // Copy in order of first cluster so the image is scanned front to back
+    if (rc == 0) {
+        qsort(files, file_count, sizeof(*files), compare_pending);
+        for (size_t i = 0; i < file_count; i++) {
+            if (extract_file(img, files[i].entry, NULL, 0, files[i].host_path) != 0) {
+                rc = -1;
+                break;
+            }
+            (*copied)++;
         }
     }
 
-    if (!found) {
-        printf("File not found.\n");
-        fclose(disk);
-        return 1;
+    for (size_t i = front; i < queue_size; i++) {
+        free(queue[i].host_path);
+    }
+    for (size_t i = 0; i < file_count; i++) {
+        free(files[i].host_path);
     }
+    free(queue);
+    free(files);
+    free(visited);
+    return rc;
+}
 
-    // Open the output file
-    FILE *output = fopen(argv[2], "wb");
-    if (!output) {
-        perror("Error creating output file");
-        fclose(disk);
+int main(int argc, char *argv[]) {
+    fat12_stats_option(&argc, argv);
+    if (fat12_queue_option(&argc, argv) != 0) {
         return 1;
     }
+    int recursive = (argc == 3 || argc == 4) && strcmp(argv[2], "-r") == 0;
+    int named = argc == 5 && strcmp(argv[3], "-o") == 0;
 
-    // Copy the file contents
-    uint16_t current_cluster = entry.starting_cluster;
-    uint32_t bytes_remaining = entry.file_size;
-    uint32_t cluster_size = bs.sectors_per_cluster * bs.bytes_per_sector;
-    char *buffer = malloc(cluster_size);
-    if (!buffer) {
-        fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
-        fclose(output);
-        fclose(disk);
+    // Check command line arguments
+    if (argc != 3 && !recursive && !named) {
+        fprintf(stderr, "Usage: %s [--stats] [--queue-depth=<n>] <disk_image> [/path/to/]<filename> [-o <host_path>|-]\n",
+                argv[0]);
+        fprintf(stderr, "       %s [--stats] [--queue-depth=<n>] <disk_image> -r [/path/to/dir]\n", argv[0]);
         return 1;
     }
 
-    while (current_cluster < 0xFF8 && bytes_remaining > 0) {
-        uint32_t cluster_start = data_start + (current_cluster - 2) * cluster_size;
-        if (fseek(disk, cluster_start, SEEK_SET) != 0) {
-            fprintf(stderr, "Error seeking to cluster: %s\n", strerror(errno));
-            free(buffer);
-            fclose(output);
-            fclose(disk);
-            return 1;
-        }
+    // Unless -o names it, the copy is named after the last path component, in the
+    // current directory
+    const char *output_name = strrchr(argv[2], '/');
+    output_name = output_name ? output_name + 1 : argv[2];
+    if (named) {
+        output_name = argv[4];
+    }
+    int to_stdout = strcmp(output_name, "-") == 0;
+    FILE *messages = to_stdout ? stderr : stdout;
 
-        uint32_t to_read = (bytes_remaining < cluster_size) ? bytes_remaining : cluster_size;
-        size_t bytes_read = fread(buffer, 1, to_read, disk);
-        if (bytes_read == 0 && ferror(disk)) {
-            fprintf(stderr, "Error reading cluster: %s\n", strerror(errno));
-            free(buffer);
-            fclose(output);
-            fclose(disk);
-            return 1;
+    // A running diskd serves single files from the copy it keeps open
+    int daemon = recursive || to_stdout ? -1 : diskd_connect();
+    if (daemon >= 0) {
+        struct OutBuf reply = {0};
+        int status = diskd_request(daemon, "get", argv[1], argv[2], -1, 0, &reply, output_name);
+        close(daemon);
+        if (status == DISKD_OK) {
+            printf("File copied successfully.\n");
+        } else if (status == DISKD_FAIL) {
+            fwrite(reply.data, 1, reply.len, stdout);
+        } else if (status == DISKD_ERR) {
+            fwrite(reply.data, 1, reply.len, stderr);
         }
+        outbuf_free(&reply);
+        return status == DISKD_OK ? 0 : 1;
+    }
 
-        if (fwrite(buffer, 1, bytes_read, output) != bytes_read) {
-            fprintf(stderr, "Error writing to output file: %s\n", strerror(errno));
-            free(buffer);
-            fclose(output);
-            fclose(disk);
+    // Open and map the disk image
+    struct Fat12Image img;
+    if (fat12_open(&img, argv[1], 0) != 0) {
+        return 1;
+    }
+
+    // stdout may be a file already written to, so it is never given explicit offsets
+    struct Fat12Queue queue;
+    if (fat12_queue_depth > 0 && !to_stdout) {
+        if (fat12_queue_open(&queue, fat12_queue_depth) != 0) {
+            fat12_close(&img);
             return 1;
         }
+        copy_queue = &queue;
+    }
+
+    const char *path = recursive ? (argc == 4 ? argv[3] : "/") : argv[2];
+
+    // Resolve the path with one probe of a valid sidecar index, or else through the
+    // root directory and subdirectories
+    struct Fat12Index index;
+    int indexed = fat12_index_open(&index, &img, argv[1]) == 0;
+    const struct Fat12IndexRecord *record = indexed ? fat12_index_find(&index, path) : NULL;
+    const struct DirEntry *entry = NULL;
+    char name[FAT12_NAME_MAX];
+    int found = 1;
+    if (record) {
+        entry = fat12_index_entry(&img, record);
+        strcpy(name, fat12_index_name(&index, record));
+    } else {
+        found = fat12_lookup(&img, path, &entry, name) == 0;
+    }
 
-        bytes_remaining -= bytes_read;
-        current_cluster = read_fat_entry(disk, &bs, current_cluster);
+    int rc = 0;
+    if (recursive) {
+        if (!found || (entry && !(entry->attributes & 0x10))) {
+            printf("The directory not found.\n");
+            rc = -1;
+        } else if (entry && entry->filename[0] != '.' && host_name(entry, name) != 0) {
+            printf("The directory name is not usable as a host file name.\n");
+            rc = -1;
+        } else {
+            // The subtree lands in a host directory named after it, or "." for the root
+            // and for a path ending in "." or ".."
+            uint32_t copied = 0;
+            const char *host_root = entry && entry->filename[0] != '.' ? name : ".";
+            rc = extract_tree(&img, entry ? fat12_entry_cluster(&img, entry) : 0, host_root, &copied);
+            if (rc == 0) {
+                printf("%u file(s) copied successfully.\n", copied);
+            }
+        }
+    } else if (!found || !entry || (entry->attributes & 0x10)) {
+        fprintf(messages, "File not found.\n");
+        rc = -1;
+    } else if (to_stdout) {
+        rc = write_file_data(&img, entry, record ? index.extents + record->first_extent : NULL,
+                             record ? record->extent_count : 0, STDOUT_FILENO);
+    } else {
+        rc = extract_file(&img, entry, record ? index.extents + record->first_extent : NULL,
+                          record ? record->extent_count : 0, output_name);
+        if (rc == 0) {
+            printf("File copied successfully.\n");
+        }
     }
 
-    // Clean up
-    free(buffer);
-    fclose(output);
-    fclose(disk);
-    printf("File copied successfully.\n");
-    return 0;
+    if (indexed) {
+        fat12_index_close(&index);
+    }
+    if (copy_queue) {
+        fat12_queue_close(copy_queue);
+    }
+    fat12_close(&img);
+    return rc == 0 ? 0 : 1;
 }
@@ -2,9 +2,14 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <ctype.h>
-#include <time.h>
-#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fat12.h"
+#include "batch.h"
+#include "putsession.h"
+#include "diskd.h"
 
 /*
 diskput.c - FAT12 File System File Insertion Utility
@@ -12,435 +17,217 @@ diskput.c - FAT12 File System File Insertion Utility
 This program copies a file from the current Linux directory into a specified
 directory (root or subdirectory) of a FAT12 file system image. It updates the
 File Allocation Table (FAT) and directory entries accordingly. The program
-handles file path parsing, directory traversal, free space checking, and 
+handles file path parsing, directory traversal, free space checking, and
 cluster allocation to ensure proper file insertion into the FAT12 structure.
- */
-
-
-#pragma pack(push, 1)
-struct BootSector {
-    uint8_t jmp[3];
-    char oem[8];
-    uint16_t bytes_per_sector;
-    uint8_t sectors_per_cluster;
-    uint16_t reserved_sectors;
-    uint8_t num_fats;
-    uint16_t root_dir_entries;
-    uint16_t total_sectors_16;
-    uint8_t media_type;
-    uint16_t fat_size_16;
-    uint16_t sectors_per_track;
-    uint16_t num_heads;
-    uint32_t hidden_sectors;
-    uint32_t total_sectors_32;
+The image is mapped through libfat12 for reading; all modifications are written
+back through the image descriptor.
+
+In batch mode (-b) many files are inserted in one session: the image is opened,
+the FAT cached and the free-cluster bitmap built once, and directory lookups and
+free-slot searches are remembered between files. The FAT is flushed once at the end.
+A valid sidecar index (see diskindex) answers directory lookups directly and is
+rebuilt once the session's changes are on disk, so it stays usable.
+When $DISKD_SOCKET names a running diskd, single files and batches are sent to it
+and inserted there instead.
+
+With -r a whole host directory tree is imported as a new subdirectory. The tree is
+scanned and sized first, then laid out in one pass: each directory's clusters are
+allocated, followed by the data of the files it lists, before its subdirectories.
+
+With -t the run is one transaction: FAT and directory changes are staged in memory
+and committed through a write-ahead journal (<image>.wal) with ordered fsyncs, so a
+crash or power loss leaves the image either as it was or with every file inserted.
+Any run that writes the image first finishes a commit that was interrupted.
+
+With -s the file's contents are read from stdin until end of file, so generated
+output can be piped straight into the image without staging it on local disk. No
+size is needed up front: clusters are allocated as the data arrives, reads overlap
+image writes, and the directory entry's size is filled in at the end. Streams are
+always inserted locally, since diskd expects the size with each request.
+
+--queue-depth=<n> copies host files into the image through a queue of n chunks in
+flight on io_uring (see fat12_queue.c), falling back to pread/pwrite where it is
+missing. Streams from stdin are copied as before.
+
+--stats prints I/O counts and timings per phase to stderr at the end of the run.
+
+Usage: ./diskput [--stats] [--queue-depth=<n>] <disk_image> [-t] [/path/to/]<filename>
+       ./diskput [--stats] [--queue-depth=<n>] <disk_image> [-t] -b [/path/to/]<filename>...
+       ./diskput [--stats] [--queue-depth=<n>] <disk_image> [-t] -b -    (one entry per line on stdin)
+       ./diskput [--stats] [--queue-depth=<n>] <disk_image> [-t] -r <host_dir> [/path/to/dir]
+       ./diskput [--stats] [--queue-depth=<n>] <disk_image> [-t] -s [/path/to/]<filename>    (contents on stdin)
+*/
+
+// Where files go: a local session, or a running diskd
+struct PutTarget {
+    struct PutSession *session;
+    int daemon;                 // Connection to diskd, or -1 to insert locally
+    const char *image;
+    int batch;
 };
 
-struct DirEntry {
-    char filename[8];
-    char extension[3];
-    uint8_t attributes;
-    uint8_t reserved[10];
-    uint16_t time;
-    uint16_t date;
-    uint16_t starting_cluster;
-    uint32_t file_size;
-};
-#pragma pack(pop)
-
-// Function to read a FAT entry
-uint16_t read_fat_entry(FILE *disk, struct BootSector *bs, uint16_t cluster) {
-    uint32_t fat_offset = bs->reserved_sectors * bs->bytes_per_sector + cluster * 3 / 2;
-    uint16_t fat_entry;
-
-    if (fseek(disk, fat_offset, SEEK_SET) != 0) {
-        fprintf(stderr, "Error seeking to FAT entry: %s\n", strerror(errno));
-        return 0xFFF;  // Return an invalid cluster number
+// Print a per-file message the way a local session would
+static void print_message(const struct PutTarget *t, const char *spec, const char *message, size_t len) {
+    if (len > 0 && message[len - 1] == '\n') {
+        len--;
     }
-
-    if (fread(&fat_entry, 2, 1, disk) != 1) {
-        fprintf(stderr, "Error reading FAT entry: %s\n", strerror(errno));
-        return 0xFFF;  // Return an invalid cluster number
-    }
-
-    // Extract the 12-bit FAT entry
-    if (cluster & 1) {
-        return fat_entry >> 4;
+    if (t->batch) {
+        printf("%s: %.*s\n", spec, (int)len, message);
     } else {
-        return fat_entry & 0x0FFF;
+        printf("%.*s\n", (int)len, message);
     }
 }
 
-// Function to write a FAT entry
-void write_fat_entry(FILE *disk, struct BootSector *bs, uint16_t cluster, uint16_t value) {
-    uint32_t fat_offset = bs->reserved_sectors * bs->bytes_per_sector + cluster * 3 / 2;
-    uint16_t fat_entry;
-
-    if (fseek(disk, fat_offset, SEEK_SET) != 0) {
-        fprintf(stderr, "Error seeking to FAT entry for writing: %s\n", strerror(errno));
-        return;
+// Send one host file to diskd for insertion at image_path; returns 0 on success
+static int forward_file(const struct PutTarget *t, const char *host_path, const char *image_path) {
+    struct stat st;
+    int input = open(host_path, O_RDONLY);
+    if (input < 0 || fstat(input, &st) != 0) {
+        if (input >= 0) close(input);
+
+        // A local run checks the directory before the host file, so ask about it first
+        struct OutBuf reply = {0};
+        int status = diskd_request(t->daemon, "locate", t->image, image_path, -1, 0, &reply, NULL);
+        if (status == DISKD_OK) {
+            const char *message = "File not found.";
+            print_message(t, image_path, message, strlen(message));
+        } else if (status == DISKD_FAIL) {
+            print_message(t, image_path, reply.data, reply.len);
+        } else if (status == DISKD_ERR) {
+            fwrite(reply.data, 1, reply.len, stderr);
+        }
+        outbuf_free(&reply);
+        return 1;
     }
 
-    if (fread(&fat_entry, 2, 1, disk) != 1) {
-        fprintf(stderr, "Error reading FAT entry for writing: %s\n", strerror(errno));
-        return;
+    struct OutBuf reply = {0};
+    int status = diskd_request(t->daemon, "put", t->image, image_path, input, st.st_size, &reply, NULL);
+    close(input);
+    if (status == DISKD_FAIL) {
+        print_message(t, image_path, reply.data, reply.len);
+    } else if (status == DISKD_ERR) {
+        fwrite(reply.data, 1, reply.len, stderr);
     }
+    outbuf_free(&reply);
+    return status == DISKD_OK ? 0 : 1;
+}
 
-    // Update the 12-bit FAT entry
-    if (cluster & 1) {
-        fat_entry = (fat_entry & 0x000F) | (value << 4);
+// Insert a file named by a command line argument or manifest line. The host file
+// is the basename, taken from the current directory; a manifest line may instead
+// name both sides as "<host_file>\t<image_path>". Command line arguments are
+// always one image path, spaces and all.
+static int put_spec(const struct PutTarget *t, const char *spec, int manifest) {
+    char host[4096], dest[4096];
+    const char *filename = strrchr(spec, '/');
+    filename = filename ? filename + 1 : spec;
+    const char *tab = manifest ? strchr(spec, '\t') : NULL;
+    if (tab) {
+        snprintf(host, sizeof(host), "%.*s", (int)(tab - spec), spec);
+        snprintf(dest, sizeof(dest), "%s", tab + 1);
     } else {
-        fat_entry = (fat_entry & 0xF000) | value;
-    }
-
-    if (fseek(disk, fat_offset, SEEK_SET) != 0) {
-        fprintf(stderr, "Error seeking back to FAT entry for writing: %s\n", strerror(errno));
-        return;
+        snprintf(host, sizeof(host), "%s", filename);
+        snprintf(dest, sizeof(dest), "%s", spec);
     }
 
-    if (fwrite(&fat_entry, 2, 1, disk) != 1) {
-        fprintf(stderr, "Error writing FAT entry: %s\n", strerror(errno));
-    }
-}
-
-// Function to find a free cluster
-uint16_t find_free_cluster(FILE *disk, struct BootSector *bs) {
-    for (uint16_t cluster = 2; cluster < bs->total_sectors_16 / bs->sectors_per_cluster; cluster++) {
-        if (read_fat_entry(disk, bs, cluster) == 0) {
-            return cluster;
-        }
+    if (t->daemon >= 0) {
+        return forward_file(t, host, dest);
     }
-    return 0xFFF;  // No free cluster found
+    return put_file(t->session, host, dest);
 }
 
-// Function to find a directory given a path
-uint16_t find_directory(FILE *disk, struct BootSector *bs, const char *path) {
-    if (path[0] == '\0' || (path[0] == '/' && path[1] == '\0')) {
-        return 0;  // Special case for root directory
-    }
-
-    char *path_copy = strdup(path);
-    if (!path_copy) {
-        fprintf(stderr, "Memory allocation error: %s\n", strerror(errno));
-        return 0xFFF;
-    }
-
-    char *token = strtok(path_copy, "/");
-    uint16_t current_cluster = 0;  // Start from root directory
-
-    while (token != NULL) {
-        uint32_t dir_sector;
-        uint32_t entries_to_read;
+// Read manifest entries from stdin, one per line
+static int put_manifest(const struct PutTarget *t, uint32_t *copied) {
+    int failures = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
 
-        if (current_cluster == 0) {
-            // Root directory
-            dir_sector = bs->reserved_sectors + bs->num_fats * bs->fat_size_16;
-            entries_to_read = bs->root_dir_entries;
-        } else {
-            // Subdirectory
-            dir_sector = bs->reserved_sectors + bs->num_fats * bs->fat_size_16 +
-                         (bs->root_dir_entries * 32 + bs->bytes_per_sector - 1) / bs->bytes_per_sector +
-                         (current_cluster - 2) * bs->sectors_per_cluster;
-            entries_to_read = bs->bytes_per_sector / 32 * bs->sectors_per_cluster;
-        }
-
-        struct DirEntry entry;
-        int found = 0;
-
-        for (uint32_t i = 0; i < entries_to_read; i++) {
-            if (fseek(disk, dir_sector * bs->bytes_per_sector + i * sizeof(struct DirEntry), SEEK_SET) != 0) {
-                fprintf(stderr, "Error seeking to directory entry: %s\n", strerror(errno));
-                free(path_copy);
-                return 0xFFF;
-            }
-
-            if (fread(&entry, sizeof(entry), 1, disk) != 1) {
-                if (feof(disk)) {
-                    break;  // End of directory
-                }
-                fprintf(stderr, "Error reading directory entry: %s\n", strerror(errno));
-                free(path_copy);
-                return 0xFFF;
-            }
-
-            if (entry.filename[0] == 0) break;  // End of directory
-            if ((uint8_t)entry.filename[0] == 0xE5) continue;  // Deleted entry
-
-            char name[13];
-            snprintf(name, sizeof(name), "%.8s%.3s", entry.filename, entry.extension);
-            // Remove trailing spaces
-            for (int j = 0; j < 12; j++) {
-                if (name[j] == ' ') {
-                    name[j] = '\0';
-                    break;
-                }
-            }
-
-            if (strcmp(name, token) == 0 && (entry.attributes & 0x10)) {
-                current_cluster = entry.starting_cluster;
-                found = 1;
-                break;
-            }
+    while ((line_len = getline(&line, &line_cap, stdin)) != -1) {
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+            line[--line_len] = '\0';
         }
+        if (line_len == 0 || line[0] == '#') continue;
 
-        if (!found) {
-            free(path_copy);
-            return 0;  // Directory not found
+        if (put_spec(t, line, 1) == 0) {
+            (*copied)++;
+        } else {
+            failures++;
         }
-
-        token = strtok(NULL, "/");
     }
 
-    free(path_copy);
-    return current_cluster;
+    free(line);
+    return failures;
 }
 
 int main(int argc, char *argv[]) {
-    // Check for correct number of command-line arguments
-    if (argc != 3 && argc != 4) {
-        fprintf(stderr, "Usage: %s <disk_image> [/path/to/]<filename>\n", argv[0]);
-        return 1;
-    }
-
-    // Open the disk image file in read-write binary mode
-    FILE *disk = fopen(argv[1], "r+b");
-    if (!disk) {
-        perror("Error opening disk image");
-        return 1;
-    }
-
-    // Read the boot sector
-    struct BootSector bs;
-    if (fread(&bs, sizeof(bs), 1, disk) != 1) {
-        fprintf(stderr, "Error reading boot sector: %s\n", strerror(errno));
-        fclose(disk);
-        return 1;
-    }
-
-    // Parse the input path and filename
-    char *filepath = (argc == 4) ? argv[3] : argv[2];
-    char *filename = strrchr(filepath, '/');
-    filename = filename ? filename + 1 : filepath;
-    
-    char dirpath[256] = {0};
-    if (filename != filepath) {
-        strncpy(dirpath, filepath, filename - filepath - 1);
-    }
-
-    // Find the target directory
-    uint16_t dir_cluster = find_directory(disk, &bs, dirpath);
-    if (dir_cluster == 0xFFF) {
-        fclose(disk);
-        return 1;  // Error already printed in find_directory
-    }
-    if (dir_cluster == 0 && dirpath[0] != '\0') {
-        printf("The directory not found.\n");
-        fclose(disk);
-        return 1;
-    }
-
-    // Open the input file
-    FILE *input_file = fopen(filename, "rb");
-    if (!input_file) {
-        printf("File not found.\n");
-        fclose(disk);
+    fat12_stats_option(&argc, argv);
+    if (fat12_queue_option(&argc, argv) != 0) {
         return 1;
     }
 
-    // Get the file size
-    if (fseek(input_file, 0, SEEK_END) != 0) {
-        fprintf(stderr, "Error seeking in input file: %s\n", strerror(errno));
-        fclose(input_file);
-        fclose(disk);
-        return 1;
-    }
-    long file_size = ftell(input_file);
-    if (file_size == -1) {
-        fprintf(stderr, "Error getting file size: %s\n", strerror(errno));
-        fclose(input_file);
-        fclose(disk);
-        return 1;
-    }
-    if (fseek(input_file, 0, SEEK_SET) != 0) {
-        fprintf(stderr, "Error seeking in input file: %s\n", strerror(errno));
-        fclose(input_file);
-        fclose(disk);
-        return 1;
+    // -t right after the image makes the whole run one transaction
+    int journaled = argc >= 3 && strcmp(argv[2], "-t") == 0;
+    if (journaled) {
+        memmove(&argv[2], &argv[3], (argc - 2) * sizeof(char *));
+        argc--;
     }
 
-    // Calculate required clusters and check for free space
-    uint32_t clusters_needed = (file_size + bs.bytes_per_sector * bs.sectors_per_cluster - 1) / (bs.bytes_per_sector * bs.sectors_per_cluster);
-    uint32_t free_clusters = 0;
-    for (uint16_t cluster = 2; cluster < bs.total_sectors_16 / bs.sectors_per_cluster; cluster++) {
-        if (read_fat_entry(disk, &bs, cluster) == 0) {
-            free_clusters++;
-        }
-    }
+    int batch = argc >= 4 && strcmp(argv[2], "-b") == 0;
+    int recursive = (argc == 4 || argc == 5) && strcmp(argv[2], "-r") == 0;
+    int streaming = argc == 4 && strcmp(argv[2], "-s") == 0;
 
-    if (free_clusters < clusters_needed) {
-        printf("No enough free space in the disk image.\n");
-        fclose(input_file);
-        fclose(disk);
+    // Check for correct number of command-line arguments
+    if (argc < 3 || (argc > 3 && !batch && !recursive && !streaming)) {
+        fprintf(stderr, "Usage: %s [--stats] [--queue-depth=<n>] <disk_image> [-t] [/path/to/]<filename>\n", argv[0]);
+        fprintf(stderr, "       %s [--stats] [--queue-depth=<n>] <disk_image> [-t] -b [/path/to/]<filename>...\n", argv[0]);
+        fprintf(stderr, "       %s [--stats] [--queue-depth=<n>] <disk_image> [-t] -b -\n", argv[0]);
+        fprintf(stderr, "       %s [--stats] [--queue-depth=<n>] <disk_image> [-t] -r <host_dir> [/path/to/dir]\n", argv[0]);
+        fprintf(stderr, "       %s [--stats] [--queue-depth=<n>] <disk_image> [-t] -s [/path/to/]<filename>\n", argv[0]);
         return 1;
     }
 
-    // Find the target directory sector
-    uint32_t dir_sector;
-    uint32_t entries_to_read;
-    if (dir_cluster == 0) {
-        // Root directory
-        dir_sector = bs.reserved_sectors + bs.num_fats * bs.fat_size_16;
-        entries_to_read = bs.root_dir_entries;
-    } else {
-        // Subdirectory
-        dir_sector = bs.reserved_sectors + bs.num_fats * bs.fat_size_16 +
-                     (bs.root_dir_entries * 32 + bs.bytes_per_sector - 1) / bs.bytes_per_sector +
-                     (dir_cluster - 2) * bs.sectors_per_cluster;
-        entries_to_read = bs.bytes_per_sector / 32 * bs.sectors_per_cluster;
-    }
-
-    // Find a free directory entry
-    struct DirEntry entry;
-    int free_entry_index = -1;
-    for (uint32_t i = 0; i < entries_to_read; i++) {
-        if (fseek(disk, dir_sector * bs.bytes_per_sector + i * sizeof(struct DirEntry), SEEK_SET) != 0) {
-            fprintf(stderr, "Error seeking to directory entry: %s\n", strerror(errno));
-            fclose(input_file);
-            fclose(disk);
-            return 1;
-        }
-
-        if (fread(&entry, sizeof(entry), 1, disk) != 1) {
-            fprintf(stderr, "Error reading directory entry: %s\n", strerror(errno));
-            fclose(input_file);
-            fclose(disk);
-            return 1;
-        }
-
-        if (entry.filename[0] == 0x00 || (unsigned char)entry.filename[0] == 0xE5) {
-            free_entry_index = i;
-            break;
-        }
-    }
-
-    if (free_entry_index == -1) {
-        printf("No free directory entries.\n");
-        fclose(input_file);
-        fclose(disk);
+    // A running diskd inserts single files and batches into the copy it keeps open
+    struct PutSession session;
+    struct PutTarget target = {&session, recursive || streaming ? -1 : diskd_connect(), argv[1], batch};
+    if (target.daemon < 0 && session_open(&session, argv[1], batch, journaled) != 0) {
         return 1;
     }
 
-    // Prepare the directory entry
-    memset(&entry, 0, sizeof(entry));
-
-    // Convert filename to uppercase and format it to 8.3
-    char upper_filename[256];
-    for (int i = 0; filename[i] && i < 255; i++) {
-        upper_filename[i] = toupper((unsigned char)filename[i]);
-    }
-    upper_filename[255] = '\0';
-
-    char *dot = strrchr(upper_filename, '.');
-    char base_name[9] = "        ";  // 8 spaces
-    char extension[4] = "   ";  // 3 spaces
-    if (dot) {
-        strncpy(base_name, upper_filename, (dot - upper_filename > 8) ? 8 : (dot - upper_filename));
-        strncpy(extension, dot + 1, 3);
+    int failures = 0;
+    uint32_t copied = 0;
+    uint32_t dirs = 0;
+    if (recursive) {
+        failures = put_tree(&session, argv[3], argc == 5 ? argv[4] : "", &copied, &dirs);
+    } else if (streaming) {
+        failures = put_pipe(&session, STDIN_FILENO, argv[3]);
+    } else if (!batch) {
+        failures = put_spec(&target, argv[2], 0);
     } else {
-        strncpy(base_name, upper_filename, 8);
-    }
-
-    memcpy(entry.filename, base_name, 8);
-    memcpy(entry.extension, extension, 3);
-    entry.attributes = 0x00;  // Regular file
-
-    // Set creation time and date
-    time_t now = time(NULL);
-    struct tm *tm_now = localtime(&now);
-    entry.time = (tm_now->tm_hour << 11) | (tm_now->tm_min << 5) | (tm_now->tm_sec / 2);
-    entry.date = ((tm_now->tm_year - 80) << 9) | ((tm_now->tm_mon + 1) << 5) | tm_now->tm_mday;
-    entry.file_size = file_size;
-
-    // Find the first free cluster and write the file
-    uint16_t first_cluster = find_free_cluster(disk, &bs);
-    if (first_cluster == 0xFFF) {
-        fprintf(stderr, "No free clusters available.\n");
-        fclose(input_file);
-        fclose(disk);
-        return 1;
-    }
-    entry.starting_cluster = first_cluster;
-
-    uint16_t current_cluster = first_cluster;
-    uint32_t bytes_written = 0;
-    while (bytes_written < file_size) {
-        uint32_t cluster_start = bs.reserved_sectors * bs.bytes_per_sector +
-                                 bs.num_fats * bs.fat_size_16 * bs.bytes_per_sector +
-                                 bs.root_dir_entries * 32 +
-                                 (current_cluster - 2) * bs.sectors_per_cluster * bs.bytes_per_sector;
-
-        uint32_t to_write = bs.sectors_per_cluster * bs.bytes_per_sector;
-        if (to_write > file_size - bytes_written) {
-            to_write = file_size - bytes_written;
-        }
-
-        char buffer[4096];
-        size_t bytes_read = fread(buffer, 1, to_write, input_file);
-        if (bytes_read != to_write) {
-            fprintf(stderr, "Error reading from input file: %s\n", strerror(errno));
-            fclose(input_file);
-            fclose(disk);
-            return 1;
-        }
-
-        if (fseek(disk, cluster_start, SEEK_SET) != 0) {
-            fprintf(stderr, "Error seeking in disk image: %s\n", strerror(errno));
-            fclose(input_file);
-            fclose(disk);
-            return 1;
-        }
-
-        if (fwrite(buffer, 1, to_write, disk) != to_write) {
-            fprintf(stderr, "Error writing to disk image: %s\n", strerror(errno));
-            fclose(input_file);
-            fclose(disk);
-            return 1;
-        }
-
-        bytes_written += to_write;
-
-        if (bytes_written < file_size) {
-            uint16_t next_cluster = find_free_cluster(disk, &bs);
-            if (next_cluster == 0xFFF) {
-                fprintf(stderr, "No more free clusters available.\n");
-                fclose(input_file);
-                fclose(disk);
-                return 1;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "-") == 0) {
+                failures += put_manifest(&target, &copied);
+            } else if (put_spec(&target, argv[i], 0) == 0) {
+                copied++;
+            } else {
+                failures++;
             }
-            write_fat_entry(disk, &bs, current_cluster, next_cluster);
-            current_cluster = next_cluster;
-        } else {
-            write_fat_entry(disk, &bs, current_cluster, 0xFFF);  // End of file
         }
     }
 
-    // Write the directory entry
-    if (fseek(disk, dir_sector * bs.bytes_per_sector + free_entry_index * sizeof(struct DirEntry), SEEK_SET) != 0) {
-        fprintf(stderr, "Error seeking to write directory entry: %s\n", strerror(errno));
-        fclose(input_file);
-        fclose(disk);
+    if (target.daemon >= 0) {
+        close(target.daemon);
+    } else if (session_close(&session) != 0) {
         return 1;
     }
 
-    if (fwrite(&entry, sizeof(entry), 1, disk) != 1) {
-        fprintf(stderr, "Error writing directory entry: %s\n", strerror(errno));
-        fclose(input_file);
-        fclose(disk);
-        return 1;
+    if (recursive) {
+        if (failures == 0) {
+            printf("%u file(s) in %u director(ies) copied successfully.\n", copied, dirs);
+        }
+    } else if (batch) {
+        printf("%u file(s) copied successfully.\n", copied);
+    } else if (failures == 0) {
+        printf("File copied successfully.\n");
     }
-
-    // Clean up
-    fclose(input_file);
-    fclose(disk);
-    printf("File copied successfully.\n");
-    return 0;
+    return failures ? 1 : 0;
 }
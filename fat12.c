@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fat12.h"
+
+/*
+fat12.c - Shared FAT12 Image Access Library
+
+Implements the image engine declared in fat12.h: opening and mapping an image,
+validating and parsing the boot sector into a geometry object, and the small
+helpers every tool needs to address the FAT, directories and data clusters.
+
+The FAT width is decided the way the FAT specification does it, by the number
+of data clusters alone (fewer than 4085 is FAT12, fewer than 65525 FAT16), and
+fixes the codec every FAT access goes through.
+*/
+
+// Derive all region offsets from the boot sector and check them against the image size
+static int parse_geometry(struct Fat12Image *img, const char *path) {
+    const struct BootSector *bs = img->bs;
+    struct Fat12Geometry *geo = &img->geo;
+
+    uint32_t fat_sectors = bs->fat_size_16 ? bs->fat_size_16 : bs->fat32.fat_size_32;
+    if (bs->bytes_per_sector < 32 || (bs->bytes_per_sector & (bs->bytes_per_sector - 1)) != 0 ||
+        bs->sectors_per_cluster == 0 || bs->num_fats == 0 || fat_sectors == 0) {
+        fprintf(stderr, "%s: Error: invalid boot sector\n", path);
+        return -1;
+    }
+
+    geo->bytes_per_sector = bs->bytes_per_sector;
+    geo->sectors_per_cluster = bs->sectors_per_cluster;
+    geo->cluster_size = geo->bytes_per_sector * geo->sectors_per_cluster;
+    geo->reserved_sectors = bs->reserved_sectors;
+    geo->num_fats = bs->num_fats;
+    geo->fat_sectors = fat_sectors;
+    geo->root_dir_entries = bs->root_dir_entries;
+    geo->root_dir_sectors = (geo->root_dir_entries * 32 + geo->bytes_per_sector - 1) / geo->bytes_per_sector;
+    geo->total_sectors = bs->total_sectors_16 ? bs->total_sectors_16 : bs->total_sectors_32;
+
+    // A crafted fat_size_32 can wrap 32-bit sums, so the data area is placed in 64
+    // bits and must start inside the image before any offset is narrowed
+    uint64_t first_data_sector = geo->reserved_sectors + (uint64_t)geo->num_fats * geo->fat_sectors +
+                                 geo->root_dir_sectors;
+    if (geo->total_sectors < first_data_sector) {
+        fprintf(stderr, "%s: Error: invalid boot sector\n", path);
+        return -1;
+    }
+    uint64_t data_offset = first_data_sector * geo->bytes_per_sector;
+    if (data_offset > img->size || data_offset > UINT32_MAX) {
+        fprintf(stderr, "%s: Error: disk image is truncated\n", path);
+        return -1;
+    }
+
+    geo->fat_size = geo->fat_sectors * geo->bytes_per_sector;
+    geo->fat_offset = geo->reserved_sectors * geo->bytes_per_sector;
+    geo->root_dir_offset = (geo->reserved_sectors + geo->num_fats * geo->fat_sectors) * geo->bytes_per_sector;
+    geo->data_offset = data_offset;
+    geo->total_clusters = (geo->total_sectors - first_data_sector) / geo->sectors_per_cluster;
+
+    // The width follows from the cluster count; a FAT32 volume has no fixed root
+    // region and says where its root chain starts
+    geo->fat_bits = geo->total_clusters < 4085 ? 12 : geo->total_clusters < 65525 ? 16 : 32;
+    if (geo->fat_bits == 32) {
+        if (bs->fat_size_16 != 0 || geo->root_dir_entries != 0) {
+            fprintf(stderr, "%s: Error: invalid boot sector\n", path);
+            return -1;
+        }
+        geo->root_cluster = bs->fat32.root_cluster;
+        if (bs->fat32.fs_info > 0 && bs->fat32.fs_info < geo->reserved_sectors) {
+            geo->fs_info_offset = bs->fat32.fs_info * geo->bytes_per_sector;
+        }
+    }
+
+    // Never address clusters whose FAT entry or data lie past the end of the image
+    uint32_t fat_capacity = (uint32_t)(((uint64_t)geo->fat_size * 8) / geo->fat_bits);
+    if (geo->total_clusters + 2 > fat_capacity) {
+        geo->total_clusters = fat_capacity > 2 ? fat_capacity - 2 : 0;
+    }
+    uint32_t mapped_clusters = (img->size - geo->data_offset) / geo->cluster_size;
+    if (geo->total_clusters > mapped_clusters) {
+        geo->total_clusters = mapped_clusters;
+    }
+    if (geo->fat_bits == 32 && !fat12_valid_cluster(img, geo->root_cluster)) {
+        fprintf(stderr, "%s: Error: invalid boot sector\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int fat12_open(struct Fat12Image *img, const char *path, int writable) {
+    FAT12_PHASE(FAT12_PHASE_BOOT);
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: Error opening disk image: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "%s: Error reading disk image: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < 512) {
+        fprintf(stderr, "%s: Error reading boot sector: disk image too small\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "%s: Error mapping disk image: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    img->fd = fd;
+    img->writable = writable;
+    img->base = base;
+    img->size = st.st_size;
+    img->bs = (const struct BootSector *)img->base;
+    FAT12_STAT_READ(0, 512);
+
+    if (parse_geometry(img, path) != 0) {
+        fat12_close(img);
+        return -1;
+    }
+    img->codec = fat12_codec(img->geo.fat_bits);
+    img->ext = img->geo.fat_bits == 32 ? &img->bs->fat32.ext : &img->bs->ext;
+
+    img->fat = img->base + img->geo.fat_offset;
+    img->root_dir = (const struct DirEntry *)(img->base + img->geo.root_dir_offset);
+    img->data = img->base + img->geo.data_offset;
+    return 0;
+}
+
+void fat12_close(struct Fat12Image *img) {
+    if (img->base) {
+        munmap(img->base, img->size);
+    }
+    if (img->fd >= 0) {
+        close(img->fd);
+    }
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+}
+
+int fat12_fat_load(const struct Fat12Image *img, struct Fat12FatCache *cache) {
+    FAT12_PHASE(FAT12_PHASE_FAT);
+    memset(cache, 0, sizeof(*cache));
+    cache->codec = img->codec;
+    cache->size = img->geo.fat_size;
+    cache->bytes_per_sector = img->geo.bytes_per_sector;
+    cache->sectors = img->geo.fat_sectors;
+
+    cache->table = malloc(cache->size);
+    cache->dirty = calloc(cache->sectors, 1);
+    if (!cache->table || !cache->dirty) {
+        fprintf(stderr, "Error allocating memory for FAT: %s\n", strerror(errno));
+        fat12_fat_release(cache);
+        return -1;
+    }
+    memcpy(cache->table, img->fat, cache->size);
+    FAT12_STAT_READ(img->geo.fat_offset, cache->size);
+    return 0;
+}
+
+void fat12_fat_release(struct Fat12FatCache *cache) {
+    free(cache->table);
+    free(cache->dirty);
+    memset(cache, 0, sizeof(*cache));
+}
+
+uint32_t fat12_fat_get(const struct Fat12FatCache *cache, uint32_t cluster) {
+    return cache->codec->get(cache->table, cluster);
+}
+
+void fat12_fat_set(struct Fat12FatCache *cache, uint32_t cluster, uint32_t value) {
+    cache->codec->set(cache->table, cluster, value);
+
+    // A FAT12 entry may straddle a sector boundary
+    uint64_t first_bit = (uint64_t)cluster * cache->codec->bits;
+    cache->dirty[first_bit / 8 / cache->bytes_per_sector] = 1;
+    cache->dirty[(first_bit + cache->codec->bits - 1) / 8 / cache->bytes_per_sector] = 1;
+}
+
+// Mark the FAT32 free-cluster count and next-free hint unknown once the FAT
+// changes, as the specification allows, rather than keep them in step
+static int invalidate_fs_info(struct Fat12Image *img) {
+    uint32_t offset = img->geo.fs_info_offset;
+    if (offset == 0 || offset + 512 > img->geo.fat_offset) {
+        return 0;
+    }
+    const uint8_t *info = img->base + offset;
+    static const uint8_t unknown[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    if (memcmp(info, "RRaA", 4) != 0 || memcmp(info + 484, "rrAa", 4) != 0 || memcmp(info + 488, unknown, 8) == 0) {
+        return 0;
+    }
+    return fat12_write_meta(img, offset + 488, unknown, sizeof(unknown));
+}
+
+int fat12_fat_flush(struct Fat12Image *img, struct Fat12FatCache *cache) {
+    FAT12_PHASE(FAT12_PHASE_FAT);
+    if (memchr(cache->dirty, 1, cache->sectors) && invalidate_fs_info(img) != 0) {
+        return -1;
+    }
+    uint32_t sector = 0;
+    while (sector < cache->sectors) {
+        if (!cache->dirty[sector]) {
+            sector++;
+            continue;
+        }
+
+        // Coalesce adjacent dirty sectors into a single write per copy
+        uint32_t run_start = sector;
+        while (sector < cache->sectors && cache->dirty[sector]) {
+            sector++;
+        }
+        uint32_t offset = run_start * cache->bytes_per_sector;
+        uint32_t length = (sector - run_start) * cache->bytes_per_sector;
+
+        for (uint32_t copy = 0; copy < img->geo.num_fats; copy++) {
+            off_t fat_start = img->geo.fat_offset + (off_t)copy * img->geo.fat_size;
+            if (fat12_write_meta(img, fat_start + offset, cache->table + offset, length) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    memset(cache->dirty, 0, cache->sectors);
+    return 0;
+}
+
+int fat12_valid_cluster(const struct Fat12Image *img, uint32_t cluster) {
+    return cluster >= 2 && cluster < img->geo.total_clusters + 2;
+}
+
+off_t fat12_cluster_offset(const struct Fat12Image *img, uint32_t cluster) {
+    return (off_t)img->geo.data_offset + (off_t)(cluster - 2) * img->geo.cluster_size;
+}
+
+const uint8_t *fat12_cluster(const struct Fat12Image *img, uint32_t cluster) {
+    if (!fat12_valid_cluster(img, cluster)) {
+        return NULL;
+    }
+    return img->data + (size_t)(cluster - 2) * img->geo.cluster_size;
+}
+
+uint32_t fat12_next_cluster(const struct Fat12Image *img, uint32_t cluster) {
+    uint32_t next = img->codec->get(img->fat, cluster);
+    return fat12_valid_cluster(img, next) ? next : 0;
+}
+
+uint32_t fat12_entry_cluster(const struct Fat12Image *img, const struct DirEntry *entry) {
+    uint32_t high = img->geo.fat_bits == 32 ? entry->first_cluster_high : 0;
+    return entry->starting_cluster | high << 16;
+}
+
+void fat12_set_entry_cluster(const struct Fat12Image *img, struct DirEntry *entry, uint32_t cluster) {
+    entry->starting_cluster = cluster & 0xFFFF;
+    if (img->geo.fat_bits == 32) {
+        entry->first_cluster_high = cluster >> 16;
+    }
+}
+
+uint32_t fat12_dir_cluster(const struct Fat12Image *img, uint32_t cluster) {
+    return cluster ? cluster : img->geo.root_cluster;
+}
+
+void fat12_dir_open(struct Fat12DirIter *it, const struct Fat12Image *img, const struct Fat12FatCache *fat,
+                    uint32_t cluster) {
+    memset(it, 0, sizeof(*it));
+    it->img = img;
+    it->fat = fat;
+    cluster = fat12_dir_cluster(img, cluster);
+    it->cluster = cluster;
+    if (cluster == 0) {
+        it->entries = img->root_dir;
+        it->count = img->geo.root_dir_entries;
+        FAT12_STAT_READ(img->geo.root_dir_offset, it->count * sizeof(struct DirEntry));
+        return;
+    }
+    it->entries = (const struct DirEntry *)fat12_cluster(img, cluster);
+    it->count = img->geo.cluster_size / sizeof(struct DirEntry);
+    it->error = it->entries == NULL;
+    if (it->entries) {
+        FAT12_STAT_READ(fat12_cluster_offset(img, cluster), img->geo.cluster_size);
+    }
+}
+
+// Move to the next cluster of a subdirectory; returns 0 at the end of the chain
+static int dir_advance(struct Fat12DirIter *it) {
+    if (it->cluster == 0 || ++it->steps >= it->img->geo.total_clusters) {
+        return 0;  // The root directory is a single region
+    }
+    uint32_t next = it->fat ? fat12_fat_get(it->fat, it->cluster) : fat12_next_cluster(it->img, it->cluster);
+    if (!fat12_valid_cluster(it->img, next)) {
+        return 0;
+    }
+    it->cluster = next;
+    it->entries = (const struct DirEntry *)fat12_cluster(it->img, next);
+    it->index = 0;
+    FAT12_STAT_READ(fat12_cluster_offset(it->img, next), it->img->geo.cluster_size);
+    return 1;
+}
+
+const struct DirEntry *fat12_dir_next(struct Fat12DirIter *it) {
+    while (it->entries) {
+        if (it->index == it->count) {
+            if (!dir_advance(it)) {
+                it->entries = NULL;
+            }
+            continue;
+        }
+
+        const struct DirEntry *entry = &it->entries[it->index++];
+        if (entry->filename[0] == FAT12_ENTRY_FREE) {
+            it->entries = NULL;  // End of directory
+        } else if ((uint8_t)entry->filename[0] != FAT12_ENTRY_DELETED) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Search one directory (cluster 0 is the root) for a long or 8.3 name, leaving the
+// matching entry's long name (or "" if it has none) in long_name
+static const struct DirEntry *find_in_directory(const struct Fat12Image *img, uint32_t cluster, const char *name,
+                                                char *long_name) {
+    struct Fat12DirIter it;
+    fat12_dir_open(&it, img, NULL, cluster);
+
+    const struct DirEntry *entry;
+    while ((entry = fat12_dir_next_named(&it, long_name)) != NULL) {
+        char entry_name[13];
+        fat12_entry_name(entry, entry_name);
+        if ((long_name[0] && strcasecmp(long_name, name) == 0) || strcasecmp(entry_name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int fat12_lookup(const struct Fat12Image *img, const char *path, const struct DirEntry **out, char *name) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    const struct DirEntry *current = NULL;
+    uint32_t cluster = 0;
+    const char *p = path;
+    char long_name[FAT12_NAME_MAX];
+
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+
+        // Components longer than any name cannot match anything
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len >= FAT12_NAME_MAX) return -1;
+        char component[FAT12_NAME_MAX];
+        memcpy(component, p, len);
+        component[len] = '\0';
+        p += len;
+
+        // Only directories can have further components
+        if (current && !(current->attributes & FAT12_ATTR_DIRECTORY)) return -1;
+
+        current = find_in_directory(img, cluster, component, long_name);
+        if (!current) return -1;
+        cluster = fat12_entry_cluster(img, current);
+    }
+
+    if (name) {
+        if (!current) {
+            strcpy(name, "/");
+        } else if (long_name[0]) {
+            strcpy(name, long_name);
+        } else {
+            fat12_entry_name(current, name);
+        }
+    }
+    *out = current;
+    return 0;
+}
+
+int fat12_chain_extents(const struct Fat12Image *img, uint32_t first, uint32_t max_clusters,
+                        struct Fat12Extent **out, size_t *count) {
+    return img->codec->extents(img->fat, first, img->geo.total_clusters + 2, max_clusters, out, count);
+}
+
+int fat12_transfer(const struct Fat12Image *img, off_t offset, size_t len, int out_fd) {
+    FAT12_PHASE(FAT12_PHASE_DATA);
+    FAT12_STAT_READ(offset, len);
+
+    // Let the kernel move the data when it can: copy_file_range between files, or
+    // splice the image's page-cache pages into a pipe without copying them
+    off_t in_offset = offset;
+    int piped = 0;
+    while (len > 0) {
+        ssize_t n = piped ? splice(img->fd, &in_offset, out_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE)
+                          : copy_file_range(img->fd, &in_offset, out_fd, NULL, len, 0);
+        if (n > 0) {
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF) {
+            fprintf(stderr, "Error copying from disk image: %s\n", strerror(errno));
+            return -1;
+        }
+        if (n < 0 && !piped) {
+            piped = 1;  // Not a file; the output may be a pipe
+            continue;
+        }
+        break;  // Unsupported here, or the image ended early; fall back to the mapping
+    }
+
+    // Write the rest straight out of the mapping
+    if ((size_t)in_offset + len > img->size) {
+        fprintf(stderr, "Error reading disk image: offset out of range\n");
+        return -1;
+    }
+    const uint8_t *p = img->base + in_offset;
+    while (len > 0) {
+        ssize_t n = write(out_fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error writing to output file: %s\n", strerror(errno));
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void fat12_entry_name(const struct DirEntry *entry, char *out) {
+    int j = 0;
+    // Copy the base name, stopping at padding
+    for (int i = 0; i < 8 && entry->filename[i] != ' '; i++) {
+        out[j++] = entry->filename[i];
+    }
+    // Add dot if extension exists
+    if (entry->extension[0] != ' ') {
+        out[j++] = '.';
+        for (int i = 0; i < 3 && entry->extension[i] != ' '; i++) {
+            out[j++] = entry->extension[i];
+        }
+    }
+    out[j] = '\0';
+}
+
+int fat12_write(struct Fat12Image *img, off_t offset, const void *buf, size_t len) {
+    FAT12_STAT_WRITE(offset, len);
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(img->fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error writing to disk image: %s\n", strerror(errno));
+            return -1;
+        }
+        p += n;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int fat12_write_meta(struct Fat12Image *img, off_t offset, const void *buf, size_t len) {
+    if (img->journal) {
+        return fat12_journal_stage(img->journal, offset, buf, len);
+    }
+    return fat12_write(img, offset, buf, len);
+}
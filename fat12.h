@@ -0,0 +1,596 @@
+#ifndef FAT12_H
+#define FAT12_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "fat12_stats.h"
+
+/*
+fat12.h - Shared FAT12 Image Access Library
+
+This header declares the on-disk structures and the image engine shared by all of
+the disk utilities. An image is opened once and memory-mapped in its entirety; the
+boot sector is parsed into a geometry object holding every derived offset, and the
+FAT, root directory and data clusters are exposed as pointers straight into the
+mapping so that no per-entry seeks or reads are needed.
+
+Despite the name, FAT16 and FAT32 images work too: the FAT width follows from the
+cluster count, and every FAT access goes through a codec specialized for that
+width (see fat12_codec.c). Entries are handed out widened to FAT32 values, so end
+of chain and bad clusters compare the same on every image.
+
+The mapping is always read-only. Tools that modify an image write through the file
+descriptor (see fat12_write), which keeps write ordering explicit and under the
+caller's control; on Linux the shared mapping observes those writes immediately.
+*/
+
+#pragma pack(push, 1)
+// Extended boot record: right after the common fields on FAT12/16, after the
+// FAT32 fields on FAT32
+struct BootSectorTail {
+    uint8_t drive_number;
+    uint8_t reserved;
+    uint8_t boot_signature;
+    uint32_t volume_id;
+    char volume_label[11];
+    char fs_type[8];
+};
+
+struct BootSector {
+    uint8_t jmp[3];
+    char oem[8];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t num_fats;
+    uint16_t root_dir_entries;
+    uint16_t total_sectors_16;
+    uint8_t media_type;
+    uint16_t fat_size_16;
+    uint16_t sectors_per_track;
+    uint16_t num_heads;
+    uint32_t hidden_sectors;
+    uint32_t total_sectors_32;
+    union {
+        struct BootSectorTail ext;      // FAT12 and FAT16
+        struct {
+            uint32_t fat_size_32;
+            uint16_t ext_flags;
+            uint16_t fs_version;
+            uint32_t root_cluster;
+            uint16_t fs_info;           // Sector of the FSInfo block
+            uint16_t backup_boot_sector;
+            uint8_t reserved[12];
+            struct BootSectorTail ext;
+        } fat32;
+    };
+};
+
+struct DirEntry {
+    char filename[8];
+    char extension[3];
+    uint8_t attributes;
+    uint8_t reserved;
+    uint8_t creation_time_tenths;
+    uint16_t creation_time;
+    uint16_t creation_date;
+    uint16_t last_access_date;
+    uint16_t first_cluster_high;    // FAT32 only
+    uint16_t last_write_time;
+    uint16_t last_write_date;
+    uint16_t starting_cluster;
+    uint32_t file_size;
+};
+#pragma pack(pop)
+
+#define FAT12_ATTR_VOLUME_ID 0x08
+#define FAT12_ATTR_DIRECTORY 0x10
+#define FAT12_ATTR_LFN       0x0F
+
+#define FAT12_ENTRY_FREE     0x00
+#define FAT12_ENTRY_DELETED  0xE5
+
+#define FAT12_NAME_MAX       768     // Longest name in UTF-8 (255 UTF-16 units) with its terminator
+#define FAT12_LFN_CHARS      13      // Characters held by one long-name entry
+#define FAT12_LFN_LAST       0x40    // Sequence flag of the long-name entry that ends the name
+
+// FAT entry values as the codecs hand them out, whatever the width
+#define FAT12_BAD            0x0FFFFFF7  // Bad cluster
+#define FAT12_EOC            0x0FFFFFF8  // Entries at or above this value end a chain
+#define FAT12_EOC_MARK       0x0FFFFFFF  // Value written to terminate a chain
+
+// Everything derived from the boot sector, in bytes unless noted otherwise
+struct Fat12Geometry {
+    uint32_t bytes_per_sector;
+    uint32_t sectors_per_cluster;
+    uint32_t cluster_size;
+    uint32_t reserved_sectors;
+    uint32_t num_fats;
+    uint32_t fat_sectors;       // Sectors per FAT copy
+    uint32_t fat_size;          // Bytes per FAT copy
+    uint32_t root_dir_entries;  // 0 on FAT32, whose root is a cluster chain
+    uint32_t root_dir_sectors;
+    uint32_t total_sectors;
+    uint32_t total_clusters;    // Usable data clusters, numbered from 2
+    uint32_t fat_bits;          // 12, 16 or 32, from the cluster count
+    uint32_t root_cluster;      // First cluster of a FAT32 root directory, else 0
+    uint32_t fs_info_offset;    // FAT32 FSInfo block, 0 if there is none
+    uint32_t fat_offset;        // Offset of the first FAT copy
+    uint32_t root_dir_offset;
+    uint32_t data_offset;       // Offset of cluster 2
+};
+
+struct Fat12Journal;
+struct Fat12Extent;
+
+// Entry access for one FAT width. Each function is built from the same template
+// per width, so the loops inside them carry no width tests. Values read are
+// widened to FAT32 values (FAT12_BAD, FAT12_EOC...); values written are cut to
+// the width.
+struct Fat12Codec {
+    uint32_t bits;              // 12, 16 or 32
+    uint32_t mask;              // Bits an entry holds: 0xFFF, 0xFFFF or 0x0FFFFFFF
+    uint32_t (*get)(const uint8_t *fat, uint32_t cluster);
+    void (*set)(uint8_t *fat, uint32_t cluster, uint32_t value);
+
+    // Unpack count consecutive entries starting at first into out[0..count-1]
+    void (*decode)(const uint8_t *fat, uint32_t first, uint32_t count, uint32_t *out);
+
+    // Number of free entries among count consecutive entries starting at first
+    uint32_t (*count_free)(const uint8_t *fat, uint32_t first, uint32_t count);
+
+    // Follow the chain from first through clusters below limit, at most max_clusters
+    // links, into a malloc'd extent array; returns 0 or -1
+    int (*extents)(const uint8_t *fat, uint32_t first, uint32_t limit, uint32_t max_clusters,
+                   struct Fat12Extent **out, size_t *count);
+};
+
+// Codec for a FAT width, or NULL for anything but 12, 16 and 32
+const struct Fat12Codec *fat12_codec(uint32_t bits);
+
+// FAT12 bulk kernels behind the FAT12 codec, vectorized where the CPU allows
+void fat12_decode12(const uint8_t *fat, uint32_t first, uint32_t count, uint32_t *out);
+uint32_t fat12_count_free12(const uint8_t *fat, uint32_t first, uint32_t count);
+
+struct Fat12Image {
+    int fd;
+    int writable;
+    uint8_t *base;              // Whole image, mapped read-only
+    size_t size;
+    struct Fat12Journal *journal;  // Stages metadata writes while a transaction is open
+    const struct BootSector *bs;
+    const struct BootSectorTail *ext;  // Volume label and id, wherever the width puts them
+    struct Fat12Geometry geo;
+    const struct Fat12Codec *codec;
+    const uint8_t *fat;         // First FAT copy
+    const struct DirEntry *root_dir;
+    const uint8_t *data;        // Cluster 2
+};
+
+// Open and map an image; prints a diagnostic and returns -1 on failure
+int fat12_open(struct Fat12Image *img, const char *path, int writable);
+void fat12_close(struct Fat12Image *img);
+
+// First cluster of an entry; the high half only counts on FAT32
+uint32_t fat12_entry_cluster(const struct Fat12Image *img, const struct DirEntry *entry);
+void fat12_set_entry_cluster(const struct Fat12Image *img, struct DirEntry *entry, uint32_t cluster);
+
+// First cluster of a directory given as its entry's cluster (0 for the root): the
+// same cluster, or the FAT32 root chain; 0 means the fixed FAT12/16 root region
+uint32_t fat12_dir_cluster(const struct Fat12Image *img, uint32_t cluster);
+
+// Working copy of the FAT with per-sector dirty tracking
+struct Fat12FatCache {
+    const struct Fat12Codec *codec;
+    uint8_t *table;             // Packed entries, same layout as on disk
+    uint32_t size;              // Bytes in one FAT copy
+    uint32_t bytes_per_sector;
+    uint8_t *dirty;             // One flag per FAT sector
+    uint32_t sectors;
+};
+
+// Load the first FAT copy into memory; returns 0 or -1
+int fat12_fat_load(const struct Fat12Image *img, struct Fat12FatCache *cache);
+void fat12_fat_release(struct Fat12FatCache *cache);
+
+// Read or update an entry in the cached FAT; updates only mark sectors dirty
+uint32_t fat12_fat_get(const struct Fat12FatCache *cache, uint32_t cluster);
+void fat12_fat_set(struct Fat12FatCache *cache, uint32_t cluster, uint32_t value);
+
+// Write every run of dirty sectors back to all FAT copies, then clear the dirty flags
+int fat12_fat_flush(struct Fat12Image *img, struct Fat12FatCache *cache);
+
+// Free-cluster bitmap with a next-fit cursor, backed by a FAT cache
+struct Fat12Allocator {
+    uint64_t *bitmap;           // One bit per cluster, set when in use
+    uint32_t limit;             // One past the last usable cluster
+    uint32_t cursor;            // Where the next search starts
+    uint32_t free_count;
+    struct Fat12FatCache *fat;
+};
+
+// Build the bitmap from the cached FAT; returns 0 or -1
+int fat12_alloc_init(struct Fat12Allocator *alloc, const struct Fat12Image *img, struct Fat12FatCache *fat);
+void fat12_alloc_release(struct Fat12Allocator *alloc);
+
+// Allocate up to want contiguous clusters, chained and terminated in the FAT.
+// Returns the run length (0 when the disk is full) and stores its first cluster.
+uint32_t fat12_alloc_extent(struct Fat12Allocator *alloc, uint32_t want, uint32_t *start);
+
+// Allocate a single cluster marked as end of chain; returns 0 when the disk is full
+uint32_t fat12_alloc_cluster(struct Fat12Allocator *alloc);
+
+// Return every cluster of a chain to the free pool
+void fat12_alloc_free_chain(struct Fat12Allocator *alloc, uint32_t cluster);
+
+// Non-zero if cluster lies inside the image's data area
+int fat12_valid_cluster(const struct Fat12Image *img, uint32_t cluster);
+
+// Byte offset of a data cluster within the image
+off_t fat12_cluster_offset(const struct Fat12Image *img, uint32_t cluster);
+
+// Pointer to the start of a data cluster, or NULL if it is out of range
+const uint8_t *fat12_cluster(const struct Fat12Image *img, uint32_t cluster);
+
+// Next cluster in a chain, or 0 at the end of the chain or on a bad link
+uint32_t fat12_next_cluster(const struct Fat12Image *img, uint32_t cluster);
+
+// Long-name pieces gathered while walking a directory, waiting for their 8.3 entry
+struct Fat12LfnState {
+    uint16_t name[20 * FAT12_LFN_CHARS];  // UTF-16, in name order
+    uint8_t count;              // Pieces in the name being gathered, 0 for none
+    uint8_t expected;           // Sequence number of the next piece, 0 once complete
+    uint8_t checksum;           // Checksum of the 8.3 name the pieces belong to
+};
+
+// Cursor over the entries of one directory (cluster 0 is the root region). Entries
+// are handed out straight from the mapped image, a whole cluster at a time; chain
+// links come from fat when given (e.g. a session's unflushed cache), otherwise from
+// the image's own FAT.
+struct Fat12DirIter {
+    const struct Fat12Image *img;
+    const struct Fat12FatCache *fat;
+    uint32_t cluster;           // Cluster holding the current block, 0 for the root
+    const struct DirEntry *entries;  // Current block; NULL once the walk is over
+    uint32_t count;             // Entries in the current block
+    uint32_t index;             // Next entry of the block to examine
+    uint32_t steps;             // Clusters followed, bounding looping chains
+    int error;                  // Set if the first cluster is outside the data area
+    struct Fat12LfnState lfn;   // Long name of the next entry, for fat12_dir_next_named
+};
+
+void fat12_dir_open(struct Fat12DirIter *it, const struct Fat12Image *img, const struct Fat12FatCache *fat,
+                    uint32_t cluster);
+
+// Next in-use entry, skipping free and deleted slots; NULL at the end-of-directory
+// marker or the end of the chain. Long-name and volume entries are returned as-is.
+const struct DirEntry *fat12_dir_next(struct Fat12DirIter *it);
+
+// Next file, directory or "."/".." entry, skipping long-name and volume entries,
+// with its long name in name (FAT12_NAME_MAX bytes), or "" if it has none
+const struct DirEntry *fat12_dir_next_named(struct Fat12DirIter *it, char *name);
+
+// Resolve a '/'-separated path from the root, matching each component against
+// long and 8.3 names without regard to case. Returns 0 and the matching entry, or
+// NULL for the root itself; -1 if not found. When name is given it receives the
+// entry's long name, or its 8.3 name if it has none ("/" for the root).
+int fat12_lookup(const struct Fat12Image *img, const char *path, const struct DirEntry **out, char *name);
+
+// VFAT long names. Names are UTF-8 on the tools' side and UTF-16 on the image.
+
+// Checksum of an entry's 8.3 name, repeated in each of its long-name entries
+uint8_t fat12_lfn_checksum(const struct DirEntry *entry);
+
+// Gather a long-name entry met while walking a directory
+void fat12_lfn_feed(struct Fat12LfnState *lfn, const struct DirEntry *entry);
+
+// Hand the gathered long name to the 8.3 entry that follows it: returns 1 with the
+// name in name (FAT12_NAME_MAX bytes) if the pieces are complete and belong to
+// entry, else 0 with name empty. The state is reset either way.
+int fat12_lfn_take(struct Fat12LfnState *lfn, const struct DirEntry *entry, char *name);
+
+// Fill entry's 8.3 name from name. Returns 1 if name is a valid 8.3 name as it
+// stands, in upper case; otherwise stores the basis for an alias (upper-cased) and
+// returns 0, and the entry needs a long name and usually fat12_short_alias.
+int fat12_short_name(const char *name, struct DirEntry *entry);
+
+// Turn an alias basis into its n-th numbered form ("LONGNA~1.TXT")
+void fat12_short_alias(struct DirEntry *entry, uint32_t n);
+
+// Long-name entries name needs besides its 8.3 entry (0 if it is an exact 8.3
+// name, case included), or -1 if it cannot be stored: malformed UTF-8, a
+// forbidden character or too long
+int fat12_lfn_entries(const char *name);
+
+// Write the long-name entries for name, belonging to the 8.3 entry entry, into out
+// in on-disk order; returns how many (0 if none are needed) or -1 as above
+int fat12_lfn_encode(const char *name, const struct DirEntry *entry, struct DirEntry *out);
+
+// Every name in one directory, long and 8.3, mapped to the image offset of its
+// entry; built in one pass, then one hash probe per lookup
+struct Fat12NameSlot {
+    uint64_t offset;            // 0 marks an empty slot
+    uint32_t hash;
+    uint32_t name;              // Offset in names
+};
+
+struct Fat12NameTable {
+    struct Fat12NameSlot *slots;  // Open addressing, power-of-two size
+    uint32_t mask;
+    uint32_t count;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+};
+
+// Build the table for the directory at cluster (0 for the root), following links
+// in fat when given; returns 0 or -1 with a diagnostic
+int fat12_names_build(struct Fat12NameTable *t, const struct Fat12Image *img, const struct Fat12FatCache *fat,
+                      uint32_t cluster);
+
+// Record a name added to the directory; returns 0 or -1
+int fat12_names_add(struct Fat12NameTable *t, const char *name, uint64_t offset);
+
+// Entry offset for a name (case-insensitive), 0 if absent
+uint64_t fat12_names_find(const struct Fat12NameTable *t, const char *name);
+void fat12_names_free(struct Fat12NameTable *t);
+
+// A run of physically consecutive clusters
+struct Fat12Extent {
+    uint32_t cluster;           // First cluster of the run
+    uint32_t count;
+};
+
+// Resolve a chain into extents, following at most max_clusters links. On success
+// returns 0 with a malloc'd array in *out; a chain that ends early is not an error.
+int fat12_chain_extents(const struct Fat12Image *img, uint32_t first, uint32_t max_clusters,
+                        struct Fat12Extent **out, size_t *count);
+
+// Copy len bytes at offset in the image to out_fd (a file, pipe or socket), in-kernel
+// where possible
+int fat12_transfer(const struct Fat12Image *img, off_t offset, size_t len, int out_fd);
+
+// Format an entry's 8.3 name as "NAME.EXT" (at least 13 bytes of output)
+void fat12_entry_name(const struct DirEntry *entry, char *out);
+
+// Write len bytes at offset through the image descriptor; returns 0 or -1
+int fat12_write(struct Fat12Image *img, off_t offset, const void *buf, size_t len);
+
+// Write FAT or directory bytes: staged in the open journal if there is one,
+// otherwise written at once like fat12_write. File data should use fat12_write.
+int fat12_write_meta(struct Fat12Image *img, off_t offset, const void *buf, size_t len);
+
+// Write-ahead journal ("<image>.wal") that makes a set of metadata writes atomic.
+// While a transaction is open the image is mapped privately and fat12_write_meta
+// applies each write to the mapping and records it, so the session reads its own
+// changes while the file is untouched. File data goes straight to clusters that
+// nothing references yet. Commit then makes the data durable, writes and syncs
+// the journal, applies the records in place and syncs again, and removes the
+// journal; an interrupted commit is finished by fat12_journal_recover.
+#define FAT12_JOURNAL_MAGIC "FAT12WAL"
+
+struct Fat12JournalHeader {
+    char magic[8];
+    uint64_t image_size;
+    uint32_t record_count;
+    uint32_t reserved;
+    uint64_t payload_size;
+    uint64_t checksum;          // FNV-1a 64 over the records and the payload
+};
+
+// One staged write; the records are followed by their bytes, in order
+struct Fat12JournalRecord {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct Fat12Journal {
+    struct Fat12Image *img;
+    char path[4200];
+    struct Fat12JournalRecord *records;
+    size_t record_count;
+    size_t record_capacity;
+    uint8_t *payload;
+    size_t payload_size;
+    size_t payload_capacity;
+};
+
+// Replay a complete journal left by an interrupted commit, or discard a torn one.
+// Returns 0 (also when there is none) or -1 with a diagnostic.
+int fat12_journal_recover(struct Fat12Image *img, const char *image_path);
+
+// Open a transaction on a writable image; returns 0 or -1
+int fat12_journal_begin(struct Fat12Journal *journal, struct Fat12Image *img, const char *image_path);
+
+// Apply one write to the private mapping and record it; used by fat12_write_meta
+int fat12_journal_stage(struct Fat12Journal *journal, off_t offset, const void *buf, size_t len);
+
+// Commit everything staged so far; returns 0 or -1 with the image unchanged or
+// recoverable. The transaction stays open for further writes.
+int fat12_journal_commit(struct Fat12Journal *journal);
+
+// Close the transaction, dropping anything not committed. The mapping keeps the
+// staged view, so the image should be closed next.
+void fat12_journal_end(struct Fat12Journal *journal);
+
+// Queue for copying file data between the image and host files (fat12_queue.c).
+// With io_uring, each chunk is read into its own buffer by a request linked to the
+// write out of it, and up to depth chunks are in flight. Without io_uring, each
+// copy is done at once with pread and pwrite.
+#define FAT12_QUEUE_CHUNK (256 * 1024)
+#define FAT12_QUEUE_MAX_DEPTH 1024
+
+struct Fat12Ring;
+
+// One chunk buffer and the copy it is carrying
+struct Fat12QueueSlot {
+    int in_fd;
+    int out_fd;
+    off_t in_offset;
+    off_t out_offset;
+    size_t len;
+    int pending;                // Completions still to come (the read and the write)
+    int redo;                   // One of them fell short; copy again with pread/pwrite
+};
+
+struct Fat12Queue {
+    struct Fat12Ring *ring;     // io_uring state, NULL when copying with pread/pwrite
+    uint32_t depth;
+    uint8_t *buffers;           // FAT12_QUEUE_CHUNK bytes per slot
+    struct Fat12QueueSlot *slots;
+    uint32_t *free_slots;
+    uint32_t free_count;
+    int failed;                 // A chunk failed since the last drain
+};
+
+// Depth given with --queue-depth=<n>, or 0 when tools should copy as before
+extern uint32_t fat12_queue_depth;
+
+// Take every "--queue-depth=<n>" out of argv and set fat12_queue_depth; returns 0,
+// or -1 with a diagnostic for a depth out of range
+int fat12_queue_option(int *argc, char *argv[]);
+
+// Set up a queue of depth chunks, on io_uring when the kernel allows; returns 0 or -1
+int fat12_queue_open(struct Fat12Queue *q, uint32_t depth);
+
+// Copy len bytes from in_fd at in_offset to out_fd at out_offset. Queued copies may
+// still be running on return; returns 0, or -1 if this or an earlier copy failed.
+int fat12_queue_copy(struct Fat12Queue *q, int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t len);
+
+// Wait for every queued copy; returns 0, or -1 if any failed since the last drain
+int fat12_queue_drain(struct Fat12Queue *q);
+
+void fat12_queue_close(struct Fat12Queue *q);
+
+// Sidecar index ("<image>.idx") mapping full paths to directory entries and extents.
+// It is valid only while the image's size, mtime, inode and boot sector hash match
+// the values recorded when it was built.
+#define FAT12_INDEX_MAGIC "FAT12IX4"
+#define FAT12_INDEX_NONE  0xFFFFFFFFu
+
+struct Fat12IndexHeader {
+    char magic[8];
+    uint64_t image_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t inode;
+    uint64_t boot_hash;         // Hash of the boot sector
+    uint32_t record_count;
+    uint32_t dir_count;
+    uint32_t bucket_count;      // Power of two
+    uint32_t extent_count;
+    uint32_t strings_size;
+    uint32_t reserved;
+};
+
+// One file or directory
+struct Fat12IndexRecord {
+    uint64_t entry_offset;      // Byte offset of its directory entry in the image
+    uint32_t path;              // Offset of "/DIR/NAME.EXT" in the string table
+    uint32_t hash;              // Hash of the uppercased path
+    uint32_t next;              // Next record in the same hash bucket
+    uint32_t first_extent;      // Extents of its cluster chain
+    uint32_t extent_count;
+};
+
+// One directory, in breadth-first order; directory 0 is the root
+struct Fat12IndexDir {
+    uint32_t record;            // Record of its own entry, FAT12_INDEX_NONE for the root
+    uint32_t parent;
+    uint32_t first_child;       // The records of the entries it lists are contiguous
+    uint32_t child_count;
+};
+
+struct Fat12Index {
+    void *base;                 // Whole sidecar, mapped read-only
+    size_t size;
+    int owned;                  // base was built in memory and is freed on close
+    const struct Fat12IndexHeader *header;
+    const struct Fat12IndexRecord *records;
+    const struct Fat12IndexDir *dirs;
+    const uint32_t *buckets;
+    const struct Fat12Extent *extents;
+    const char *strings;
+};
+
+// Walk the whole tree and write the sidecar for image_path, replacing any old one.
+// Returns 0 and the number of records, or -1 with a diagnostic.
+int fat12_index_build(const struct Fat12Image *img, const char *image_path, uint32_t *records);
+
+// Build the same index in memory only, for a process that keeps the image open
+int fat12_index_build_memory(struct Fat12Index *index, const struct Fat12Image *img);
+
+// Map the sidecar if it exists and still matches the image; returns 0, or -1
+// (silently) when there is no usable index
+int fat12_index_open(struct Fat12Index *index, const struct Fat12Image *img, const char *image_path);
+void fat12_index_close(struct Fat12Index *index);
+
+// Find a path (case-insensitive, repeated '/' ignored); NULL if absent or for the root
+const struct Fat12IndexRecord *fat12_index_find(const struct Fat12Index *index, const char *path);
+
+// Directory entry of a record returned by fat12_index_find
+const struct DirEntry *fat12_index_entry(const struct Fat12Image *img, const struct Fat12IndexRecord *record);
+
+// Last component of a record's path: its long name, or its 8.3 name if it has none
+const char *fat12_index_name(const struct Fat12Index *index, const struct Fat12IndexRecord *record);
+
+// What fat12_stat, fat12_file_stat and fat12_readdir report about an entry
+struct Fat12Stat {
+    char name[FAT12_NAME_MAX];  // Long name, else "NAME.EXT"; "/" for the root
+    uint32_t size;              // 0 for directories
+    uint8_t attributes;
+    uint32_t first_cluster;
+    int is_dir;
+    const struct DirEntry *entry;  // Entry in the mapped image; NULL for the root
+};
+
+// A file opened for random-access reads. Its chain is resolved into extents once,
+// with the file cluster each one starts at, so a read at any offset goes straight
+// to the right cluster.
+struct Fat12File {
+    const struct Fat12Image *img;
+    const struct DirEntry *entry;
+    char name[FAT12_NAME_MAX];  // As fat12_file_stat reports it
+    uint32_t size;
+    uint64_t position;          // Where fat12_file_read continues
+    struct Fat12Extent *extents;
+    uint32_t *extent_start;     // File cluster index at which each extent begins
+    size_t extent_count;
+    uint32_t mapped_clusters;   // Clusters the chain actually supplies
+};
+
+// The functions below print nothing; on failure they return -1 with errno set
+// (ENOENT, EISDIR, ENOTDIR, EIO, ENOMEM or EINVAL). index may be NULL; when given
+// it must match img (see fat12_index_open).
+
+// Describe the file or directory at path
+int fat12_stat(const struct Fat12Image *img, const struct Fat12Index *index, const char *path,
+               struct Fat12Stat *st);
+
+// Open the file at path for reading; returns 0 or -1
+int fat12_file_open(struct Fat12File *f, const struct Fat12Image *img, const struct Fat12Index *index,
+                    const char *path);
+void fat12_file_close(struct Fat12File *f);
+int fat12_file_stat(const struct Fat12File *f, struct Fat12Stat *st);
+
+// Copy up to len bytes at offset into buf; returns the count (0 at end of file) or -1
+ssize_t fat12_file_pread(const struct Fat12File *f, void *buf, size_t len, uint64_t offset);
+
+// Read from and advance the handle's position
+ssize_t fat12_file_read(struct Fat12File *f, void *buf, size_t len);
+
+// Move the position as lseek does (SEEK_SET, SEEK_CUR, SEEK_END); returns it or -1
+int64_t fat12_file_seek(struct Fat12File *f, int64_t offset, int whence);
+
+// Start listing the directory at path ("/" for the root); returns 0 or -1
+int fat12_opendir(struct Fat12DirIter *it, const struct Fat12Image *img, const struct Fat12Index *index,
+                  const char *path);
+
+// Next file or subdirectory, skipping long-name, volume label, "." and ".." entries.
+// Returns 1 with st filled in, or 0 at the end of the directory.
+int fat12_readdir(struct Fat12DirIter *it, struct Fat12Stat *st);
+
+#endif
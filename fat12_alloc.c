@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "fat12.h"
+
+/*
+fat12_alloc.c - Free-Cluster Allocator
+
+Keeps a bitmap of in-use clusters built once from the cached FAT. Allocation is
+next-fit: each request starts scanning where the previous one ended, so successive
+files are laid out one after another instead of re-scanning from cluster 2. Requests
+are served as contiguous extents; when no single run is long enough the longest one
+available is handed out and the caller asks again for the remainder.
+*/
+
+#define BITS_PER_WORD 64
+#define DECODE_CHUNK 1024       // FAT entries unpacked per codec decode call
+
+static int cluster_used(const struct Fat12Allocator *alloc, uint32_t cluster) {
+    return (alloc->bitmap[cluster / BITS_PER_WORD] >> (cluster % BITS_PER_WORD)) & 1;
+}
+
+static void mark_used(struct Fat12Allocator *alloc, uint32_t cluster) {
+    alloc->bitmap[cluster / BITS_PER_WORD] |= (uint64_t)1 << (cluster % BITS_PER_WORD);
+}
+
+static void mark_free(struct Fat12Allocator *alloc, uint32_t cluster) {
+    alloc->bitmap[cluster / BITS_PER_WORD] &= ~((uint64_t)1 << (cluster % BITS_PER_WORD));
+}
+
+// Skip to the next free cluster in [cluster, end), a whole word at a time when full
+static uint32_t next_free(const struct Fat12Allocator *alloc, uint32_t cluster, uint32_t end) {
+    while (cluster < end) {
+        uint64_t word = alloc->bitmap[cluster / BITS_PER_WORD] >> (cluster % BITS_PER_WORD);
+        uint64_t free_bits = ~word;
+        if (cluster % BITS_PER_WORD != 0) {
+            free_bits &= ~(uint64_t)0 >> (cluster % BITS_PER_WORD);
+        }
+        if (free_bits) {
+            cluster += __builtin_ctzll(free_bits);
+            return cluster < end ? cluster : end;
+        }
+        cluster = (cluster / BITS_PER_WORD + 1) * BITS_PER_WORD;
+    }
+    return end;
+}
+
+// Search [from, end) for a run of at least want free clusters, remembering the longest seen
+static int find_run(const struct Fat12Allocator *alloc, uint32_t from, uint32_t end, uint32_t want,
+                    uint32_t *best_start, uint32_t *best_len) {
+    uint32_t cluster = next_free(alloc, from, end);
+    while (cluster < end) {
+        uint32_t run_start = cluster;
+        while (cluster < end && cluster - run_start < want && !cluster_used(alloc, cluster)) {
+            cluster++;
+        }
+        uint32_t run_len = cluster - run_start;
+        if (run_len > *best_len) {
+            *best_start = run_start;
+            *best_len = run_len;
+        }
+        if (run_len >= want) {
+            return 1;
+        }
+        cluster = next_free(alloc, cluster, end);
+    }
+    return 0;
+}
+
+int fat12_alloc_init(struct Fat12Allocator *alloc, const struct Fat12Image *img, struct Fat12FatCache *fat) {
+    FAT12_PHASE(FAT12_PHASE_FAT);
+    memset(alloc, 0, sizeof(*alloc));
+    alloc->fat = fat;
+    alloc->limit = img->geo.total_clusters + 2;
+    alloc->cursor = 2;
+
+    size_t words = (alloc->limit + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    alloc->bitmap = calloc(words ? words : 1, sizeof(uint64_t));
+    if (!alloc->bitmap) {
+        fprintf(stderr, "Error allocating memory for cluster bitmap: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Clusters 0 and 1 are reserved; everything else follows the FAT
+    mark_used(alloc, 0);
+    if (alloc->limit > 1) {
+        mark_used(alloc, 1);
+    }
+    uint32_t entries[DECODE_CHUNK];
+    for (uint32_t chunk = 2; chunk < alloc->limit; chunk += DECODE_CHUNK) {
+        uint32_t count = alloc->limit - chunk < DECODE_CHUNK ? alloc->limit - chunk : DECODE_CHUNK;
+        fat->codec->decode(fat->table, chunk, count, entries);
+        for (uint32_t i = 0; i < count; i++) {
+            if (entries[i] != 0) {
+                mark_used(alloc, chunk + i);
+            } else {
+                alloc->free_count++;
+            }
+        }
+    }
+    return 0;
+}
+
+void fat12_alloc_release(struct Fat12Allocator *alloc) {
+    free(alloc->bitmap);
+    memset(alloc, 0, sizeof(*alloc));
+}
+
+uint32_t fat12_alloc_extent(struct Fat12Allocator *alloc, uint32_t want, uint32_t *start) {
+    if (want == 0 || alloc->free_count == 0) {
+        return 0;
+    }
+
+    // Next-fit: look from the cursor to the end, then wrap around to cluster 2
+    uint32_t best_start = 0, best_len = 0;
+    if (!find_run(alloc, alloc->cursor, alloc->limit, want, &best_start, &best_len)) {
+        find_run(alloc, 2, alloc->cursor, want, &best_start, &best_len);
+    }
+    if (best_len == 0) {
+        return 0;
+    }
+
+    // Chain the run together in the FAT and terminate it
+    for (uint32_t i = 0; i < best_len; i++) {
+        uint32_t cluster = best_start + i;
+        mark_used(alloc, cluster);
+        fat12_fat_set(alloc->fat, cluster, i + 1 < best_len ? cluster + 1 : FAT12_EOC_MARK);
+    }
+
+    alloc->free_count -= best_len;
+    alloc->cursor = best_start + best_len < alloc->limit ? best_start + best_len : 2;
+    *start = best_start;
+    return best_len;
+}
+
+uint32_t fat12_alloc_cluster(struct Fat12Allocator *alloc) {
+    uint32_t cluster;
+    if (fat12_alloc_extent(alloc, 1, &cluster) == 0) {
+        return 0;
+    }
+    return cluster;
+}
+
+void fat12_alloc_free_chain(struct Fat12Allocator *alloc, uint32_t cluster) {
+    // Bounded by the cluster count so a corrupt cycle cannot spin forever
+    for (uint32_t steps = 0; steps < alloc->limit && cluster >= 2 && cluster < alloc->limit; steps++) {
+        uint32_t next = fat12_fat_get(alloc->fat, cluster);
+        if (cluster_used(alloc, cluster)) {
+            mark_free(alloc, cluster);
+            alloc->free_count++;
+        }
+        fat12_fat_set(alloc->fat, cluster, 0);
+        if (next >= FAT12_EOC) {
+            break;
+        }
+        cluster = next;
+    }
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "fat12.h"
+
+/*
+fat12_codec.c - FAT Entry Codecs
+
+One codec per FAT width. Only three primitives differ between widths: where an
+entry's bits live (load and store) and how its reserved values map onto the
+FAT32 ones (normal). Everything else, from single lookups to the chain walk that
+resolves extents, is written once in fat12_codec_template.h and compiled three
+times, so each width gets its own loops with the entry layout inlined. An image
+picks its codec once when it is opened; callers go through one indirect call per
+operation, never per entry. FAT12 swaps in the vectorized bulk kernels from
+fat12_simd.c for decoding and counting.
+*/
+
+// FAT12: two entries packed into every 3 bytes
+static inline uint32_t load_12(const uint8_t *fat, uint32_t cluster) {
+    const uint8_t *p = fat + cluster + cluster / 2;
+    uint32_t pair = p[0] | (p[1] << 8);
+    return (cluster & 1) ? pair >> 4 : pair & 0x0FFF;
+}
+
+static inline uint32_t normal_12(uint32_t value) {
+    return value >= 0xFF7 ? value | 0x0FFFF000 : value;
+}
+
+static inline void store_12(uint8_t *fat, uint32_t cluster, uint32_t value) {
+    uint8_t *p = fat + cluster + cluster / 2;
+    value &= 0x0FFF;
+    // Keep the neighbouring entry's nibble
+    if (cluster & 1) {
+        p[0] = (p[0] & 0x0F) | ((value << 4) & 0xF0);
+        p[1] = value >> 4;
+    } else {
+        p[0] = value & 0xFF;
+        p[1] = (p[1] & 0xF0) | (value >> 8);
+    }
+}
+
+// FAT16: one little-endian 16-bit word per entry
+static inline uint32_t load_16(const uint8_t *fat, uint32_t cluster) {
+    const uint8_t *p = fat + 2 * (size_t)cluster;
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t normal_16(uint32_t value) {
+    return value >= 0xFFF7 ? value | 0x0FFF0000 : value;
+}
+
+static inline void store_16(uint8_t *fat, uint32_t cluster, uint32_t value) {
+    uint8_t *p = fat + 2 * (size_t)cluster;
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+// FAT32: 28 bits of a little-endian 32-bit word; the top 4 bits are reserved
+static inline uint32_t load_32(const uint8_t *fat, uint32_t cluster) {
+    const uint8_t *p = fat + 4 * (size_t)cluster;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t normal_32(uint32_t value) {
+    return value & 0x0FFFFFFF;
+}
+
+static inline void store_32(uint8_t *fat, uint32_t cluster, uint32_t value) {
+    uint8_t *p = fat + 4 * (size_t)cluster;
+    value = (value & 0x0FFFFFFF) | (load_32(fat, cluster) & 0xF0000000);
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+#define FAT_BITS 12
+#define FAT_BULK_KERNELS
+#include "fat12_codec_template.h"
+#undef FAT_BULK_KERNELS
+#undef FAT_BITS
+
+#define FAT_BITS 16
+#include "fat12_codec_template.h"
+#undef FAT_BITS
+
+#define FAT_BITS 32
+#include "fat12_codec_template.h"
+#undef FAT_BITS
+
+static const struct Fat12Codec codecs[] = {
+    {12, 0x00000FFF, get_12, set_12, fat12_decode12, fat12_count_free12, extents_12},
+    {16, 0x0000FFFF, get_16, set_16, decode_16, count_free_16, extents_16},
+    {32, 0x0FFFFFFF, get_32, set_32, decode_32, count_free_32, extents_32},
+};
+
+const struct Fat12Codec *fat12_codec(uint32_t bits) {
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+        if (codecs[i].bits == bits) {
+            return &codecs[i];
+        }
+    }
+    return NULL;
+}
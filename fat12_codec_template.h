@@ -0,0 +1,77 @@
+/*
+fat12_codec_template.h - Width-Specialized FAT Entry Functions
+
+Included by fat12_codec.c once per FAT width with FAT_BITS set to 12, 16 or 32
+and the primitives load_<bits>, normal_<bits> and store_<bits> defined. Each
+inclusion stamps out the codec functions for that width, so every loop below is
+compiled against one fixed entry layout and tests nothing per entry but the
+entries themselves.
+*/
+
+#define CODEC_PASTE(name, bits) name##_##bits
+#define CODEC_EXPAND(name, bits) CODEC_PASTE(name, bits)
+#define CODEC(name) CODEC_EXPAND(name, FAT_BITS)
+
+static uint32_t CODEC(get)(const uint8_t *fat, uint32_t cluster) {
+    FAT12_STAT_FAT_LOOKUP();
+    return CODEC(normal)(CODEC(load)(fat, cluster));
+}
+
+static void CODEC(set)(uint8_t *fat, uint32_t cluster, uint32_t value) {
+    CODEC(store)(fat, cluster, value);
+}
+
+// A width with its own bulk kernels defines FAT_BULK_KERNELS and skips these
+#ifndef FAT_BULK_KERNELS
+static void CODEC(decode)(const uint8_t *fat, uint32_t first, uint32_t count, uint32_t *out) {
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = CODEC(normal)(CODEC(load)(fat, first + i));
+    }
+}
+
+static uint32_t CODEC(count_free)(const uint8_t *fat, uint32_t first, uint32_t count) {
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += CODEC(normal)(CODEC(load)(fat, first + i)) == 0;
+    }
+    return total;
+}
+#endif
+
+static int CODEC(extents)(const uint8_t *fat, uint32_t first, uint32_t limit, uint32_t max_clusters,
+                          struct Fat12Extent **out, size_t *count) {
+    struct Fat12Extent *extents = NULL;
+    size_t used = 0, capacity = 0;
+    uint32_t cluster = first >= 2 && first < limit ? first : 0;
+
+    for (uint32_t walked = 0; cluster != 0 && walked < max_clusters; walked++) {
+        if (used > 0 && extents[used - 1].cluster + extents[used - 1].count == cluster) {
+            extents[used - 1].count++;
+        } else {
+            if (used == capacity) {
+                capacity = capacity ? capacity * 2 : 8;
+                struct Fat12Extent *grown = realloc(extents, capacity * sizeof(*grown));
+                if (!grown) {
+                    fprintf(stderr, "Memory allocation error: %s\n", strerror(errno));
+                    free(extents);
+                    return -1;
+                }
+                extents = grown;
+            }
+            extents[used].cluster = cluster;
+            extents[used].count = 1;
+            used++;
+        }
+        FAT12_STAT_FAT_LOOKUP();
+        uint32_t next = CODEC(normal)(CODEC(load)(fat, cluster));
+        cluster = next >= 2 && next < limit ? next : 0;
+    }
+
+    *out = extents;
+    *count = used;
+    return 0;
+}
+
+#undef CODEC
+#undef CODEC_EXPAND
+#undef CODEC_PASTE
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "fat12.h"
+
+/*
+fat12_file.c - File Handles for Random-Access Reads
+
+Opening a file resolves its whole cluster chain once into extents of physically
+consecutive clusters, each tagged with the file cluster it starts at. A read at
+any offset then finds its extent with a binary search and copies straight out of
+the mapped image, continuing through the following extents, so programs that only
+need headers or slices of large files never walk the FAT from the first cluster
+or copy the whole file out. When a matching sidecar index is supplied, both the
+path lookup and the extents come from it.
+
+Like fat12_lookup, these functions report failures through their return value and
+errno only, and print nothing.
+*/
+
+// Find path through the index when one is given, else by walking directories.
+// Sets *record when the index answered, and name to the entry's name.
+static int resolve(const struct Fat12Image *img, const struct Fat12Index *index, const char *path,
+                   const struct DirEntry **entry, const struct Fat12IndexRecord **record, char *name) {
+    *record = index ? fat12_index_find(index, path) : NULL;
+    if (*record) {
+        *entry = fat12_index_entry(img, *record);
+        strcpy(name, fat12_index_name(index, *record));
+        return 0;
+    }
+    if (fat12_lookup(img, path, entry, name) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+// Describe entry under name, or under its 8.3 name when name is empty
+static void fill_stat(const struct Fat12Image *img, const struct DirEntry *entry, const char *name,
+                      struct Fat12Stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->entry = entry;
+    if (!entry) {
+        strcpy(st->name, "/");
+        st->attributes = FAT12_ATTR_DIRECTORY;
+        st->is_dir = 1;
+        return;
+    }
+    if (name[0]) {
+        strcpy(st->name, name);
+    } else {
+        fat12_entry_name(entry, st->name);
+    }
+    st->attributes = entry->attributes;
+    st->first_cluster = fat12_entry_cluster(img, entry);
+    st->is_dir = (entry->attributes & FAT12_ATTR_DIRECTORY) != 0;
+    st->size = st->is_dir ? 0 : entry->file_size;
+}
+
+int fat12_stat(const struct Fat12Image *img, const struct Fat12Index *index, const char *path,
+               struct Fat12Stat *st) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    const struct DirEntry *entry;
+    const struct Fat12IndexRecord *record;
+    char name[FAT12_NAME_MAX];
+    if (resolve(img, index, path, &entry, &record, name) != 0) {
+        return -1;
+    }
+    fill_stat(img, entry, name, st);
+    return 0;
+}
+
+int fat12_file_open(struct Fat12File *f, const struct Fat12Image *img, const struct Fat12Index *index,
+                    const char *path) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    memset(f, 0, sizeof(*f));
+    const struct DirEntry *entry;
+    const struct Fat12IndexRecord *record;
+    if (resolve(img, index, path, &entry, &record, f->name) != 0) {
+        return -1;
+    }
+    if (!entry || (entry->attributes & FAT12_ATTR_DIRECTORY)) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    // Resolve the chain once, or take it from the index
+    uint32_t cluster_size = img->geo.cluster_size;
+    uint32_t clusters = (entry->file_size + cluster_size - 1) / cluster_size;
+    if (record) {
+        f->extent_count = record->extent_count;
+        f->extents = malloc((f->extent_count ? f->extent_count : 1) * sizeof(*f->extents));
+        if (!f->extents) {
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(f->extents, index->extents + record->first_extent, f->extent_count * sizeof(*f->extents));
+    } else if (fat12_chain_extents(img, fat12_entry_cluster(img, entry), clusters, &f->extents, &f->extent_count) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // File cluster at which each extent starts, for the binary search in pread
+    f->extent_start = malloc((f->extent_count ? f->extent_count : 1) * sizeof(*f->extent_start));
+    if (!f->extent_start) {
+        free(f->extents);
+        f->extents = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    uint32_t start = 0;
+    for (size_t i = 0; i < f->extent_count; i++) {
+        f->extent_start[i] = start;
+        start += f->extents[i].count;
+    }
+
+    f->img = img;
+    f->entry = entry;
+    f->size = entry->file_size;
+    f->mapped_clusters = start;
+    return 0;
+}
+
+void fat12_file_close(struct Fat12File *f) {
+    free(f->extents);
+    free(f->extent_start);
+    memset(f, 0, sizeof(*f));
+}
+
+int fat12_file_stat(const struct Fat12File *f, struct Fat12Stat *st) {
+    fill_stat(f->img, f->entry, f->name, st);
+    return 0;
+}
+
+// Extent holding file cluster index, which must be below f->mapped_clusters
+static size_t find_extent(const struct Fat12File *f, uint32_t index) {
+    size_t low = 0, high = f->extent_count - 1;
+    while (low < high) {
+        size_t mid = (low + high + 1) / 2;
+        if (f->extent_start[mid] <= index) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+ssize_t fat12_file_pread(const struct Fat12File *f, void *buf, size_t len, uint64_t offset) {
+    FAT12_PHASE(FAT12_PHASE_DATA);
+    if (offset >= f->size) {
+        return 0;
+    }
+    if (len > f->size - offset) {
+        len = f->size - offset;
+    }
+
+    // A chain shorter than the file size cannot supply the rest
+    uint32_t cluster_size = f->img->geo.cluster_size;
+    if (offset + len > (uint64_t)f->mapped_clusters * cluster_size) {
+        errno = EIO;
+        return -1;
+    }
+
+    uint8_t *out = buf;
+    size_t done = 0;
+    uint32_t index = offset / cluster_size;
+    size_t i = find_extent(f, index);
+    uint64_t within = offset - (uint64_t)f->extent_start[i] * cluster_size;
+    for (; done < len; i++, within = 0) {
+        const uint8_t *run = fat12_cluster(f->img, f->extents[i].cluster);
+        uint64_t run_bytes = (uint64_t)f->extents[i].count * cluster_size;
+        if (!run || fat12_cluster_offset(f->img, f->extents[i].cluster) + run_bytes > f->img->size) {
+            errno = EIO;
+            return -1;
+        }
+        size_t chunk = run_bytes - within < len - done ? run_bytes - within : len - done;
+        memcpy(out + done, run + within, chunk);
+        FAT12_STAT_READ(fat12_cluster_offset(f->img, f->extents[i].cluster) + within, chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+ssize_t fat12_file_read(struct Fat12File *f, void *buf, size_t len) {
+    ssize_t n = fat12_file_pread(f, buf, len, f->position);
+    if (n > 0) {
+        f->position += n;
+    }
+    return n;
+}
+
+int64_t fat12_file_seek(struct Fat12File *f, int64_t offset, int whence) {
+    int64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (int64_t)f->position
+                 : whence == SEEK_END ? (int64_t)f->size : -1;
+    if (base < 0 || base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    f->position = base + offset;
+    return f->position;
+}
+
+int fat12_opendir(struct Fat12DirIter *it, const struct Fat12Image *img, const struct Fat12Index *index,
+                  const char *path) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    const struct DirEntry *entry;
+    const struct Fat12IndexRecord *record;
+    char name[FAT12_NAME_MAX];
+    if (resolve(img, index, path, &entry, &record, name) != 0) {
+        return -1;
+    }
+    if (entry && !(entry->attributes & FAT12_ATTR_DIRECTORY)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    uint32_t cluster = entry ? fat12_entry_cluster(img, entry) : 0;
+    if (entry && cluster < 2) {
+        errno = EIO;  // A subdirectory cannot start in the root region
+        return -1;
+    }
+    fat12_dir_open(it, img, NULL, cluster);
+    if (it->error) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int fat12_readdir(struct Fat12DirIter *it, struct Fat12Stat *st) {
+    const struct DirEntry *entry;
+    char name[FAT12_NAME_MAX];
+    while ((entry = fat12_dir_next_named(it, name)) != NULL) {
+        if (entry->filename[0] == '.') continue;  // "." and ".."
+        fill_stat(it->img, entry, name, st);
+        return 1;
+    }
+    return 0;
+}
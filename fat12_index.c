@@ -0,0 +1,476 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fat12.h"
+
+/*
+fat12_index.c - Sidecar Path Index
+
+Builds and reads "<image>.idx", a flat file holding every file and directory of
+an image: a hash table from full path to directory-entry offset, the extents of
+each cluster chain, and the directories in breadth-first order with their entries
+stored contiguously. Paths are spelled with long names where entries have them;
+tools fall back to a directory walk for paths given with 8.3 aliases. The file is
+mapped read-only, so opening it costs one mmap and a lookup is one hash probe with
+no directory scanning.
+
+The index records the image's size, mtime and inode plus a hash of the boot
+sector. Any mismatch makes fat12_index_open fail and the tools fall back to
+walking the directories. Every write through the tools changes the mtime, so
+only the boot sector is read back; opening an index never scans the FATs.
+*/
+
+// Growable arrays used while building
+struct IndexBuilder {
+    struct Fat12IndexRecord *records;
+    size_t record_count, record_capacity;
+    struct Fat12IndexDir *dirs;
+    size_t dir_count, dir_capacity;
+    struct Fat12Extent *extents;
+    size_t extent_count, extent_capacity;
+    char *strings;
+    size_t strings_size, strings_capacity;
+};
+
+static int grow(void **items, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *grown = realloc(*items, new_capacity * item_size);
+    if (!grown) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    *items = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// FNV-1a over a path, folding case and skipping repeated or trailing '/'
+static uint32_t path_hash(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' && (p[1] == '/' || p[1] == '\0')) continue;
+        hash = (hash ^ (uint8_t)toupper((unsigned char)*p)) * 16777619u;
+    }
+    return hash;
+}
+
+// Compare a stored path with a query under the same folding as path_hash
+static int path_equal(const char *stored, const char *query) {
+    for (;;) {
+        while (*query == '/' && (query[1] == '/' || query[1] == '\0')) query++;
+        if (toupper((unsigned char)*stored) != toupper((unsigned char)*query)) return 0;
+        if (*stored == '\0') return 1;
+        stored++;
+        query++;
+    }
+}
+
+// FNV-1a 64 over the boot sector. The FATs and directories are left to the size,
+// mtime and inode checks, so opening an index costs the same on any volume size.
+static uint64_t boot_hash(const struct Fat12Image *img) {
+    FAT12_STAT_READ(0, 512);
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < 512; i++) {
+        hash = (hash ^ img->base[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static void index_path(const char *image_path, char *out, size_t out_size) {
+    snprintf(out, out_size, "%s.idx", image_path);
+}
+
+// Append one entry of directory dir_index under its long name, or its 8.3 name when
+// it has none, and queue it if it is a new subdirectory
+static int add_record(struct IndexBuilder *b, const struct Fat12Image *img, const char *prefix,
+                      const struct DirEntry *entry, const char *long_name, uint32_t dir_index,
+                      uint8_t *visited) {
+    char short_name[13];
+    fat12_entry_name(entry, short_name);
+    const char *name = long_name[0] ? long_name : short_name;
+    size_t path_len = strlen(prefix) + 1 + strlen(name);
+    if (grow((void **)&b->records, &b->record_capacity, b->record_count + 1, sizeof(*b->records)) != 0 ||
+        grow((void **)&b->strings, &b->strings_capacity, b->strings_size + path_len + 1, 1) != 0) {
+        return -1;
+    }
+
+    struct Fat12IndexRecord *record = &b->records[b->record_count];
+    record->entry_offset = (const uint8_t *)entry - img->base;
+    record->path = b->strings_size;
+    sprintf(b->strings + b->strings_size, "%s/%s", prefix, name);
+    record->hash = path_hash(b->strings + b->strings_size);
+    record->next = FAT12_INDEX_NONE;
+    record->first_extent = b->extent_count;
+    record->extent_count = 0;
+    b->strings_size += path_len + 1;
+
+    // Files keep only the clusters their size covers; directories their whole chain
+    int is_dir = (entry->attributes & FAT12_ATTR_DIRECTORY) != 0;
+    uint32_t cluster = fat12_entry_cluster(img, entry);
+    if (fat12_valid_cluster(img, cluster) && (is_dir || entry->file_size > 0)) {
+        uint32_t clusters = is_dir ? img->geo.total_clusters
+                                   : (entry->file_size + img->geo.cluster_size - 1) / img->geo.cluster_size;
+        struct Fat12Extent *extents;
+        size_t count;
+        if (fat12_chain_extents(img, cluster, clusters, &extents, &count) != 0) {
+            return -1;
+        }
+        if (grow((void **)&b->extents, &b->extent_capacity, b->extent_count + count, sizeof(*b->extents)) != 0) {
+            free(extents);
+            return -1;
+        }
+        memcpy(b->extents + b->extent_count, extents, count * sizeof(*extents));
+        b->extent_count += count;
+        record->extent_count = count;
+        free(extents);
+    }
+
+    if (is_dir && fat12_valid_cluster(img, cluster) && !visited[cluster]) {
+        visited[cluster] = 1;
+        if (grow((void **)&b->dirs, &b->dir_capacity, b->dir_count + 1, sizeof(*b->dirs)) != 0) {
+            return -1;
+        }
+        struct Fat12IndexDir *dir = &b->dirs[b->dir_count++];
+        dir->record = b->record_count;
+        dir->parent = dir_index;
+        dir->first_child = 0;
+        dir->child_count = 0;
+    }
+
+    b->record_count++;
+    return 0;
+}
+
+// Walk the tree breadth-first; the directory list doubles as the queue
+static int collect(struct IndexBuilder *b, const struct Fat12Image *img) {
+    uint8_t *visited = calloc(img->geo.total_clusters + 2, 1);
+    if (!visited || grow((void **)&b->dirs, &b->dir_capacity, 1, sizeof(*b->dirs)) != 0) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(visited);
+        return -1;
+    }
+    b->dirs[0].record = FAT12_INDEX_NONE;
+    b->dirs[0].parent = FAT12_INDEX_NONE;
+    b->dir_count = 1;
+    visited[img->geo.root_cluster] = 1;  // Cluster 0 stands for a fixed root region
+
+    int rc = 0;
+    for (size_t d = 0; d < b->dir_count && rc == 0; d++) {
+        uint32_t cluster = 0;
+        char *prefix = strdup("");
+        if (b->dirs[d].record != FAT12_INDEX_NONE) {
+            const struct Fat12IndexRecord *own = &b->records[b->dirs[d].record];
+            cluster = fat12_entry_cluster(img, (const struct DirEntry *)(img->base + own->entry_offset));
+            free(prefix);
+            prefix = strdup(b->strings + own->path);
+        }
+        if (!prefix) {
+            fprintf(stderr, "Memory allocation error\n");
+            rc = -1;
+            break;
+        }
+
+        b->dirs[d].first_child = b->record_count;
+        struct Fat12DirIter it;
+        fat12_dir_open(&it, img, NULL, cluster);
+        const struct DirEntry *entry;
+        char long_name[FAT12_NAME_MAX];
+        while (rc == 0 && (entry = fat12_dir_next_named(&it, long_name)) != NULL) {
+            if (entry->filename[0] == '.') continue;  // "." and ".."
+            rc = add_record(b, img, prefix, entry, long_name, d, visited);
+        }
+        b->dirs[d].child_count = b->record_count - b->dirs[d].first_child;
+        free(prefix);
+    }
+
+    free(visited);
+    return rc;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Lay out the whole index for img in one malloc'd block; returns 0 or -1
+static int serialize(const struct Fat12Image *img, void **out, size_t *out_size) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    struct stat st;
+    if (fstat(img->fd, &st) != 0) {
+        fprintf(stderr, "Error reading image status: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct IndexBuilder b;
+    memset(&b, 0, sizeof(b));
+    if (collect(&b, img) != 0) {
+        free(b.records);
+        free(b.dirs);
+        free(b.extents);
+        free(b.strings);
+        return -1;
+    }
+
+    uint32_t bucket_count = 16;
+    while (bucket_count < 2 * b.record_count) {
+        bucket_count *= 2;
+    }
+    size_t size = sizeof(struct Fat12IndexHeader) + b.record_count * sizeof(*b.records) +
+                  b.dir_count * sizeof(*b.dirs) + bucket_count * sizeof(uint32_t) +
+                  b.extent_count * sizeof(*b.extents) + b.strings_size;
+    uint8_t *blob = malloc(size);
+    if (!blob) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(b.records);
+        free(b.dirs);
+        free(b.extents);
+        free(b.strings);
+        return -1;
+    }
+
+    struct Fat12IndexHeader *header = (struct Fat12IndexHeader *)blob;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, FAT12_INDEX_MAGIC, sizeof(header->magic));
+    header->image_size = st.st_size;
+    header->mtime_sec = st.st_mtim.tv_sec;
+    header->mtime_nsec = st.st_mtim.tv_nsec;
+    header->inode = st.st_ino;
+    header->boot_hash = boot_hash(img);
+    header->record_count = b.record_count;
+    header->dir_count = b.dir_count;
+    header->bucket_count = bucket_count;
+    header->extent_count = b.extent_count;
+    header->strings_size = b.strings_size;
+
+    // Chain each bucket in record order so the first of any duplicate paths wins
+    uint8_t *p = blob + sizeof(*header);
+    struct Fat12IndexRecord *records = (struct Fat12IndexRecord *)p;
+    memcpy(p, b.records, b.record_count * sizeof(*b.records));
+    p += b.record_count * sizeof(*b.records);
+    memcpy(p, b.dirs, b.dir_count * sizeof(*b.dirs));
+    p += b.dir_count * sizeof(*b.dirs);
+    uint32_t *buckets = (uint32_t *)p;
+    memset(buckets, 0xFF, bucket_count * sizeof(uint32_t));
+    for (size_t i = b.record_count; i-- > 0;) {
+        uint32_t bucket = records[i].hash & (bucket_count - 1);
+        records[i].next = buckets[bucket];
+        buckets[bucket] = i;
+    }
+    p += bucket_count * sizeof(uint32_t);
+    memcpy(p, b.extents, b.extent_count * sizeof(*b.extents));
+    p += b.extent_count * sizeof(*b.extents);
+    memcpy(p, b.strings, b.strings_size);
+
+    free(b.records);
+    free(b.dirs);
+    free(b.extents);
+    free(b.strings);
+    *out = blob;
+    *out_size = size;
+    return 0;
+}
+
+// Point the section pointers of index into its block; returns 0 if the sizes add up
+static int locate_sections(struct Fat12Index *index) {
+    const struct Fat12IndexHeader *h = index->base;
+    index->header = h;
+    uint64_t expected = sizeof(*h) + (uint64_t)h->record_count * sizeof(struct Fat12IndexRecord) +
+                        (uint64_t)h->dir_count * sizeof(struct Fat12IndexDir) +
+                        (uint64_t)h->bucket_count * sizeof(uint32_t) +
+                        (uint64_t)h->extent_count * sizeof(struct Fat12Extent) + h->strings_size;
+    if (expected != index->size) {
+        return -1;
+    }
+
+    const uint8_t *p = (const uint8_t *)index->base + sizeof(*h);
+    index->records = (const struct Fat12IndexRecord *)p;
+    p += (size_t)h->record_count * sizeof(struct Fat12IndexRecord);
+    index->dirs = (const struct Fat12IndexDir *)p;
+    p += (size_t)h->dir_count * sizeof(struct Fat12IndexDir);
+    index->buckets = (const uint32_t *)p;
+    p += (size_t)h->bucket_count * sizeof(uint32_t);
+    index->extents = (const struct Fat12Extent *)p;
+    p += (size_t)h->extent_count * sizeof(struct Fat12Extent);
+    index->strings = (const char *)p;
+    return 0;
+}
+
+int fat12_index_build(const struct Fat12Image *img, const char *image_path, uint32_t *records) {
+    void *blob;
+    size_t size;
+    if (serialize(img, &blob, &size) != 0) {
+        return -1;
+    }
+
+    // Write a temporary file and rename it over the old index
+    char path[4096], tmp_path[4200];
+    index_path(image_path, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Error creating %s: %s\n", tmp_path, strerror(errno));
+        free(blob);
+        return -1;
+    }
+    int rc = 0;
+    if (write_all(fd, blob, size) != 0) {
+        fprintf(stderr, "Error writing %s: %s\n", tmp_path, strerror(errno));
+        rc = -1;
+    }
+    if (close(fd) != 0 && rc == 0) {
+        fprintf(stderr, "Error writing %s: %s\n", tmp_path, strerror(errno));
+        rc = -1;
+    }
+    if (rc == 0 && rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error replacing %s: %s\n", path, strerror(errno));
+        rc = -1;
+    }
+    if (rc != 0) {
+        unlink(tmp_path);
+    }
+
+    if (rc == 0 && records) {
+        *records = ((const struct Fat12IndexHeader *)blob)->record_count;
+    }
+    free(blob);
+    return rc;
+}
+
+int fat12_index_build_memory(struct Fat12Index *index, const struct Fat12Image *img) {
+    memset(index, 0, sizeof(*index));
+    if (serialize(img, &index->base, &index->size) != 0) {
+        return -1;
+    }
+    index->owned = 1;
+    locate_sections(index);
+    return 0;
+}
+
+// Check that every offset in a mapped index stays inside the index and the image
+static int index_consistent(const struct Fat12Index *index, const struct Fat12Image *img) {
+    const struct Fat12IndexHeader *h = index->header;
+    if (h->strings_size > 0 && index->strings[h->strings_size - 1] != '\0') {
+        return 0;
+    }
+    for (uint32_t i = 0; i < h->bucket_count; i++) {
+        if (index->buckets[i] != FAT12_INDEX_NONE && index->buckets[i] >= h->record_count) return 0;
+    }
+    for (uint32_t i = 0; i < h->record_count; i++) {
+        const struct Fat12IndexRecord *r = &index->records[i];
+        if ((uint64_t)r->entry_offset + sizeof(struct DirEntry) > img->size) return 0;
+        if (r->path >= h->strings_size) return 0;
+        if (r->next != FAT12_INDEX_NONE && r->next <= i) return 0;  // Chains only move forward
+        if ((uint64_t)r->first_extent + r->extent_count > h->extent_count) return 0;
+    }
+    for (uint32_t i = 0; i < h->dir_count; i++) {
+        const struct Fat12IndexDir *d = &index->dirs[i];
+        if (i > 0 && (d->record >= h->record_count || d->parent >= i)) return 0;
+        if ((uint64_t)d->first_child + d->child_count > h->record_count) return 0;
+    }
+    return h->dir_count > 0 && index->dirs[0].record == FAT12_INDEX_NONE;
+}
+
+int fat12_index_open(struct Fat12Index *index, const struct Fat12Image *img, const char *image_path) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    memset(index, 0, sizeof(*index));
+    char path[4096];
+    index_path(image_path, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st, image_st;
+    if (fstat(fd, &st) != 0 || fstat(img->fd, &image_st) != 0 || (size_t)st.st_size < sizeof(struct Fat12IndexHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    index->base = base;
+    index->size = st.st_size;
+
+    // The index must describe this exact image
+    const struct Fat12IndexHeader *h = base;
+    if (memcmp(h->magic, FAT12_INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+        h->image_size != (uint64_t)image_st.st_size || h->inode != (uint64_t)image_st.st_ino ||
+        h->mtime_sec != image_st.st_mtim.tv_sec || h->mtime_nsec != image_st.st_mtim.tv_nsec ||
+        h->bucket_count == 0 || (h->bucket_count & (h->bucket_count - 1)) != 0) {
+        fat12_index_close(index);
+        return -1;
+    }
+
+    if (locate_sections(index) != 0) {
+        fat12_index_close(index);
+        return -1;
+    }
+    if (h->boot_hash != boot_hash(img) || !index_consistent(index, img)) {
+        fat12_index_close(index);
+        return -1;
+    }
+    return 0;
+}
+
+void fat12_index_close(struct Fat12Index *index) {
+    if (index->owned) {
+        free(index->base);
+    } else if (index->base) {
+        munmap(index->base, index->size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+const struct Fat12IndexRecord *fat12_index_find(const struct Fat12Index *index, const char *path) {
+    // Stored paths are absolute; accept "NAME.EXT" for "/NAME.EXT" like fat12_lookup
+    char absolute[4096];
+    if (path[0] != '/') {
+        snprintf(absolute, sizeof(absolute), "/%s", path);
+        path = absolute;
+    }
+
+    uint32_t hash = path_hash(path);
+    uint32_t i = index->buckets[hash & (index->header->bucket_count - 1)];
+    for (; i != FAT12_INDEX_NONE; i = index->records[i].next) {
+        const struct Fat12IndexRecord *record = &index->records[i];
+        if (record->hash == hash && path_equal(index->strings + record->path, path)) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+const struct DirEntry *fat12_index_entry(const struct Fat12Image *img, const struct Fat12IndexRecord *record) {
+    return (const struct DirEntry *)(img->base + record->entry_offset);
+}
+
+const char *fat12_index_name(const struct Fat12Index *index, const struct Fat12IndexRecord *record) {
+    const char *path = index->strings + record->path;
+    return strrchr(path, '/') + 1;
+}
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fat12.h"
+
+/*
+fat12_journal.c - Write-Ahead Journal for Image Transactions
+
+A transaction keeps the FAT and directory changes of a whole session in memory
+and publishes them atomically. The image is remapped privately, so each staged
+write lands in the session's own view of the image (later lookups and free-slot
+searches see it) while the file itself stays as it was.
+
+Commit order:
+    1. fsync the image: new file data and nothing else has been written to it,
+       all of it in clusters no directory entry or FAT chain points to yet
+    2. write "<image>.wal" (header, records, bytes), fsync it and its directory
+    3. apply the records to the image and fsync it
+    4. remove the journal
+A crash before step 2 completes leaves the image untouched and a journal that
+fails its checksum, which is discarded; after it, the journal is complete and
+replaying it, any number of times, finishes the commit.
+*/
+
+static void journal_path(const char *image_path, char *out, size_t out_size) {
+    snprintf(out, out_size, "%s.wal", image_path);
+}
+
+// FNV-1a 64, continuing from hash
+static uint64_t checksum_update(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Make a new or removed journal's directory entry durable
+static int sync_parent(const char *path) {
+    char dir[4200];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash) {
+        slash[slash == dir ? 1 : 0] = '\0';
+    } else {
+        strcpy(dir, ".");
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return -1;
+    }
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+static int sync_image(struct Fat12Image *img) {
+    if (fsync(img->fd) != 0) {
+        fprintf(stderr, "Error syncing disk image: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Write every record's bytes to its place in the image
+static int apply_records(struct Fat12Image *img, const struct Fat12JournalRecord *records, size_t count,
+                         const uint8_t *payload) {
+    for (size_t i = 0; i < count; i++) {
+        if (fat12_write(img, records[i].offset, payload, records[i].length) != 0) {
+            return -1;
+        }
+        payload += records[i].length;
+    }
+    return sync_image(img);
+}
+
+int fat12_journal_recover(struct Fat12Image *img, const char *image_path) {
+    char path[4200];
+    journal_path(image_path, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Read the whole journal; it only holds metadata
+    struct stat st;
+    uint8_t *data = NULL;
+    int complete = 0;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct Fat12JournalHeader) &&
+        (data = malloc(st.st_size)) != NULL && pread(fd, data, st.st_size, 0) == st.st_size) {
+        const struct Fat12JournalHeader *h = (const struct Fat12JournalHeader *)data;
+        uint64_t body = (uint64_t)st.st_size - sizeof(*h);
+        uint64_t records_size = (uint64_t)h->record_count * sizeof(struct Fat12JournalRecord);
+        complete = memcmp(h->magic, FAT12_JOURNAL_MAGIC, sizeof(h->magic)) == 0 &&
+                   h->image_size == img->size && records_size <= body && h->payload_size == body - records_size &&
+                   checksum_update(CHECKSUM_SEED, data + sizeof(*h), body) == h->checksum;
+
+        // Every record must fit in the payload and in the image
+        const struct Fat12JournalRecord *records = (const struct Fat12JournalRecord *)(data + sizeof(*h));
+        uint64_t total = 0;
+        for (uint32_t i = 0; complete && i < h->record_count; i++) {
+            total += records[i].length;
+            complete = records[i].offset + records[i].length <= img->size && total <= h->payload_size;
+        }
+    }
+    close(fd);
+
+    // A journal that is not complete was never acted on, so the image is intact
+    int rc = 0;
+    if (complete) {
+        const struct Fat12JournalHeader *h = (const struct Fat12JournalHeader *)data;
+        const uint8_t *records = data + sizeof(*h);
+        rc = apply_records(img, (const struct Fat12JournalRecord *)records, h->record_count,
+                           records + (size_t)h->record_count * sizeof(struct Fat12JournalRecord));
+        if (rc == 0) {
+            fprintf(stderr, "Recovered an interrupted write from %s\n", path);
+        }
+    }
+    free(data);
+    if (rc == 0 && (unlink(path) != 0 || sync_parent(path) != 0)) {
+        fprintf(stderr, "Error removing %s: %s\n", path, strerror(errno));
+        rc = -1;
+    }
+    return rc;
+}
+
+int fat12_journal_begin(struct Fat12Journal *journal, struct Fat12Image *img, const char *image_path) {
+    memset(journal, 0, sizeof(*journal));
+
+    // Later reads through the mapping must see staged writes, which stay out of the file
+    void *base = mmap(img->base, img->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, img->fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Error mapping disk image: %s\n", strerror(errno));
+        return -1;
+    }
+
+    journal->img = img;
+    journal_path(image_path, journal->path, sizeof(journal->path));
+    img->journal = journal;
+    return 0;
+}
+
+int fat12_journal_stage(struct Fat12Journal *journal, off_t offset, const void *buf, size_t len) {
+    struct Fat12Image *img = journal->img;
+    if (offset < 0 || (uint64_t)offset + len > img->size || len > UINT32_MAX) {
+        fprintf(stderr, "Error writing to disk image: offset out of range\n");
+        return -1;
+    }
+
+    if (journal->record_count == journal->record_capacity) {
+        size_t capacity = journal->record_capacity ? journal->record_capacity * 2 : 64;
+        struct Fat12JournalRecord *grown = realloc(journal->records, capacity * sizeof(*grown));
+        if (!grown) {
+            fprintf(stderr, "Memory allocation error\n");
+            return -1;
+        }
+        journal->records = grown;
+        journal->record_capacity = capacity;
+    }
+    if (journal->payload_size + len > journal->payload_capacity) {
+        size_t capacity = journal->payload_capacity ? journal->payload_capacity : 4096;
+        while (capacity < journal->payload_size + len) {
+            capacity *= 2;
+        }
+        uint8_t *grown = realloc(journal->payload, capacity);
+        if (!grown) {
+            fprintf(stderr, "Memory allocation error\n");
+            return -1;
+        }
+        journal->payload = grown;
+        journal->payload_capacity = capacity;
+    }
+
+    struct Fat12JournalRecord *record = &journal->records[journal->record_count++];
+    record->offset = offset;
+    record->length = len;
+    record->reserved = 0;
+    memcpy(journal->payload + journal->payload_size, buf, len);
+    journal->payload_size += len;
+    memcpy(img->base + offset, buf, len);
+    return 0;
+}
+
+int fat12_journal_commit(struct Fat12Journal *journal) {
+    struct Fat12Image *img = journal->img;
+    if (journal->record_count == 0) {
+        return 0;
+    }
+
+    // 1. The data the new metadata will point to reaches the disk first
+    if (sync_image(img) != 0) {
+        return -1;
+    }
+
+    // 2. The journal becomes durable, and with it the commit
+    struct Fat12JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FAT12_JOURNAL_MAGIC, sizeof(header.magic));
+    header.image_size = img->size;
+    header.record_count = journal->record_count;
+    header.payload_size = journal->payload_size;
+    header.checksum = checksum_update(CHECKSUM_SEED, journal->records,
+                                      journal->record_count * sizeof(*journal->records));
+    header.checksum = checksum_update(header.checksum, journal->payload, journal->payload_size);
+
+    int fd = open(journal->path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Error creating %s: %s\n", journal->path, strerror(errno));
+        return -1;
+    }
+    int rc = 0;
+    if (write_all(fd, &header, sizeof(header)) != 0 ||
+        write_all(fd, journal->records, journal->record_count * sizeof(*journal->records)) != 0 ||
+        write_all(fd, journal->payload, journal->payload_size) != 0 || fsync(fd) != 0) {
+        fprintf(stderr, "Error writing %s: %s\n", journal->path, strerror(errno));
+        rc = -1;
+    }
+    if (close(fd) != 0 && rc == 0) {
+        fprintf(stderr, "Error writing %s: %s\n", journal->path, strerror(errno));
+        rc = -1;
+    }
+    if (rc == 0 && sync_parent(journal->path) != 0) {
+        fprintf(stderr, "Error syncing %s: %s\n", journal->path, strerror(errno));
+        rc = -1;
+    }
+    if (rc != 0) {
+        unlink(journal->path);
+        return -1;
+    }
+
+    // 3. Apply in place; if this is interrupted the journal finishes it later
+    if (apply_records(img, journal->records, journal->record_count, journal->payload) != 0) {
+        return -1;
+    }
+
+    // 4. Done; a journal that survives a crash here is replayed harmlessly
+    unlink(journal->path);
+    journal->record_count = 0;
+    journal->payload_size = 0;
+    return 0;
+}
+
+void fat12_journal_end(struct Fat12Journal *journal) {
+    if (journal->img) {
+        journal->img->journal = NULL;
+    }
+    free(journal->records);
+    free(journal->payload);
+    memset(journal, 0, sizeof(*journal));
+}
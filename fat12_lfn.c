@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "fat12.h"
+
+/*
+fat12_lfn.c - VFAT Long File Names and Directory Name Tables
+
+A long name is stored in up to 20 entries placed just before the 8.3 entry it
+belongs to, last piece first. Each holds 13 UTF-16 characters, its sequence
+number (0x40 marks the piece that ends the name) and a checksum of the 8.3 name,
+so pieces left behind by a tool that knows nothing of long names are detected
+and ignored. Names are converted to and from UTF-8 at this boundary.
+
+A name table maps every long and 8.3 name of one directory, folded to upper case,
+to the image offset of its entry. It is built in one pass over the directory and
+answers each lookup with one hash probe, however many long-name pieces the
+directory holds. Only ASCII letters are folded.
+*/
+
+#define LFN_MAX_ENTRIES 20
+#define LFN_MAX_UNITS   255
+
+// Characters a long name may not contain, besides control characters
+static const char lfn_forbidden[] = "\"*/:<>?\\|";
+
+// Characters an 8.3 name may contain besides letters and digits
+static const char short_allowed[] = "!#$%&'()-@^_`{}~";
+
+uint8_t fat12_lfn_checksum(const struct DirEntry *entry) {
+    const uint8_t *name = (const uint8_t *)entry->filename;  // Name and extension are adjacent
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+    }
+    return sum;
+}
+
+// Where the 13 characters of a long-name entry live inside it
+static const uint8_t lfn_offsets[FAT12_LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+
+// Decode UTF-8 into UTF-16; returns the unit count or -1 if it is malformed or too long
+static int utf8_to_utf16(const char *in, uint16_t *out, int max_units) {
+    const uint8_t *p = (const uint8_t *)in;
+    int units = 0;
+    while (*p) {
+        uint32_t c;
+        int extra;
+        if (*p < 0x80) {
+            c = *p;
+            extra = 0;
+        } else if ((*p & 0xE0) == 0xC0) {
+            c = *p & 0x1F;
+            extra = 1;
+        } else if ((*p & 0xF0) == 0xE0) {
+            c = *p & 0x0F;
+            extra = 2;
+        } else if ((*p & 0xF8) == 0xF0) {
+            c = *p & 0x07;
+            extra = 3;
+        } else {
+            return -1;
+        }
+        p++;
+        for (int i = 0; i < extra; i++, p++) {
+            if ((*p & 0xC0) != 0x80) {
+                return -1;
+            }
+            c = (c << 6) | (*p & 0x3F);
+        }
+        if ((extra == 1 && c < 0x80) || (extra == 2 && c < 0x800) || (extra == 3 && c < 0x10000) ||
+            c > 0x10FFFF || (c >= 0xD800 && c < 0xE000)) {
+            return -1;  // Overlong forms and surrogates are not characters
+        }
+
+        if (units + (c >= 0x10000 ? 2 : 1) > max_units) {
+            return -1;
+        }
+        if (c >= 0x10000) {
+            c -= 0x10000;
+            out[units++] = 0xD800 | (c >> 10);
+            out[units++] = 0xDC00 | (c & 0x3FF);
+        } else {
+            out[units++] = c;
+        }
+    }
+    return units;
+}
+
+// Encode UTF-16 as UTF-8 into out (out_size bytes, terminator included), stopping
+// at a character that would not fit; unpaired surrogates become '?'
+static void utf16_to_utf8(const uint16_t *in, int units, char *out, size_t out_size) {
+    char *p = out;
+    for (int i = 0; i < units; i++) {
+        uint32_t c = in[i];
+        int pair = c >= 0xD800 && c < 0xDC00 && i + 1 < units && in[i + 1] >= 0xDC00 && in[i + 1] < 0xE000;
+        if (pair) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (in[i + 1] - 0xDC00);
+        } else if (c >= 0xD800 && c < 0xE000) {
+            c = '?';
+        }
+
+        size_t len = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if ((size_t)(p - out) + len >= out_size) {
+            break;
+        }
+        i += pair;
+        if (c < 0x80) {
+            *p++ = c;
+        } else if (c < 0x800) {
+            *p++ = 0xC0 | (c >> 6);
+            *p++ = 0x80 | (c & 0x3F);
+        } else if (c < 0x10000) {
+            *p++ = 0xE0 | (c >> 12);
+            *p++ = 0x80 | ((c >> 6) & 0x3F);
+            *p++ = 0x80 | (c & 0x3F);
+        } else {
+            *p++ = 0xF0 | (c >> 18);
+            *p++ = 0x80 | ((c >> 12) & 0x3F);
+            *p++ = 0x80 | ((c >> 6) & 0x3F);
+            *p++ = 0x80 | (c & 0x3F);
+        }
+    }
+    *p = '\0';
+}
+
+void fat12_lfn_feed(struct Fat12LfnState *lfn, const struct DirEntry *entry) {
+    const uint8_t *raw = (const uint8_t *)entry;
+    uint8_t sequence = raw[0] & ~FAT12_LFN_LAST;
+    uint8_t checksum = raw[13];
+
+    if (raw[0] & FAT12_LFN_LAST) {
+        // The piece holding the end of the name starts a new one
+        if (sequence == 0 || sequence > LFN_MAX_ENTRIES) {
+            lfn->count = 0;
+            return;
+        }
+        lfn->count = sequence;
+        lfn->checksum = checksum;
+        memset(lfn->name, 0, sizeof(lfn->name));
+    } else if (lfn->count == 0 || sequence != lfn->expected || checksum != lfn->checksum) {
+        lfn->count = 0;  // Out of order or from another name: drop what was gathered
+        return;
+    }
+
+    uint16_t *chars = lfn->name + (sequence - 1) * FAT12_LFN_CHARS;
+    for (int i = 0; i < FAT12_LFN_CHARS; i++) {
+        chars[i] = raw[lfn_offsets[i]] | (raw[lfn_offsets[i] + 1] << 8);
+    }
+    lfn->expected = sequence - 1;
+}
+
+int fat12_lfn_take(struct Fat12LfnState *lfn, const struct DirEntry *entry, char *name) {
+    int complete = lfn->count > 0 && lfn->expected == 0 && lfn->checksum == fat12_lfn_checksum(entry);
+    int units = 0;
+    while (complete && units < lfn->count * FAT12_LFN_CHARS && lfn->name[units] != 0) {
+        units++;
+    }
+    lfn->count = 0;
+    if (!complete || units == 0 || units > LFN_MAX_UNITS) {
+        name[0] = '\0';
+        return 0;
+    }
+    utf16_to_utf8(lfn->name, units, name, FAT12_NAME_MAX);
+
+    // A name that would read as a path cannot be used; the 8.3 name stands in
+    if (strchr(name, '/') || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        name[0] = '\0';
+        return 0;
+    }
+    return 1;
+}
+
+const struct DirEntry *fat12_dir_next_named(struct Fat12DirIter *it, char *name) {
+    const struct DirEntry *entry;
+    while ((entry = fat12_dir_next(it)) != NULL) {
+        if (entry->attributes == FAT12_ATTR_LFN) {
+            fat12_lfn_feed(&it->lfn, entry);
+        } else if (entry->attributes & FAT12_ATTR_VOLUME_ID) {
+            it->lfn.count = 0;
+        } else {
+            fat12_lfn_take(&it->lfn, entry, name);
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Character as it may appear in an 8.3 name, or 0 if it cannot
+static char short_char(unsigned char c) {
+    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c && strchr(short_allowed, c))) {
+        return c;
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 'A';
+    }
+    return 0;
+}
+
+int fat12_short_name(const char *name, struct DirEntry *entry) {
+    // Lower-case letters need a long name to survive, so only upper case is exact
+    memset(entry->filename, ' ', sizeof(entry->filename));
+    memset(entry->extension, ' ', sizeof(entry->extension));
+
+    // Leading dots and every space are dropped; the last dot starts the extension
+    const char *start = name;
+    while (*start == '.') start++;
+    const char *dot = strrchr(start, '.');
+    const char *base_end = dot ? dot : start + strlen(start);
+    int exact = start == name && base_end > start && base_end - start <= 8 && (!dot || strlen(dot + 1) <= 3);
+
+    int len = 0;
+    for (const char *p = start; p < base_end; p++) {
+        char c = short_char(*p);
+        exact &= c != 0 && c == *p;
+        if (*p == ' ' || *p == '.' || (*p & 0xC0) == 0x80) continue;  // One '_' per UTF-8 character
+        if (len < 8) {
+            entry->filename[len++] = c ? c : '_';
+        }
+    }
+    if (len == 0) {
+        entry->filename[0] = '_';
+    }
+    len = 0;
+    for (const char *p = dot ? dot + 1 : ""; *p; p++) {
+        char c = short_char(*p);
+        exact &= c != 0 && c == *p;
+        if (*p == ' ' || (*p & 0xC0) == 0x80) continue;
+        if (len < 3) {
+            entry->extension[len++] = c ? c : '_';
+        }
+    }
+    if (dot && dot[1] == '\0') {
+        exact = 0;  // "NAME." has no 8.3 spelling
+    }
+
+    // 0xE5 in the first byte would read as a deleted entry
+    if ((uint8_t)entry->filename[0] == FAT12_ENTRY_DELETED) {
+        entry->filename[0] = 0x05;
+    }
+    return exact;
+}
+
+void fat12_short_alias(struct DirEntry *entry, uint32_t n) {
+    char tail[12];
+    int tail_len = snprintf(tail, sizeof(tail), "~%u", n);
+    int len = 0;
+    while (len < 8 && entry->filename[len] != ' ') {
+        len++;
+    }
+    int keep = len < 8 - tail_len ? len : 8 - tail_len;
+    memcpy(entry->filename + keep, tail, tail_len);
+}
+
+int fat12_lfn_entries(const char *name) {
+    uint16_t units[LFN_MAX_UNITS];
+    int count = utf8_to_utf16(name, units, LFN_MAX_UNITS);
+    if (count <= 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return -1;
+    }
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        if (*p < 0x20 || strchr(lfn_forbidden, *p)) {
+            return -1;
+        }
+    }
+
+    struct DirEntry probe;
+    if (fat12_short_name(name, &probe)) {
+        return 0;
+    }
+    return (count + FAT12_LFN_CHARS - 1) / FAT12_LFN_CHARS;
+}
+
+int fat12_lfn_encode(const char *name, const struct DirEntry *entry, struct DirEntry *out) {
+    int pieces = fat12_lfn_entries(name);
+    if (pieces <= 0) {
+        return pieces;
+    }
+    uint16_t units[LFN_MAX_UNITS];
+    int count = utf8_to_utf16(name, units, LFN_MAX_UNITS);
+    uint8_t checksum = fat12_lfn_checksum(entry);
+
+    // The piece holding the end of the name comes first on disk
+    for (int piece = 0; piece < pieces; piece++) {
+        uint8_t *raw = (uint8_t *)&out[pieces - 1 - piece];
+        memset(raw, 0, sizeof(struct DirEntry));
+        raw[0] = (piece + 1) | (piece == pieces - 1 ? FAT12_LFN_LAST : 0);
+        raw[11] = FAT12_ATTR_LFN;
+        raw[13] = checksum;
+        for (int i = 0; i < FAT12_LFN_CHARS; i++) {
+            int at = piece * FAT12_LFN_CHARS + i;
+            uint16_t c = at < count ? units[at] : at == count ? 0x0000 : 0xFFFF;  // Terminator, then padding
+            raw[lfn_offsets[i]] = c & 0xFF;
+            raw[lfn_offsets[i] + 1] = c >> 8;
+        }
+    }
+    return pieces;
+}
+
+// FNV-1a over a name with ASCII letters folded to upper case
+static uint32_t name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        uint8_t c = (*p >= 'a' && *p <= 'z') ? *p - 'a' + 'A' : *p;
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+// Double the slot array and reinsert every name
+static int names_grow(struct Fat12NameTable *t) {
+    uint32_t size = t->mask ? (t->mask + 1) * 2 : 64;
+    struct Fat12NameSlot *slots = calloc(size, sizeof(*slots));
+    if (!slots) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    for (uint32_t i = 0; t->slots && i <= t->mask; i++) {
+        if (t->slots[i].offset == 0) continue;
+        uint32_t at = t->slots[i].hash & (size - 1);
+        while (slots[at].offset != 0) {
+            at = (at + 1) & (size - 1);
+        }
+        slots[at] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->mask = size - 1;
+    return 0;
+}
+
+int fat12_names_add(struct Fat12NameTable *t, const char *name, uint64_t offset) {
+    if ((t->count + 1) * 2 > (t->mask ? t->mask + 1 : 0) && names_grow(t) != 0) {
+        return -1;
+    }
+    size_t len = strlen(name) + 1;
+    if (t->names_size + len > t->names_capacity) {
+        size_t capacity = t->names_capacity ? t->names_capacity : 1024;
+        while (capacity < t->names_size + len) {
+            capacity *= 2;
+        }
+        char *grown = realloc(t->names, capacity);
+        if (!grown) {
+            fprintf(stderr, "Memory allocation error\n");
+            return -1;
+        }
+        t->names = grown;
+        t->names_capacity = capacity;
+    }
+
+    // Later duplicates sit further along the probe sequence, so the first one wins
+    uint32_t hash = name_hash(name);
+    uint32_t at = hash & t->mask;
+    while (t->slots[at].offset != 0) {
+        at = (at + 1) & t->mask;
+    }
+    t->slots[at].offset = offset;
+    t->slots[at].hash = hash;
+    t->slots[at].name = t->names_size;
+    memcpy(t->names + t->names_size, name, len);
+    t->names_size += len;
+    t->count++;
+    return 0;
+}
+
+uint64_t fat12_names_find(const struct Fat12NameTable *t, const char *name) {
+    if (t->count == 0) {
+        return 0;
+    }
+    uint32_t hash = name_hash(name);
+    for (uint32_t at = hash & t->mask; t->slots[at].offset != 0; at = (at + 1) & t->mask) {
+        if (t->slots[at].hash == hash && strcasecmp(t->names + t->slots[at].name, name) == 0) {
+            return t->slots[at].offset;
+        }
+    }
+    return 0;
+}
+
+int fat12_names_build(struct Fat12NameTable *t, const struct Fat12Image *img, const struct Fat12FatCache *fat,
+                      uint32_t cluster) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    memset(t, 0, sizeof(*t));
+    struct Fat12DirIter it;
+    fat12_dir_open(&it, img, fat, cluster);
+    if (it.error) {
+        fprintf(stderr, "Error reading directory: cluster %u out of range\n", cluster);
+        return -1;
+    }
+
+    char long_name[FAT12_NAME_MAX];
+    const struct DirEntry *entry;
+    while ((entry = fat12_dir_next_named(&it, long_name)) != NULL) {
+        if (entry->filename[0] == '.') continue;  // "." and ".."
+        char short_name[13];
+        fat12_entry_name(entry, short_name);
+        uint64_t offset = (const uint8_t *)entry - img->base;
+        if ((long_name[0] && fat12_names_add(t, long_name, offset) != 0) ||
+            fat12_names_add(t, short_name, offset) != 0) {
+            fat12_names_free(t);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void fat12_names_free(struct Fat12NameTable *t) {
+    free(t->slots);
+    free(t->names);
+    memset(t, 0, sizeof(*t));
+}
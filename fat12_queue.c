@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fat12.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define FAT12_URING 1
+#endif
+
+/*
+fat12_queue.c - Queued Extent Copies
+
+Moves file data between the image and host files for diskget and diskput when
+--queue-depth is given. Each copy is cut into chunks of FAT12_QUEUE_CHUNK bytes,
+and every chunk gets one of depth buffers. With io_uring a chunk is queued as a
+read into its buffer linked to a write out of it, so up to depth reads and writes
+are in flight at once and host-file I/O overlaps image I/O. The ring is driven
+with raw system calls; nothing beyond the kernel headers is needed.
+
+Where the kernel has no io_uring or refuses a ring, copies are done at once with
+pread and pwrite instead. A queued chunk that comes back short or failed (a short
+read cancels its linked write) is redone the same way, which also produces the
+diagnostic if the error is real.
+*/
+
+uint32_t fat12_queue_depth;
+
+// Copy with pread and pwrite through buf; returns 0 or -1 with a diagnostic
+static int copy_sync(uint8_t *buf, int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t len) {
+    while (len > 0) {
+        size_t chunk = len < FAT12_QUEUE_CHUNK ? len : FAT12_QUEUE_CHUNK;
+        ssize_t n = pread(in_fd, buf, chunk, in_offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Error reading file data: %s\n", n < 0 ? strerror(errno) : "unexpected end of file");
+            return -1;
+        }
+        for (ssize_t done = 0; done < n;) {
+            ssize_t written = pwrite(out_fd, buf + done, n - done, out_offset + done);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0) {
+                fprintf(stderr, "Error writing file data: %s\n", strerror(errno));
+                return -1;
+            }
+            done += written;
+        }
+        in_offset += n;
+        out_offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+#ifdef FAT12_URING
+
+// The mapped submission and completion rings
+struct Fat12Ring {
+    int fd;
+    uint32_t unsubmitted;       // Entries queued since the last io_uring_enter
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static void ring_free(struct Fat12Ring *r) {
+    if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_size);
+    if (r->cq_map && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_size);
+    if (r->sq_map && r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_map_size);
+    close(r->fd);
+    free(r);
+}
+
+// Set up a ring with room for entries submissions, or return NULL (silently) when
+// io_uring is unavailable
+static struct Fat12Ring *ring_setup(uint32_t entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct Fat12Ring *r = calloc(1, sizeof(*r));
+    if (!r) {
+        close(fd);
+        return NULL;
+    }
+    r->fd = fd;
+
+    // Kernels with IORING_FEAT_SINGLE_MMAP map both rings together
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cq_map_size > r->sq_map_size) {
+        r->sq_map_size = r->cq_map_size;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                     IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        ring_free(r);
+        return NULL;
+    }
+    r->cq_map = single ? r->sq_map
+                       : mmap(NULL, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                              IORING_OFF_CQ_RING);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+        ring_free(r);
+        return NULL;
+    }
+
+    uint8_t *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+    r->sq_mask = (uint32_t *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (uint32_t *)(sq + p.sq_off.array);
+    r->cq_head = (uint32_t *)(cq + p.cq_off.head);
+    r->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+    r->cq_mask = (uint32_t *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return r;
+}
+
+static void ring_push(struct Fat12Ring *r, uint8_t opcode, uint8_t flags, int fd, void *buf, uint32_t len,
+                      off_t offset, uint64_t user_data) {
+    uint32_t tail = *r->sq_tail;
+    uint32_t index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->flags = flags;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->unsubmitted++;
+}
+
+// Submit what is queued and wait for at least wait completions; returns 0 or -1
+static int ring_enter(struct Fat12Ring *r, uint32_t wait) {
+    for (;;) {
+        int n = syscall(__NR_io_uring_enter, r->fd, r->unsubmitted, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                        NULL, 0);
+        if (n >= 0) {
+            r->unsubmitted -= n;
+            return 0;
+        }
+        if (errno != EINTR) {
+            fprintf(stderr, "Error submitting I/O: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+// Finish a chunk once both of its halves are back, redoing it if either fell short
+static void chunk_done(struct Fat12Queue *q, uint32_t i) {
+    struct Fat12QueueSlot *slot = &q->slots[i];
+    if (slot->redo && copy_sync(q->buffers + (size_t)i * FAT12_QUEUE_CHUNK, slot->in_fd, slot->in_offset,
+                                slot->out_fd, slot->out_offset, slot->len) != 0) {
+        q->failed = 1;
+    }
+    q->free_slots[q->free_count++] = i;
+}
+
+// Take every completion the kernel has posted
+static void ring_reap(struct Fat12Queue *q) {
+    struct Fat12Ring *r = q->ring;
+    uint32_t head = *r->cq_head;
+    uint32_t tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        uint32_t i = cqe->user_data >> 1;
+        struct Fat12QueueSlot *slot = &q->slots[i];
+        if (cqe->res < 0 || (size_t)cqe->res != slot->len) {
+            slot->redo = 1;
+        }
+        if (--slot->pending == 0) {
+            chunk_done(q, i);
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Wait until at least one chunk buffer is free; returns 0 or -1
+static int ring_wait_slot(struct Fat12Queue *q) {
+    while (q->free_count == 0) {
+        if (ring_enter(q->ring, 1) != 0) {
+            return -1;
+        }
+        ring_reap(q);
+    }
+    return 0;
+}
+
+#endif
+
+int fat12_queue_option(int *argc, char *argv[]) {
+    int kept = 0, rc = 0;
+    for (int i = 0; i < *argc; i++) {
+        if (i > 0 && strncmp(argv[i], "--queue-depth=", 14) == 0) {
+            char *end;
+            unsigned long depth = strtoul(argv[i] + 14, &end, 10);
+            if (*end != '\0' || depth < 1 || depth > FAT12_QUEUE_MAX_DEPTH) {
+                fprintf(stderr, "Invalid queue depth: %s (1 to %d)\n", argv[i] + 14, FAT12_QUEUE_MAX_DEPTH);
+                rc = -1;
+            }
+            fat12_queue_depth = depth;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+    return rc;
+}
+
+int fat12_queue_open(struct Fat12Queue *q, uint32_t depth) {
+    memset(q, 0, sizeof(*q));
+    q->depth = depth;
+#ifdef FAT12_URING
+    // One read and one write per chunk in flight
+    q->ring = ring_setup(2 * depth);
+#endif
+    uint32_t buffers = q->ring ? depth : 1;
+    q->buffers = malloc((size_t)buffers * FAT12_QUEUE_CHUNK);
+    q->slots = calloc(buffers, sizeof(*q->slots));
+    q->free_slots = malloc(buffers * sizeof(*q->free_slots));
+    if (!q->buffers || !q->slots || !q->free_slots) {
+        fprintf(stderr, "Memory allocation error: %s\n", strerror(errno));
+        fat12_queue_close(q);
+        return -1;
+    }
+    for (uint32_t i = 0; i < buffers; i++) {
+        q->free_slots[q->free_count++] = buffers - 1 - i;
+    }
+    return 0;
+}
+
+int fat12_queue_copy(struct Fat12Queue *q, int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t len) {
+#ifdef FAT12_URING
+    if (q->ring) {
+        while (len > 0) {
+            size_t chunk = len < FAT12_QUEUE_CHUNK ? len : FAT12_QUEUE_CHUNK;
+            if (ring_wait_slot(q) != 0) {
+                return -1;
+            }
+            uint32_t i = q->free_slots[--q->free_count];
+            struct Fat12QueueSlot *slot = &q->slots[i];
+            slot->in_fd = in_fd;
+            slot->in_offset = in_offset;
+            slot->out_fd = out_fd;
+            slot->out_offset = out_offset;
+            slot->len = chunk;
+            slot->pending = 2;
+            slot->redo = 0;
+
+            // The write only starts once the read has filled the buffer completely
+            uint8_t *buf = q->buffers + (size_t)i * FAT12_QUEUE_CHUNK;
+            ring_push(q->ring, IORING_OP_READ, IOSQE_IO_LINK, in_fd, buf, chunk, in_offset, (uint64_t)i << 1);
+            ring_push(q->ring, IORING_OP_WRITE, 0, out_fd, buf, chunk, out_offset, ((uint64_t)i << 1) | 1);
+
+            in_offset += chunk;
+            out_offset += chunk;
+            len -= chunk;
+        }
+        if (ring_enter(q->ring, 0) != 0) {
+            return -1;
+        }
+        ring_reap(q);
+        return q->failed ? -1 : 0;
+    }
+#endif
+    return copy_sync(q->buffers, in_fd, in_offset, out_fd, out_offset, len);
+}
+
+int fat12_queue_drain(struct Fat12Queue *q) {
+    int rc = 0;
+#ifdef FAT12_URING
+    while (q->ring && q->free_count < q->depth) {
+        if (ring_enter(q->ring, 1) != 0) {
+            rc = -1;
+            break;
+        }
+        ring_reap(q);
+    }
+#endif
+    if (q->failed) {
+        rc = -1;
+    }
+    q->failed = 0;
+    return rc;
+}
+
+void fat12_queue_close(struct Fat12Queue *q) {
+#ifdef FAT12_URING
+    if (q->ring) {
+        fat12_queue_drain(q);
+        ring_free(q->ring);
+    }
+#endif
+    free(q->buffers);
+    free(q->slots);
+    free(q->free_slots);
+    memset(q, 0, sizeof(*q));
+}
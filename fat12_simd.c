@@ -0,0 +1,240 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "fat12.h"
+
+/*
+fat12_simd.c - Bulk FAT12 Decode and Free-Cluster Counting
+
+A FAT12 table packs two 12-bit entries into every 3 bytes. Read as a stream of
+nibbles (low nibble first), entry k is simply nibbles 3k..3k+2, so entry k of a
+pair is zero exactly when:
+    even entry: byte 0 is zero and the low nibble of byte 1 is zero
+    odd entry:  the high nibble of byte 1 is zero and byte 2 is zero
+The counting kernels compute "byte zero", "low nibble zero" and "high nibble zero"
+bitmasks for 48 bytes (32 entries) at a time with byte compares and movemask, and
+combine them with shifts and two fixed masks selecting the first and second byte
+of every 3-byte group. Decoding uses a byte shuffle to gather each entry's two
+bytes into a 16-bit lane, then masks even lanes and shifts odd lanes; entries
+from 0xFF7 up are widened to the FAT32 values (see fat12_codec.c) by a compare
+that supplies their upper bits as the lanes are interleaved out to 32 bits.
+
+SSE2, SSSE3 and AVX2 variants are selected at run time; other targets use the
+scalar pairwise code, which is also used for the unaligned head and the tail.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FAT12_X86 1
+#endif
+
+// Bit 3k (and 3k+1) for k = 0..15: the first (second) byte of each 3-byte group
+#define GROUP_FIRST_BYTES  0x249249249249ULL
+#define GROUP_SECOND_BYTES (GROUP_FIRST_BYTES << 1)
+
+// Widen bad-cluster and end-of-chain values to their FAT32 forms
+static inline uint32_t widen(uint32_t value) {
+    return value >= 0xFF7 ? value | 0x0FFFF000 : value;
+}
+
+// One entry, for the odd head and the tail of a range
+static inline uint32_t entry12(const uint8_t *fat, uint32_t cluster) {
+    const uint8_t *p = fat + cluster + cluster / 2;
+    uint32_t pair = p[0] | (p[1] << 8);
+    return widen((cluster & 1) ? pair >> 4 : pair & 0x0FFF);
+}
+
+// Decode the pair of entries stored in one 3-byte group
+static inline void decode_pair(const uint8_t *p, uint32_t *out) {
+    uint32_t v = p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16);
+    out[0] = widen(v & 0x0FFF);
+    out[1] = widen(v >> 12);
+}
+
+static inline uint32_t count_pair(const uint8_t *p) {
+    return (p[0] == 0 && (p[1] & 0x0F) == 0) + ((p[1] & 0xF0) == 0 && p[2] == 0);
+}
+
+// Count zero entries given the three 48-bit masks of one 32-entry block
+static inline uint32_t count_block_masks(uint64_t zero, uint64_t low_zero, uint64_t high_zero) {
+    uint64_t even = zero & (low_zero >> 1) & GROUP_FIRST_BYTES;
+    uint64_t odd = high_zero & (zero >> 1) & GROUP_SECOND_BYTES;
+    return __builtin_popcountll(even) + __builtin_popcountll(odd);
+}
+
+#ifdef FAT12_X86
+
+__attribute__((target("sse2")))
+static uint32_t count_free_sse2(const uint8_t *p, uint32_t blocks) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_set1_epi8(0x0F);
+    const __m128i high = _mm_set1_epi8((char)0xF0);
+    uint32_t total = 0;
+
+    for (uint32_t b = 0; b < blocks; b++, p += 48) {
+        uint64_t z = 0, l = 0, h = 0;
+        for (int j = 0; j < 3; j++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * j));
+            z |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) << (16 * j);
+            l |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, low), zero)) << (16 * j);
+            h |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, high), zero)) << (16 * j);
+        }
+        total += count_block_masks(z, l, h);
+    }
+    return total;
+}
+
+// Processes two 32-entry blocks (96 bytes) per iteration
+__attribute__((target("avx2,popcnt")))
+static uint32_t count_free_avx2(const uint8_t *p, uint32_t blocks) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    const __m256i high = _mm256_set1_epi8((char)0xF0);
+    uint32_t total = 0;
+    uint32_t b = 0;
+
+    for (; b + 2 <= blocks; b += 2, p += 96) {
+        uint32_t z[3], l[3], h[3];
+        for (int j = 0; j < 3; j++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * j));
+            z[j] = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+            l[j] = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, low), zero));
+            h[j] = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, high), zero));
+        }
+        // Split the 96 mask bits back into two 48-bit blocks
+        total += count_block_masks(z[0] | (uint64_t)(z[1] & 0xFFFF) << 32,
+                                   l[0] | (uint64_t)(l[1] & 0xFFFF) << 32,
+                                   h[0] | (uint64_t)(h[1] & 0xFFFF) << 32);
+        total += count_block_masks((z[1] >> 16) | (uint64_t)z[2] << 16,
+                                   (l[1] >> 16) | (uint64_t)l[2] << 16,
+                                   (h[1] >> 16) | (uint64_t)h[2] << 16);
+    }
+    if (b < blocks) {
+        total += count_free_sse2(p, blocks - b);
+    }
+    return total;
+}
+
+// Gather bytes (3i, 3i+1) and (3i+1, 3i+2) of each group into consecutive 16-bit lanes
+#define DECODE_SHUFFLE 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11
+
+// Decodes 8 entries from 12 bytes per iteration; reads 16 bytes at a time
+__attribute__((target("ssse3")))
+static void decode_ssse3(const uint8_t *p, uint32_t steps, uint32_t *out) {
+    const __m128i shuffle = _mm_setr_epi8(DECODE_SHUFFLE);
+    const __m128i even_mask = _mm_set1_epi32(0x00000FFF);
+    const __m128i odd_mask = _mm_set1_epi32(0x0FFF0000);
+    const __m128i reserved = _mm_set1_epi16(0xFF6);
+    const __m128i low_fill = _mm_set1_epi16((short)0xF000);
+    const __m128i high_fill = _mm_set1_epi16(0x0FFF);
+
+    for (uint32_t s = 0; s < steps; s++, p += 12, out += 8) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), shuffle);
+        __m128i entries = _mm_or_si128(_mm_and_si128(v, even_mask), _mm_and_si128(_mm_srli_epi16(v, 4), odd_mask));
+        // Lanes at 0xFF7 and up get 0xF000 below and 0x0FFF above when widened
+        __m128i wide = _mm_cmpgt_epi16(entries, reserved);
+        __m128i low = _mm_or_si128(entries, _mm_and_si128(wide, low_fill));
+        __m128i high = _mm_and_si128(wide, high_fill);
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(low, high));
+        _mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi16(low, high));
+    }
+}
+
+// Decodes 16 entries from 24 bytes per iteration, 12 bytes in each 128-bit lane
+__attribute__((target("avx2")))
+static void decode_avx2(const uint8_t *p, uint32_t steps, uint32_t *out) {
+    const __m256i shuffle = _mm256_setr_epi8(DECODE_SHUFFLE, DECODE_SHUFFLE);
+    const __m256i even_mask = _mm256_set1_epi32(0x00000FFF);
+    const __m256i odd_mask = _mm256_set1_epi32(0x0FFF0000);
+    const __m256i reserved = _mm256_set1_epi16(0xFF6);
+    const __m256i low_fill = _mm256_set1_epi16((short)0xF000);
+    const __m256i high_fill = _mm256_set1_epi16(0x0FFF);
+
+    for (uint32_t s = 0; s < steps; s++, p += 24, out += 16) {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+                                            _mm_loadu_si128((const __m128i *)(p + 12)), 1);
+        v = _mm256_shuffle_epi8(v, shuffle);
+        __m256i entries = _mm256_or_si256(_mm256_and_si256(v, even_mask),
+                                          _mm256_and_si256(_mm256_srli_epi16(v, 4), odd_mask));
+        __m256i wide = _mm256_cmpgt_epi16(entries, reserved);
+        __m256i low = _mm256_or_si256(entries, _mm256_and_si256(wide, low_fill));
+        __m256i high = _mm256_and_si256(wide, high_fill);
+
+        // Unpacking works within 128-bit lanes; put the four quarters back in order
+        __m256i first = _mm256_unpacklo_epi16(low, high);
+        __m256i second = _mm256_unpackhi_epi16(low, high);
+        _mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 8), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+}
+
+#endif
+
+uint32_t fat12_count_free12(const uint8_t *fat, uint32_t first, uint32_t count) {
+    uint32_t total = 0;
+    uint32_t cluster = first;
+    uint32_t end = first + count;
+
+    // Align to the start of a 3-byte group
+    if ((cluster & 1) && cluster < end) {
+        total += entry12(fat, cluster) == 0;
+        cluster++;
+    }
+
+    const uint8_t *p = fat + cluster + cluster / 2;
+    uint32_t blocks = (end - cluster) / 32;
+#ifdef FAT12_X86
+    if (blocks > 0) {
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+            total += count_free_avx2(p, blocks);
+        } else {
+            total += count_free_sse2(p, blocks);
+        }
+        cluster += blocks * 32;
+        p += blocks * 48;
+    }
+#endif
+
+    for (; cluster + 2 <= end; cluster += 2, p += 3) {
+        total += count_pair(p);
+    }
+    if (cluster < end) {
+        total += entry12(fat, cluster) == 0;
+    }
+    return total;
+}
+
+void fat12_decode12(const uint8_t *fat, uint32_t first, uint32_t count, uint32_t *out) {
+    uint32_t cluster = first;
+    uint32_t end = first + count;
+
+    if ((cluster & 1) && cluster < end) {
+        *out++ = entry12(fat, cluster);
+        cluster++;
+    }
+
+    const uint8_t *p = fat + cluster + cluster / 2;
+#ifdef FAT12_X86
+    // Vector loads read 4 bytes past the groups they decode, so leave a scalar tail
+    if (__builtin_cpu_supports("avx2")) {
+        uint32_t steps = end - cluster >= 24 ? (end - cluster - 8) / 16 : 0;
+        decode_avx2(p, steps, out);
+        cluster += steps * 16;
+        p += steps * 24;
+        out += steps * 16;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        uint32_t steps = end - cluster >= 16 ? (end - cluster - 8) / 8 : 0;
+        decode_ssse3(p, steps, out);
+        cluster += steps * 8;
+        p += steps * 12;
+        out += steps * 8;
+    }
+#endif
+
+    for (; cluster + 2 <= end; cluster += 2, p += 3, out += 2) {
+        decode_pair(p, out);
+    }
+    if (cluster < end) {
+        *out = entry12(fat, cluster);
+    }
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fat12_stats.h"
+
+/*
+fat12_stats.c - Image I/O Instrumentation
+
+Implements the counters declared in fat12_stats.h. Totals are shared by all
+threads and updated with relaxed atomic adds; the current phase, when it was
+entered and where the last access ended are kept per thread. Times are summed
+over threads, so with several workers they can exceed the elapsed time.
+*/
+
+#ifndef FAT12_NO_STATS
+
+int fat12_stats_enabled;
+
+struct PhaseTotals {
+    uint64_t nanoseconds;
+    uint64_t reads;
+    uint64_t read_bytes;
+    uint64_t writes;
+    uint64_t write_bytes;
+    uint64_t seeks;
+};
+
+static struct PhaseTotals totals[FAT12_PHASE_COUNT];
+static uint64_t fat_lookups;
+static uint64_t started;
+
+static __thread int current_phase;
+static __thread uint64_t phase_started;
+static __thread uint64_t last_end;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add(uint64_t *counter, uint64_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+// Charge the time since the last switch to the current phase and make phase current
+static int switch_phase(int phase) {
+    uint64_t now = now_ns();
+    int previous = current_phase;
+    if (phase_started) {
+        add(&totals[previous].nanoseconds, now - phase_started);
+    }
+    current_phase = phase;
+    phase_started = now;
+    return previous;
+}
+
+struct Fat12PhaseScope fat12_stats_enter(enum Fat12Phase phase) {
+    struct Fat12PhaseScope scope = { 0, fat12_stats_enabled };
+    if (scope.active) {
+        scope.previous = switch_phase(phase);
+    }
+    return scope;
+}
+
+void fat12_stats_leave(struct Fat12PhaseScope *scope) {
+    if (scope->active) {
+        switch_phase(scope->previous);
+    }
+}
+
+void fat12_stats_io(int write, uint64_t offset, uint64_t len) {
+    struct PhaseTotals *t = &totals[current_phase];
+    add(write ? &t->writes : &t->reads, 1);
+    add(write ? &t->write_bytes : &t->read_bytes, len);
+    if (offset != last_end) {
+        add(&t->seeks, 1);
+    }
+    last_end = offset + len;
+}
+
+void fat12_stats_fat_lookup(void) {
+    add(&fat_lookups, 1);
+}
+
+static void print_stats(void) {
+    // Close the main thread's open interval so its time is counted
+    switch_phase(current_phase);
+    fflush(stdout);
+
+    static const char *names[FAT12_PHASE_COUNT] = {
+        "other", "boot sector", "FAT", "directory walk", "data copy"
+    };
+    static const int order[FAT12_PHASE_COUNT] = {
+        FAT12_PHASE_BOOT, FAT12_PHASE_FAT, FAT12_PHASE_DIR, FAT12_PHASE_DATA, FAT12_PHASE_OTHER
+    };
+
+    fprintf(stderr, "\n%-15s %10s %8s %12s %8s %13s %8s\n", "Phase", "Time (ms)", "Reads", "Bytes read",
+            "Writes", "Bytes written", "Seeks");
+    struct PhaseTotals sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int i = 0; i < FAT12_PHASE_COUNT; i++) {
+        const struct PhaseTotals *t = &totals[order[i]];
+        fprintf(stderr, "%-15s %10.3f %8llu %12llu %8llu %13llu %8llu\n", names[order[i]], t->nanoseconds / 1e6,
+                (unsigned long long)t->reads, (unsigned long long)t->read_bytes, (unsigned long long)t->writes,
+                (unsigned long long)t->write_bytes, (unsigned long long)t->seeks);
+        sum.reads += t->reads;
+        sum.read_bytes += t->read_bytes;
+        sum.writes += t->writes;
+        sum.write_bytes += t->write_bytes;
+        sum.seeks += t->seeks;
+    }
+    fprintf(stderr, "%-15s %10.3f %8llu %12llu %8llu %13llu %8llu\n", "total (elapsed)",
+            (now_ns() - started) / 1e6, (unsigned long long)sum.reads, (unsigned long long)sum.read_bytes,
+            (unsigned long long)sum.writes, (unsigned long long)sum.write_bytes, (unsigned long long)sum.seeks);
+    fprintf(stderr, "FAT lookups: %llu\n", (unsigned long long)fat_lookups);
+}
+
+#else
+
+static void print_stats(void) {
+    fflush(stdout);
+    fprintf(stderr, "Statistics are not available: built with FAT12_NO_STATS\n");
+}
+
+#endif
+
+void fat12_stats_option(int *argc, char *argv[]) {
+    int found = 0, kept = 0;
+    for (int i = 0; i < *argc; i++) {
+        if (i > 0 && strcmp(argv[i], "--stats") == 0) {
+            found = 1;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+    if (!found) {
+        return;
+    }
+
+#ifndef FAT12_NO_STATS
+    fat12_stats_enabled = 1;
+    started = now_ns();
+    switch_phase(FAT12_PHASE_OTHER);
+#endif
+    atexit(print_stats);
+}
@@ -0,0 +1,68 @@
+#ifndef FAT12_STATS_H
+#define FAT12_STATS_H
+
+#include <stdint.h>
+
+/*
+fat12_stats.h - Image I/O Instrumentation
+
+Counters and timers on the library's image accesses, printed by every tool when
+given --stats. Work is split into phases: reading the boot sector, loading and
+writing the FAT, walking directories and copying file data. A phase is entered
+for the rest of a block with FAT12_PHASE; nested phases pause the outer one, so
+each phase's time excludes the others. Every read or write of image bytes,
+whether through the mapping or a system call, is counted with its size under the
+current phase, and counted as a seek when it does not start where the previous
+access of the same thread ended. FAT entry decodes are counted separately.
+
+Counting costs one predictable branch while --stats is off. Building with
+-DFAT12_NO_STATS (make STATS=0) removes the instrumentation altogether.
+*/
+
+enum Fat12Phase {
+    FAT12_PHASE_OTHER,          // Outside any phase
+    FAT12_PHASE_BOOT,           // Opening the image and parsing the boot sector
+    FAT12_PHASE_FAT,            // Loading, scanning and writing the FAT
+    FAT12_PHASE_DIR,            // Walking and updating directories and indexes
+    FAT12_PHASE_DATA,           // Copying file data in or out
+    FAT12_PHASE_COUNT
+};
+
+// Take every "--stats" out of argv and turn the statistics on if there was one;
+// they are then printed to stderr when the program exits
+void fat12_stats_option(int *argc, char *argv[]);
+
+#ifndef FAT12_NO_STATS
+
+extern int fat12_stats_enabled;
+
+// Phase entered by FAT12_PHASE, left again when the block ends
+struct Fat12PhaseScope {
+    int previous;
+    int active;
+};
+
+struct Fat12PhaseScope fat12_stats_enter(enum Fat12Phase phase);
+void fat12_stats_leave(struct Fat12PhaseScope *scope);
+void fat12_stats_io(int write, uint64_t offset, uint64_t len);
+void fat12_stats_fat_lookup(void);
+
+#define FAT12_PHASE(phase) \
+    __attribute__((cleanup(fat12_stats_leave))) struct Fat12PhaseScope fat12_phase_scope_ = fat12_stats_enter(phase)
+#define FAT12_STAT_READ(offset, len) \
+    do { if (fat12_stats_enabled) fat12_stats_io(0, (offset), (len)); } while (0)
+#define FAT12_STAT_WRITE(offset, len) \
+    do { if (fat12_stats_enabled) fat12_stats_io(1, (offset), (len)); } while (0)
+#define FAT12_STAT_FAT_LOOKUP() \
+    do { if (fat12_stats_enabled) fat12_stats_fat_lookup(); } while (0)
+
+#else
+
+#define FAT12_PHASE(phase) do { } while (0)
+#define FAT12_STAT_READ(offset, len) do { } while (0)
+#define FAT12_STAT_WRITE(offset, len) do { } while (0)
+#define FAT12_STAT_FAT_LOOKUP() do { } while (0)
+
+#endif
+
+#endif
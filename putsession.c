@@ -0,0 +1,1191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "fat12.h"
+#include "batch.h"
+#include "putsession.h"
+
+/*
+putsession.c - File Insertion Sessions
+
+The insertion engine behind diskput, shared with diskd. A session opens an image
+for writing, caches its FAT and builds the free-cluster bitmap once, then inserts
+any number of files or host directory trees; directory lookups and free-slot
+searches are remembered between files, and the FAT is flushed once at the end.
+
+Names that do not fit 8.3 are stored as VFAT long names ahead of a unique "~n"
+alias; so are 8.3 names with lower-case letters, whose alias is just their
+upper-case form when that is free. Each directory touched gets a name table (see fat12_lfn.c) holding all of
+its long and 8.3 names, so path components and alias collisions are resolved with
+one hash probe however many long-name entries the directory holds.
+
+A journaled session stages every FAT and directory write (see fat12_journal.c)
+and commits them all at once when it closes, so an interrupted run leaves the
+image either untouched or fully updated, never with half-linked chains.
+
+Input of unknown length (stdin, a pipe) is streamed by put_pipe: a reader thread
+fills one buffer while the previous one is allocated and written, clusters are
+taken from the allocator as the data arrives, and the directory entry gets its
+size once the input ends.
+*/
+
+// Upper bound on the clusters staged per extent write
+#define EXTENT_BUFFER_CLUSTERS 2048
+
+// Print a per-file message, prefixed with the file in batch mode
+static void report(struct PutSession *s, const char *spec, const char *message) {
+    if (s->messages) {
+        outbuf_printf(s->messages, "%s\n", message);
+    } else if (s->batch) {
+        printf("%s: %s\n", spec, message);
+    } else {
+        printf("%s\n", message);
+    }
+}
+
+// Locate the entries of a directory cluster (0 is a fixed root region) inside the mapped image
+static const struct DirEntry *directory_entries(struct Fat12Image *img, uint32_t cluster, uint32_t *count) {
+    if (cluster == 0) {
+        *count = img->geo.root_dir_entries;
+        FAT12_STAT_READ(img->geo.root_dir_offset, *count * sizeof(struct DirEntry));
+        return img->root_dir;
+    }
+    *count = img->geo.cluster_size / sizeof(struct DirEntry);
+    FAT12_STAT_READ(fat12_cluster_offset(img, cluster), img->geo.cluster_size);
+    return (const struct DirEntry *)fat12_cluster(img, cluster);
+}
+
+// Next cluster of a directory chain, or 0 at its end (a fixed root is a single region)
+static uint32_t next_directory_cluster(struct PutSession *s, uint32_t cluster) {
+    if (cluster == 0) {
+        return 0;
+    }
+    uint32_t next = fat12_fat_get(&s->fat, cluster);
+    return fat12_valid_cluster(&s->img, next) ? next : 0;
+}
+
+// Name table of a directory, built on first use; the oldest table is dropped when
+// all are taken. Returns NULL after reporting an error.
+static struct Fat12NameTable *directory_names(struct PutSession *s, uint32_t dir_cluster) {
+    for (uint32_t i = 0; i < NAME_TABLES; i++) {
+        if (s->names[i].used && s->names[i].dir_cluster == dir_cluster) {
+            return &s->names[i].table;
+        }
+    }
+
+    struct DirNames *names = &s->names[s->next_names];
+    if (names->used) {
+        fat12_names_free(&names->table);
+        names->used = 0;
+    }
+    if (fat12_names_build(&names->table, &s->img, &s->fat, dir_cluster) != 0) {
+        return NULL;
+    }
+    s->next_names = (s->next_names + 1) % NAME_TABLES;
+    names->used = 1;
+    names->dir_cluster = dir_cluster;
+    return &names->table;
+}
+
+// Function to find a directory given a path
+uint32_t find_directory(struct PutSession *s, const char *path) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    if (path[0] == '\0' || (path[0] == '/' && path[1] == '\0')) {
+        return 0;  // Special case for root directory
+    }
+
+    // Consecutive files usually target the same directory
+    if (s->last_dir_valid && strcmp(s->last_dirpath, path) == 0) {
+        return s->last_dir_cluster;
+    }
+
+    // Directories in the index still exist: a session only ever adds entries
+    const struct Fat12IndexRecord *record = s->indexed ? fat12_index_find(&s->index, path) : NULL;
+    if (record && (fat12_index_entry(&s->img, record)->attributes & 0x10)) {
+        return fat12_entry_cluster(&s->img, fat12_index_entry(&s->img, record));
+    }
+
+    char *path_copy = strdup(path);
+    if (!path_copy) {
+        fprintf(stderr, "Memory allocation error: %s\n", strerror(errno));
+        return UINT32_MAX;
+    }
+
+    // One probe of each directory's name table per component; the tables are kept,
+    // so later paths through the same directories scan nothing
+    char *token = strtok(path_copy, "/");
+    uint32_t current_cluster = 0;  // Start from root directory
+
+    while (token != NULL) {
+        struct Fat12NameTable *names = directory_names(s, current_cluster);
+        if (!names) {
+            free(path_copy);
+            return UINT32_MAX;
+        }
+
+        uint64_t offset = fat12_names_find(names, token);
+        const struct DirEntry *entry = (const struct DirEntry *)(s->img.base + offset);
+        if (offset == 0 || !(entry->attributes & 0x10)) {
+            free(path_copy);
+            return 0;  // Directory not found
+        }
+        current_cluster = fat12_entry_cluster(&s->img, entry);
+
+        token = strtok(NULL, "/");
+    }
+
+    free(path_copy);
+
+    snprintf(s->last_dirpath, sizeof(s->last_dirpath), "%s", path);
+    s->last_dir_cluster = current_cluster;
+    s->last_dir_valid = 1;
+    return current_cluster;
+}
+
+static struct SlotHint *slot_hint(struct PutSession *s, uint32_t dir_cluster) {
+    for (uint32_t i = 0; i < SLOT_HINTS; i++) {
+        if (s->hints[i].used && s->hints[i].dir_cluster == dir_cluster) {
+            return &s->hints[i];
+        }
+    }
+
+    // Start a fresh search at the head of the directory, recycling the oldest hint
+    struct SlotHint *hint = &s->hints[s->next_hint];
+    s->next_hint = (s->next_hint + 1) % SLOT_HINTS;
+    hint->used = 1;
+    hint->dir_cluster = dir_cluster;
+    hint->cluster = fat12_dir_cluster(&s->img, dir_cluster);
+    hint->index = 0;
+    return hint;
+}
+
+// Extend a full subdirectory with a zeroed cluster; returns the new cluster or 0
+static uint32_t grow_directory(struct PutSession *s, uint32_t tail) {
+    uint32_t cluster = fat12_alloc_cluster(&s->alloc);
+    if (cluster == 0) {
+        return 0;
+    }
+
+    uint8_t *zero = calloc(1, s->img.geo.cluster_size);
+    if (!zero) {
+        fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
+        fat12_alloc_free_chain(&s->alloc, cluster);
+        return 0;
+    }
+    int rc = fat12_write_meta(&s->img, fat12_cluster_offset(&s->img, cluster), zero, s->img.geo.cluster_size);
+    free(zero);
+    if (rc != 0) {
+        fat12_alloc_free_chain(&s->alloc, cluster);
+        return 0;
+    }
+
+    fat12_fat_set(&s->fat, tail, cluster);
+    return cluster;
+}
+
+// Find count consecutive free directory entries, growing a full subdirectory as
+// needed; stores their image offsets in offsets and returns 0, or -1. The hint only
+// moves past used entries, so free runs too short for this name stay available.
+static int find_free_slots(struct PutSession *s, uint32_t dir_cluster, uint32_t count, off_t *offsets) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    struct SlotHint *hint = slot_hint(s, dir_cluster);
+    uint32_t cluster = hint->cluster;
+    uint32_t index = hint->index;
+    int skipped_free = 0;
+    uint32_t run = 0;
+    uint32_t steps = 0;
+
+    for (;;) {
+        uint32_t entries_to_read;
+        const struct DirEntry *entries = directory_entries(&s->img, cluster, &entries_to_read);
+        if (!entries) {
+            fprintf(stderr, "Error reading directory: cluster %u out of range\n", cluster);
+            return -1;
+        }
+
+        for (; index < entries_to_read; index++) {
+            uint8_t first = entries[index].filename[0];
+            if (first == 0x00 || first == 0xE5) {
+                offsets[run++] = ((const uint8_t *)&entries[index]) - s->img.base;
+                if (run == count) {
+                    return 0;
+                }
+                continue;
+            }
+
+            // A used entry ends the run; the hint follows while nothing free lies behind it
+            skipped_free |= run > 0;
+            run = 0;
+            if (!skipped_free) {
+                hint->cluster = cluster;
+                hint->index = index + 1;
+            }
+        }
+
+        if (cluster == 0) {
+            return -1;  // A fixed root directory cannot grow
+        }
+
+        // A run may carry on into the next cluster of the chain
+        uint32_t next = next_directory_cluster(s, cluster);
+        if (next == 0) {
+            next = grow_directory(s, cluster);
+            if (next == 0) {
+                return -1;
+            }
+        } else if (++steps >= s->img.geo.total_clusters) {
+            return -1;  // Cyclic chain
+        }
+        cluster = next;
+        index = 0;
+    }
+}
+
+// Clear a new directory entry and set its timestamps
+static void prepare_entry(struct DirEntry *entry) {
+    memset(entry, 0, sizeof(*entry));
+    entry->attributes = 0x00;  // Regular file
+
+    // Set creation and modification time and date
+    time_t now = time(NULL);
+    struct tm *tm_now = localtime(&now);
+    entry->last_write_time = (tm_now->tm_hour << 11) | (tm_now->tm_min << 5) | (tm_now->tm_sec / 2);
+    entry->last_write_date = ((tm_now->tm_year - 80) << 9) | ((tm_now->tm_mon + 1) << 5) | tm_now->tm_mday;
+    entry->creation_time = entry->last_write_time;
+    entry->creation_date = entry->last_write_date;
+}
+
+// Give entry the 8.3 form of name, or else an alias not yet used in names, and
+// write the long-name entries that go before it into lfn (room for 20). Returns how
+// many long-name entries there are, -1 if name cannot be stored, or -2 if names
+// already holds it.
+static int name_entries(const struct Fat12NameTable *names, const char *name, struct DirEntry *entry,
+                        struct DirEntry *lfn) {
+    if (fat12_lfn_entries(name) < 0) {
+        return -1;
+    }
+    if (fat12_names_find(names, name) != 0) {
+        return -2;
+    }
+    if (fat12_short_name(name, entry)) {
+        char short_name[13];
+        fat12_entry_name(entry, short_name);
+        if (fat12_names_find(names, short_name) != 0) {
+            return -2;
+        }
+    } else {
+        // A name that differs from its 8.3 form only in case keeps that form as its
+        // alias while it is free
+        char basis[13];
+        fat12_entry_name(entry, basis);
+        if (strcasecmp(basis, name) == 0 && fat12_names_find(names, basis) == 0) {
+            return fat12_lfn_encode(name, entry, lfn);
+        }
+        for (uint32_t n = 1;; n++) {
+            fat12_short_name(name, entry);
+            fat12_short_alias(entry, n);
+            char alias[13];
+            fat12_entry_name(entry, alias);
+            if (fat12_names_find(names, alias) == 0 || n == 999999) {
+                break;
+            }
+        }
+    }
+    return fat12_lfn_encode(name, entry, lfn);
+}
+
+// Write a name's long-name entries and its 8.3 entry into the slots found for them,
+// one call per run of adjacent slots, and record the names in the directory's table
+static int write_entries(struct PutSession *s, struct Fat12NameTable *names, const char *name,
+                         const struct DirEntry *lfn, int pieces, const struct DirEntry *entry,
+                         const off_t *offsets) {
+    struct DirEntry slots[21];
+    memcpy(slots, lfn, pieces * sizeof(*lfn));
+    slots[pieces] = *entry;
+    for (int i = 0; i <= pieces;) {
+        int run = 1;
+        while (i + run <= pieces && offsets[i + run] == offsets[i] + (off_t)(run * sizeof(struct DirEntry))) {
+            run++;
+        }
+        if (fat12_write_meta(&s->img, offsets[i], &slots[i], run * sizeof(struct DirEntry)) != 0) {
+            return -1;
+        }
+        i += run;
+    }
+
+    char short_name[13];
+    fat12_entry_name(entry, short_name);
+    if ((pieces > 0 && fat12_names_add(names, name, offsets[pieces]) != 0) ||
+        fat12_names_add(names, short_name, offsets[pieces]) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Allocate an extent of at most want clusters and link it after *tail (0 while the
+// entry has no clusters yet); returns its length, or 0 when the disk is full
+static uint32_t extend_chain(struct PutSession *s, uint32_t want, struct DirEntry *entry, uint32_t *tail,
+                             uint32_t *extent_start) {
+    uint32_t extent_len = fat12_alloc_extent(&s->alloc, want, extent_start);
+    if (extent_len == 0) {
+        fprintf(stderr, "No more free clusters available.\n");
+        return 0;
+    }
+    if (*tail == 0) {
+        fat12_set_entry_cluster(&s->img, entry, *extent_start);
+    } else {
+        fat12_fat_set(&s->fat, *tail, *extent_start);
+    }
+    *tail = *extent_start + extent_len - 1;
+    return extent_len;
+}
+
+// Append len bytes of data to the chain ending at *tail, allocating contiguous
+// extents and writing each with a single call
+static int append_data(struct PutSession *s, const char *data, size_t len, struct DirEntry *entry, uint32_t *tail) {
+    uint32_t cluster_size = s->img.geo.cluster_size;
+    uint32_t clusters = (len + cluster_size - 1) / cluster_size;
+    while (clusters > 0) {
+        uint32_t extent_start;
+        uint32_t extent_len = extend_chain(s, clusters, entry, tail, &extent_start);
+        if (extent_len == 0) {
+            return -1;
+        }
+
+        size_t to_write = (size_t)extent_len * cluster_size;
+        if (to_write > len) {
+            to_write = len;
+        }
+        if (fat12_write(&s->img, fat12_cluster_offset(&s->img, extent_start), data, to_write) != 0) {
+            return -1;
+        }
+
+        data += to_write;
+        len -= to_write;
+        clusters -= extent_len;
+    }
+    return 0;
+}
+
+// Give back a partly written file's clusters
+static void release_data(struct PutSession *s, struct DirEntry *entry, uint32_t tail) {
+    if (tail != 0) {
+        fat12_alloc_free_chain(&s->alloc, fat12_entry_cluster(&s->img, entry));
+        fat12_set_entry_cluster(&s->img, entry, 0);
+    }
+}
+
+// Copy a host file through the session's queue: allocate the file extent by extent
+// and queue each extent's copy, so reads and writes of several are in flight
+static int queue_file_data(struct PutSession *s, int input, uint32_t file_size, struct DirEntry *entry) {
+    uint32_t cluster_size = s->img.geo.cluster_size;
+    uint32_t tail = 0;
+    uint32_t bytes_written = 0;
+    while (bytes_written < file_size) {
+        // Ask for what is left of the current buffer's worth, as write_file_data does,
+        // so the file is laid out the same either way
+        uint32_t want = (file_size - bytes_written + cluster_size - 1) / cluster_size;
+        uint32_t buffer_left = EXTENT_BUFFER_CLUSTERS - bytes_written / cluster_size % EXTENT_BUFFER_CLUSTERS;
+        if (want > buffer_left) {
+            want = buffer_left;
+        }
+        uint32_t extent_start;
+        uint32_t extent_len = extend_chain(s, want, entry, &tail, &extent_start);
+        if (extent_len == 0) {
+            goto fail;
+        }
+
+        uint32_t to_write = file_size - bytes_written;
+        if ((uint64_t)extent_len * cluster_size < to_write) {
+            to_write = extent_len * cluster_size;
+        }
+        off_t offset = fat12_cluster_offset(&s->img, extent_start);
+        FAT12_STAT_WRITE(offset, to_write);
+        if (fat12_queue_copy(&s->queue, input, bytes_written, s->img.fd, offset, to_write) != 0) {
+            goto fail;
+        }
+        bytes_written += to_write;
+    }
+    if (fat12_queue_drain(&s->queue) != 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    // Nothing may still be writing into the clusters when they are given back
+    fat12_queue_drain(&s->queue);
+    release_data(s, entry, tail);
+    return -1;
+}
+
+// Copy the input file into freshly allocated extents, chaining them as it goes
+static int write_file_data(struct PutSession *s, FILE *input_file, uint32_t file_size, struct DirEntry *entry) {
+    FAT12_PHASE(FAT12_PHASE_DATA);
+    uint32_t cluster_size = s->img.geo.cluster_size;
+    uint32_t clusters_needed = (file_size + cluster_size - 1) / cluster_size;
+    if (clusters_needed == 0) {
+        return 0;
+    }
+
+    // Queued copies read the input by offset from its start, so it must be a regular file
+    struct stat st;
+    if (s->queued && fstat(fileno(input_file), &st) == 0 && S_ISREG(st.st_mode)) {
+        return queue_file_data(s, fileno(input_file), file_size, entry);
+    }
+
+    // Stage whole extents so each contiguous run is written with a single call
+    uint32_t buffer_clusters = clusters_needed < EXTENT_BUFFER_CLUSTERS ? clusters_needed : EXTENT_BUFFER_CLUSTERS;
+    size_t buffer_size = (size_t)buffer_clusters * cluster_size;
+    char *buffer = malloc(buffer_size);
+    if (!buffer) {
+        fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
+        return -1;
+    }
+
+    uint32_t tail = 0;
+    uint32_t bytes_written = 0;
+    while (bytes_written < file_size) {
+        size_t to_write = file_size - bytes_written;
+        if (to_write > buffer_size) {
+            to_write = buffer_size;
+        }
+
+        size_t bytes_read = fread(buffer, 1, to_write, input_file);
+        if (bytes_read != to_write) {
+            fprintf(stderr, "Error reading from input file: %s\n", strerror(errno));
+            goto fail;
+        }
+        if (append_data(s, buffer, to_write, entry, &tail) != 0) {
+            goto fail;
+        }
+        bytes_written += to_write;
+    }
+
+    free(buffer);
+    return 0;
+
+fail:
+    release_data(s, entry, tail);
+    free(buffer);
+    return -1;
+}
+
+// Resolve the directory part of image_path; returns 0 with the directory cluster
+// and the filename, or 1 after reporting why not
+static int resolve_target(struct PutSession *s, const char *image_path, uint32_t *dir_cluster,
+                          const char **filename) {
+    // Parse the destination path and filename
+    *filename = strrchr(image_path, '/');
+    *filename = *filename ? *filename + 1 : image_path;
+
+    char dirpath[4096] = {0};
+    if (*filename != image_path) {
+        size_t dir_len = *filename - image_path - 1;
+        if (dir_len >= sizeof(dirpath)) {
+            report(s, image_path, "The directory not found.");
+            return 1;
+        }
+        memcpy(dirpath, image_path, dir_len);
+    }
+
+    // Find the target directory
+    *dir_cluster = find_directory(s, dirpath);
+    if (*dir_cluster == UINT32_MAX) {
+        return 1;  // Error already printed in find_directory
+    }
+    if (*dir_cluster == 0 && dirpath[0] != '\0') {
+        report(s, image_path, "The directory not found.");
+        return 1;
+    }
+    return 0;
+}
+
+// Add a file of file_size bytes read from input to a resolved directory
+static int insert_file(struct PutSession *s, uint32_t dir_cluster, const char *filename, FILE *input,
+                       uint64_t file_size, const char *image_path) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    // Calculate required clusters and check for free space
+    uint32_t cluster_size = s->img.geo.cluster_size;
+    uint64_t clusters_needed = (file_size + cluster_size - 1) / cluster_size;
+    if (file_size > UINT32_MAX || s->alloc.free_count < clusters_needed) {
+        report(s, image_path, "No enough free space in the disk image.");
+        return 1;
+    }
+
+    // Name the entry, with a long name and a unique alias when it does not fit 8.3
+    struct Fat12NameTable *names = directory_names(s, dir_cluster);
+    if (!names) {
+        return 1;
+    }
+    struct DirEntry entry, lfn[20];
+    prepare_entry(&entry);
+    int pieces = name_entries(names, filename, &entry, lfn);
+    if (pieces < 0) {
+        report(s, image_path, pieces == -2 ? "File already exists." : "Invalid file name.");
+        return 1;
+    }
+    entry.file_size = file_size;
+
+    // Find free directory entries for the long name and the entry itself
+    off_t offsets[21];
+    if (find_free_slots(s, dir_cluster, pieces + 1, offsets) != 0) {
+        report(s, image_path, "No free directory entries.");
+        return 1;
+    }
+
+    if (write_file_data(s, input, file_size, &entry) != 0) {
+        return 1;
+    }
+
+    // Write the directory entries
+    if (write_entries(s, names, filename, lfn, pieces, &entry, offsets) != 0) {
+        fat12_alloc_free_chain(&s->alloc, fat12_entry_cluster(&s->img, &entry));
+        return 1;
+    }
+
+    return 0;
+}
+
+int put_file(struct PutSession *s, const char *host_path, const char *image_path) {
+    uint32_t dir_cluster;
+    const char *filename;
+    if (resolve_target(s, image_path, &dir_cluster, &filename) != 0) {
+        return 1;
+    }
+
+    // Open the input file
+    FILE *input_file = fopen(host_path, "rb");
+    if (!input_file) {
+        report(s, image_path, "File not found.");
+        return 1;
+    }
+
+    // Get the file size
+    if (fseek(input_file, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Error seeking in input file: %s\n", strerror(errno));
+        fclose(input_file);
+        return 1;
+    }
+    long file_size = ftell(input_file);
+    if (file_size == -1) {
+        fprintf(stderr, "Error getting file size: %s\n", strerror(errno));
+        fclose(input_file);
+        return 1;
+    }
+    if (fseek(input_file, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Error seeking in input file: %s\n", strerror(errno));
+        fclose(input_file);
+        return 1;
+    }
+
+    int rc = insert_file(s, dir_cluster, filename, input_file, file_size, image_path);
+    fclose(input_file);
+    return rc;
+}
+
+int put_stream(struct PutSession *s, FILE *input, uint64_t file_size, const char *image_path) {
+    uint32_t dir_cluster;
+    const char *filename;
+    if (resolve_target(s, image_path, &dir_cluster, &filename) != 0) {
+        return 1;
+    }
+    return insert_file(s, dir_cluster, filename, input, file_size, image_path);
+}
+
+// Input buffers handed between put_pipe's reader thread and the image writer
+#define PIPE_BUFFERS 2
+
+// Bytes read per buffer, rounded down to whole clusters
+#define PIPE_BUFFER_BYTES (1 << 20)
+
+struct PipeBuffer {
+    char *data;
+    size_t len;                 // Bytes read; a whole number of clusters unless last
+    int full;                   // Filled by the reader and not yet written
+    int last;                   // Input ended (or failed) with this buffer
+    int error;                  // errno of the failed read, else 0
+};
+
+// Reads the input ahead of the writer, alternating between the buffers
+struct PipeReader {
+    int fd;
+    size_t capacity;
+    struct PipeBuffer buffers[PIPE_BUFFERS];
+    int stop;                   // Writer gave up; leave the rest of the input unread
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static void *pipe_reader(void *arg) {
+    struct PipeReader *r = arg;
+    for (uint32_t i = 0;; i++) {
+        struct PipeBuffer *b = &r->buffers[i % PIPE_BUFFERS];
+        pthread_mutex_lock(&r->lock);
+        while (b->full && !r->stop) {
+            pthread_cond_wait(&r->changed, &r->lock);
+        }
+        int stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+        if (stop) {
+            return NULL;
+        }
+
+        // Fill the buffer completely so only the final one ends mid-cluster
+        size_t len = 0;
+        int last = 0, error = 0;
+        while (len < r->capacity) {
+            ssize_t n = read(r->fd, b->data + len, r->capacity - len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                last = 1;
+                error = n < 0 ? errno : 0;
+                break;
+            }
+            len += n;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        b->len = len;
+        b->last = last;
+        b->error = error;
+        b->full = 1;
+        pthread_cond_broadcast(&r->changed);
+        pthread_mutex_unlock(&r->lock);
+        if (last) {
+            return NULL;
+        }
+    }
+}
+
+// Write everything the reader delivers as the entry's data, allocating as it
+// arrives; the size is only known once the input ends
+static int write_pipe_data(struct PutSession *s, struct PipeReader *r, struct DirEntry *entry,
+                           const char *image_path) {
+    FAT12_PHASE(FAT12_PHASE_DATA);
+    uint32_t cluster_size = s->img.geo.cluster_size;
+    uint32_t tail = 0;
+    uint64_t total = 0;
+    int rc = 0;
+
+    for (uint32_t i = 0; rc == 0; i++) {
+        struct PipeBuffer *b = &r->buffers[i % PIPE_BUFFERS];
+        pthread_mutex_lock(&r->lock);
+        while (!b->full) {
+            pthread_cond_wait(&r->changed, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        total += b->len;
+        if (b->error) {
+            fprintf(stderr, "Error reading from input file: %s\n", strerror(b->error));
+            rc = 1;
+        } else if (total > UINT32_MAX ||
+                   s->alloc.free_count < (b->len + cluster_size - 1) / cluster_size) {
+            report(s, image_path, "No enough free space in the disk image.");
+            rc = 1;
+        } else if (append_data(s, b->data, b->len, entry, &tail) != 0) {
+            rc = 1;
+        }
+        int last = b->last;
+
+        // Hand the buffer back while the next one is written
+        pthread_mutex_lock(&r->lock);
+        b->full = 0;
+        pthread_cond_broadcast(&r->changed);
+        pthread_mutex_unlock(&r->lock);
+        if (last) {
+            break;
+        }
+    }
+
+    if (rc != 0) {
+        release_data(s, entry, tail);
+        return rc;
+    }
+    entry->file_size = total;
+    return 0;
+}
+
+int put_pipe(struct PutSession *s, int input, const char *image_path) {
+    uint32_t dir_cluster;
+    const char *filename;
+    if (resolve_target(s, image_path, &dir_cluster, &filename) != 0) {
+        return 1;
+    }
+
+    // Name the entry and reserve its slots before consuming any input
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    struct Fat12NameTable *names = directory_names(s, dir_cluster);
+    if (!names) {
+        return 1;
+    }
+    struct DirEntry entry, lfn[20];
+    prepare_entry(&entry);
+    int pieces = name_entries(names, filename, &entry, lfn);
+    if (pieces < 0) {
+        report(s, image_path, pieces == -2 ? "File already exists." : "Invalid file name.");
+        return 1;
+    }
+    off_t offsets[21];
+    if (find_free_slots(s, dir_cluster, pieces + 1, offsets) != 0) {
+        report(s, image_path, "No free directory entries.");
+        return 1;
+    }
+
+    struct PipeReader r;
+    memset(&r, 0, sizeof(r));
+    r.fd = input;
+    r.capacity = PIPE_BUFFER_BYTES / s->img.geo.cluster_size * s->img.geo.cluster_size;
+    if (r.capacity == 0) {
+        r.capacity = s->img.geo.cluster_size;
+    }
+    int rc = 1;
+    for (int i = 0; i < PIPE_BUFFERS; i++) {
+        r.buffers[i].data = malloc(r.capacity);
+        if (!r.buffers[i].data) {
+            fprintf(stderr, "Error allocating memory: %s\n", strerror(errno));
+            goto out;
+        }
+    }
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.changed, NULL);
+
+    pthread_t reader;
+    int err = pthread_create(&reader, NULL, pipe_reader, &r);
+    if (err != 0) {
+        fprintf(stderr, "Error starting input reader: %s\n", strerror(err));
+    } else {
+        rc = write_pipe_data(s, &r, &entry, image_path);
+
+        pthread_mutex_lock(&r.lock);
+        r.stop = 1;
+        pthread_cond_broadcast(&r.changed);
+        pthread_mutex_unlock(&r.lock);
+        pthread_join(reader, NULL);
+    }
+    pthread_cond_destroy(&r.changed);
+    pthread_mutex_destroy(&r.lock);
+
+    // Write the directory entries now that the size is known
+    if (rc == 0 && write_entries(s, names, filename, lfn, pieces, &entry, offsets) != 0) {
+        fat12_alloc_free_chain(&s->alloc, fat12_entry_cluster(&s->img, &entry));
+        rc = 1;
+    }
+
+out:
+    for (int i = 0; i < PIPE_BUFFERS; i++) {
+        free(r.buffers[i].data);
+    }
+    return rc;
+}
+
+// A host file or directory queued for recursive import
+struct ImportNode {
+    char *host_path;
+    const char *name;           // Points into host_path
+    int is_dir;
+    uint32_t size;
+    struct ImportNode *children;
+    size_t child_count;
+};
+
+static void free_import_tree(struct ImportNode *node) {
+    for (size_t i = 0; i < node->child_count; i++) {
+        free_import_tree(&node->children[i]);
+    }
+    free(node->children);
+    free(node->host_path);
+}
+
+// Directories sort after files so each directory's file data follows its own clusters
+static int compare_import_nodes(const void *a, const void *b) {
+    const struct ImportNode *x = a, *y = b;
+    if (x->is_dir != y->is_dir) {
+        return x->is_dir - y->is_dir;
+    }
+    return strcmp(x->name, y->name);
+}
+
+// Scan a host tree into memory so the whole import can be sized and planned up front
+static int scan_import_tree(const char *path, struct ImportNode *node) {
+    memset(node, 0, sizeof(*node));
+    node->host_path = strdup(path);
+    if (!node->host_path) {
+        fprintf(stderr, "Memory allocation error: %s\n", strerror(errno));
+        return -1;
+    }
+    const char *slash = strrchr(node->host_path, '/');
+    node->name = slash ? slash + 1 : node->host_path;
+    if (fat12_lfn_entries(node->name) < 0) {
+        fprintf(stderr, "%s: name cannot be stored in the image\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (st.st_size > UINT32_MAX) {
+            fprintf(stderr, "%s: file too large for FAT\n", path);
+            return -1;
+        }
+        node->size = st.st_size;
+        return 0;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "%s: not a regular file or directory\n", path);
+        return -1;
+    }
+    node->is_dir = 1;
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    size_t capacity = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+        if (node->child_count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            struct ImportNode *grown = realloc(node->children, capacity * sizeof(*grown));
+            if (!grown) {
+                fprintf(stderr, "Memory allocation error: %s\n", strerror(errno));
+                closedir(dir);
+                return -1;
+            }
+            node->children = grown;
+        }
+
+        char child_path[4096];
+        snprintf(child_path, sizeof(child_path), "%s/%s", path, de->d_name);
+        if (scan_import_tree(child_path, &node->children[node->child_count++]) != 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+
+    qsort(node->children, node->child_count, sizeof(*node->children), compare_import_nodes);
+    return 0;
+}
+
+// Clusters a directory needs for its children, with their long names, plus the "."
+// and ".." entries
+static uint32_t directory_clusters(struct PutSession *s, const struct ImportNode *node) {
+    uint32_t slots = 2;
+    for (size_t i = 0; i < node->child_count; i++) {
+        slots += 1 + fat12_lfn_entries(node->children[i].name);
+    }
+    uint32_t bytes = slots * sizeof(struct DirEntry);
+    return (bytes + s->img.geo.cluster_size - 1) / s->img.geo.cluster_size;
+}
+
+static uint32_t import_tree_clusters(struct PutSession *s, const struct ImportNode *node) {
+    if (!node->is_dir) {
+        return (node->size + s->img.geo.cluster_size - 1) / s->img.geo.cluster_size;
+    }
+    uint32_t total = directory_clusters(s, node);
+    for (size_t i = 0; i < node->child_count; i++) {
+        total += import_tree_clusters(s, &node->children[i]);
+    }
+    return total;
+}
+
+// Import one host directory whose entry lives in parent_cluster; *entry comes named
+// by the caller and gets the rest filled in. Its own clusters are allocated first, then its files' data, then each subdirectory,
+// so a directory and the files it lists sit next to each other on the image.
+static int import_directory(struct PutSession *s, const struct ImportNode *node, uint32_t parent_cluster,
+                            struct DirEntry *entry, uint32_t *files, uint32_t *dirs) {
+    uint32_t cluster_size = s->img.geo.cluster_size;
+    uint32_t dir_clusters = directory_clusters(s, node);
+
+    // Allocate the directory's own chain as contiguously as possible
+    uint32_t *clusters = malloc(dir_clusters * sizeof(uint32_t));
+    uint8_t *content = calloc(dir_clusters, cluster_size);
+    if (!clusters || !content) {
+        fprintf(stderr, "Memory allocation error: %s\n", strerror(errno));
+        free(clusters);
+        free(content);
+        return -1;
+    }
+    uint32_t allocated = 0;
+    uint32_t previous_tail = 0;
+    while (allocated < dir_clusters) {
+        uint32_t start;
+        uint32_t len = fat12_alloc_extent(&s->alloc, dir_clusters - allocated, &start);
+        if (len == 0) {
+            fprintf(stderr, "No more free clusters available.\n");
+            free(clusters);
+            free(content);
+            return -1;
+        }
+        if (previous_tail != 0) {
+            fat12_fat_set(&s->fat, previous_tail, start);
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            clusters[allocated++] = start + i;
+        }
+        previous_tail = start + len - 1;
+    }
+
+    entry->attributes = 0x10;  // Directory
+    fat12_set_entry_cluster(&s->img, entry, clusters[0]);
+
+    // "." and ".." come first; ".." of a top-level directory points at cluster 0
+    struct DirEntry *entries = (struct DirEntry *)content;
+    entries[0] = *entry;
+    memcpy(entries[0].filename, ".          ", 11);
+    entries[1] = *entry;
+    memcpy(entries[1].filename, "..         ", 11);
+    fat12_set_entry_cluster(&s->img, &entries[1], parent_cluster);
+
+    // The new directory's 8.3 names, so every alias in it is unique
+    struct Fat12NameTable names;
+    memset(&names, 0, sizeof(names));
+
+    int rc = 0;
+    uint32_t slot = 2;
+    for (size_t i = 0; i < node->child_count && rc == 0; i++) {
+        const struct ImportNode *child = &node->children[i];
+        struct DirEntry child_entry, lfn[20];
+        prepare_entry(&child_entry);
+        int pieces = name_entries(&names, child->name, &child_entry, lfn);
+        if (pieces < 0) {
+            // Host names that differ only in case share one FAT name
+            fprintf(stderr, "Error: %s clashes with another name in its directory\n", child->host_path);
+            rc = -1;
+            break;
+        }
+        char short_name[13];
+        fat12_entry_name(&child_entry, short_name);
+        rc = fat12_names_add(&names, short_name, slot + pieces + 1);
+        if (rc != 0) {
+            break;
+        }
+
+        if (child->is_dir) {
+            rc = import_directory(s, child, clusters[0], &child_entry, files, dirs);
+        } else {
+            FILE *input_file = fopen(child->host_path, "rb");
+            if (!input_file) {
+                fprintf(stderr, "Error opening %s: %s\n", child->host_path, strerror(errno));
+                rc = -1;
+                break;
+            }
+            child_entry.file_size = child->size;
+            rc = write_file_data(s, input_file, child->size, &child_entry);
+            fclose(input_file);
+            if (rc == 0) {
+                (*files)++;
+            }
+        }
+
+        memcpy(&entries[slot], lfn, pieces * sizeof(*lfn));
+        entries[slot + pieces] = child_entry;
+        slot += pieces + 1;
+    }
+    fat12_names_free(&names);
+
+    // Write the finished directory out, one call per contiguous run of its clusters
+    for (uint32_t i = 0; i < dir_clusters && rc == 0;) {
+        uint32_t run = 1;
+        while (i + run < dir_clusters && clusters[i + run] == clusters[i] + run) {
+            run++;
+        }
+        rc = fat12_write_meta(&s->img, fat12_cluster_offset(&s->img, clusters[i]),
+                              content + (size_t)i * cluster_size, (size_t)run * cluster_size);
+        i += run;
+    }
+
+    if (rc == 0) {
+        (*dirs)++;
+    }
+    free(clusters);
+    free(content);
+    return rc;
+}
+
+// Copy a host directory tree into image_dir as a new subdirectory; returns 0 on success
+int put_tree(struct PutSession *s, const char *host_dir, const char *image_dir, uint32_t *files, uint32_t *dirs) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    uint32_t dir_cluster = find_directory(s, image_dir);
+    if (dir_cluster == UINT32_MAX) {
+        return 1;
+    }
+    if (dir_cluster == 0 && image_dir[0] != '\0' && strcmp(image_dir, "/") != 0) {
+        report(s, host_dir, "The directory not found.");
+        return 1;
+    }
+
+    // Strip trailing slashes so the basename names the new directory
+    char root_path[4096];
+    snprintf(root_path, sizeof(root_path), "%s", host_dir);
+    size_t root_len = strlen(root_path);
+    while (root_len > 1 && root_path[root_len - 1] == '/') {
+        root_path[--root_len] = '\0';
+    }
+
+    struct ImportNode root;
+    if (scan_import_tree(root_path, &root) != 0) {
+        free_import_tree(&root);
+        return 1;
+    }
+    if (!root.is_dir) {
+        char message[4200];
+        snprintf(message, sizeof(message), "%s is not a directory.", host_dir);
+        report(s, host_dir, message);
+        free_import_tree(&root);
+        return 1;
+    }
+
+    if (s->alloc.free_count < import_tree_clusters(s, &root)) {
+        report(s, host_dir, "No enough free space in the disk image.");
+        free_import_tree(&root);
+        return 1;
+    }
+
+    // Name the new directory and find entries for it in its parent
+    struct Fat12NameTable *names = directory_names(s, dir_cluster);
+    struct DirEntry entry, lfn[20];
+    prepare_entry(&entry);
+    int pieces = names ? name_entries(names, root.name, &entry, lfn) : -1;
+    off_t offsets[21];
+    if (pieces == -2) {
+        report(s, host_dir, "The directory already exists.");
+        free_import_tree(&root);
+        return 1;
+    }
+    if (pieces < 0 || find_free_slots(s, dir_cluster, pieces + 1, offsets) != 0) {
+        if (names) {
+            report(s, host_dir, "No free directory entries.");
+        }
+        free_import_tree(&root);
+        return 1;
+    }
+
+    // Keep the FAT as it was so a failed import leaves no partial chains behind
+    uint8_t *saved_fat = malloc(s->fat.size);
+    if (!saved_fat) {
+        fprintf(stderr, "Memory allocation error: %s\n", strerror(errno));
+        free_import_tree(&root);
+        return 1;
+    }
+    memcpy(saved_fat, s->fat.table, s->fat.size);
+
+    int rc = import_directory(s, &root, dir_cluster, &entry, files, dirs);
+    if (rc == 0) {
+        rc = write_entries(s, names, root.name, lfn, pieces, &entry, offsets);
+    }
+    if (rc != 0) {
+        memcpy(s->fat.table, saved_fat, s->fat.size);
+        memset(s->fat.dirty, 1, s->fat.sectors);
+        fat12_alloc_release(&s->alloc);
+        if (fat12_alloc_init(&s->alloc, &s->img, &s->fat) != 0) {
+            rc = -1;
+        }
+    }
+
+    free(saved_fat);
+    free_import_tree(&root);
+    return rc == 0 ? 0 : 1;
+}
+
+int session_open(struct PutSession *s, const char *image, int batch, int journaled) {
+    memset(s, 0, sizeof(*s));
+    s->batch = batch;
+
+    // Open and map the disk image for writing, finishing any interrupted commit first
+    if (fat12_open(&s->img, image, 1) != 0) {
+        return -1;
+    }
+    if (fat12_journal_recover(&s->img, image) != 0) {
+        fat12_close(&s->img);
+        return -1;
+    }
+    if (journaled && fat12_journal_begin(&s->journal, &s->img, image) != 0) {
+        fat12_close(&s->img);
+        return -1;
+    }
+    s->journaled = journaled;
+
+    // Load the FAT once; all allocation and chaining happens against this copy
+    if (fat12_fat_load(&s->img, &s->fat) != 0) {
+        fat12_journal_end(&s->journal);
+        fat12_close(&s->img);
+        return -1;
+    }
+
+    // Build the free-cluster bitmap once from the cached FAT
+    if (fat12_alloc_init(&s->alloc, &s->img, &s->fat) != 0) {
+        fat12_fat_release(&s->fat);
+        fat12_journal_end(&s->journal);
+        fat12_close(&s->img);
+        return -1;
+    }
+
+    if (fat12_queue_depth > 0) {
+        if (fat12_queue_open(&s->queue, fat12_queue_depth) != 0) {
+            fat12_alloc_release(&s->alloc);
+            fat12_fat_release(&s->fat);
+            fat12_journal_end(&s->journal);
+            fat12_close(&s->img);
+            return -1;
+        }
+        s->queued = 1;
+    }
+
+    s->image_path = image;
+    s->indexed = fat12_index_open(&s->index, &s->img, image) == 0;
+    return 0;
+}
+
+// Flush all dirty FAT sectors to every FAT copy in one pass, commit the transaction
+// if there is one, and release the session
+int session_close(struct PutSession *s) {
+    int rc = fat12_fat_flush(&s->img, &s->fat);
+    if (s->journaled) {
+        if (rc == 0 && fat12_journal_commit(&s->journal) != 0) {
+            rc = -1;
+        }
+        fat12_journal_end(&s->journal);
+    }
+
+    // Rebuild an index that was valid on entry so it describes the new contents
+    if (s->indexed) {
+        fat12_index_close(&s->index);
+        if (rc == 0 && fat12_index_build(&s->img, s->image_path, NULL) != 0) {
+            rc = -1;
+        }
+    }
+    for (uint32_t i = 0; i < NAME_TABLES; i++) {
+        if (s->names[i].used) {
+            fat12_names_free(&s->names[i].table);
+        }
+    }
+    if (s->queued) {
+        fat12_queue_close(&s->queue);
+    }
+    fat12_alloc_release(&s->alloc);
+    fat12_fat_release(&s->fat);
+    fat12_close(&s->img);
+    return rc;
+}
+
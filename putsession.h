@@ -0,0 +1,85 @@
+#ifndef PUTSESSION_H
+#define PUTSESSION_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "fat12.h"
+#include "batch.h"
+
+/*
+putsession.h - File Insertion Sessions
+
+Inserting files into an image: one session holds the image open for writing with
+its FAT cached and free-cluster bitmap built, and every insertion goes through it.
+Used by diskput and by diskd's put requests.
+*/
+
+// Directories whose next free slot is remembered during a batch
+#define SLOT_HINTS 64
+
+// Where the search for a free entry in a directory should resume
+struct SlotHint {
+    int used;
+    uint32_t dir_cluster;       // Directory the hint belongs to (0 is the root)
+    uint32_t cluster;           // Cluster of the directory chain being searched
+    uint32_t index;             // Entry index within that cluster
+};
+
+// Directories whose name table is kept during a batch
+#define NAME_TABLES 16
+
+// Every name in one directory, for lookups and unique 8.3 aliases
+struct DirNames {
+    int used;
+    uint32_t dir_cluster;       // Directory the table belongs to (0 is the root)
+    struct Fat12NameTable table;
+};
+
+// State shared by every file inserted in one invocation
+struct PutSession {
+    struct Fat12Image img;
+    struct Fat12FatCache fat;
+    struct Fat12Allocator alloc;
+    int batch;
+    char last_dirpath[4096];    // Most recent directory lookup and its result
+    uint32_t last_dir_cluster;
+    int last_dir_valid;
+    struct SlotHint hints[SLOT_HINTS];
+    uint32_t next_hint;
+    struct DirNames names[NAME_TABLES];
+    uint32_t next_names;
+    const char *image_path;
+    struct Fat12Index index;    // Sidecar index, if one matched the image at open
+    int indexed;
+    struct OutBuf *messages;    // Per-file messages go here instead of stdout when set
+    int journaled;              // FAT and directory writes are committed together at close
+    struct Fat12Journal journal;
+    int queued;                 // File data is copied through queue (--queue-depth)
+    struct Fat12Queue queue;
+};
+
+// Open image for writing and prepare the FAT cache and allocator, as one transaction
+// if journaled; returns 0 or -1
+int session_open(struct PutSession *s, const char *image, int batch, int journaled);
+
+// Flush all dirty FAT sectors to every FAT copy and release the session; returns 0 or -1
+int session_close(struct PutSession *s);
+
+// Cluster of the directory at path (0 for the root, or if not found), UINT32_MAX on error
+uint32_t find_directory(struct PutSession *s, const char *path);
+
+// Insert one host file at image_path ("[/path/to/]<filename>"); returns 0 on success
+int put_file(struct PutSession *s, const char *host_path, const char *image_path);
+
+// Insert file_size bytes read from input at image_path; returns 0 on success
+int put_stream(struct PutSession *s, FILE *input, uint64_t file_size, const char *image_path);
+
+// Insert everything read from the descriptor input until end of file at image_path,
+// without knowing its size in advance; returns 0 on success
+int put_pipe(struct PutSession *s, int input, const char *image_path);
+
+// Copy a host directory tree into image_dir as a new subdirectory; returns 0 on success
+int put_tree(struct PutSession *s, const char *host_dir, const char *image_dir, uint32_t *files, uint32_t *dirs);
+
+#endif
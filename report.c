@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fat12.h"
+#include "batch.h"
+#include "report.h"
+
+/*
+report.c - Image Reports
+
+Renders the diskinfo summary and the disklist listing of an open image into an
+output buffer, in any of the output formats. The tools call these on an image they
+have just opened; diskd calls them on images it keeps open between requests.
+*/
+
+// A directory waiting to be walked
+struct PendingDir {
+    uint32_t cluster;
+    uint32_t depth;
+};
+
+// Count files and directories with an explicit stack, following every cluster of
+// each directory chain. A bitmap of walked directory clusters stops loops and
+// cross-linked directories, so each cluster is read at most once.
+int count_files(const struct Fat12Image *img, const char *path, struct TreeStats *stats) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    memset(stats, 0, sizeof(*stats));
+    uint8_t *visited = calloc((img->geo.total_clusters + 2 + 7) / 8, 1);
+    struct PendingDir *stack = malloc(64 * sizeof(*stack));
+    size_t depth_capacity = 64, top = 0;
+    if (!visited || !stack) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(visited);
+        free(stack);
+        return -1;
+    }
+    stack[top].cluster = 0;
+    stack[top].depth = 0;
+    top++;
+
+    int rc = 0;
+    while (top > 0 && rc == 0) {
+        struct PendingDir dir = stack[--top];
+
+        struct Fat12DirIter it;
+        fat12_dir_open(&it, img, NULL, dir.cluster);
+        if (it.error) {
+            fprintf(stderr, "%s: Error reading directory: cluster %u out of range\n", path, dir.cluster);
+            continue;
+        }
+
+        uint32_t steps_checked = UINT32_MAX;
+        const struct DirEntry *entry;
+        while ((entry = fat12_dir_next(&it)) != NULL) {
+            // Check each new cluster of a subdirectory chain before using its entries
+            if (it.cluster != 0 && it.steps != steps_checked) {
+                steps_checked = it.steps;
+                if (visited[it.cluster / 8] & (1 << (it.cluster % 8))) {
+                    stats->cycles++;
+                    break;
+                }
+                visited[it.cluster / 8] |= 1 << (it.cluster % 8);
+                stats->directory_clusters++;
+            }
+
+            uint32_t first_cluster = fat12_entry_cluster(img, entry);
+            uint8_t attributes = entry->attributes;
+
+            if (attributes & 0x08) continue;  // Volume label or long name, skip
+            if (first_cluster == 0 || first_cluster == 1) continue;
+
+            if (attributes & 0x10) {  // Subdirectory
+                if (entry->filename[0] == '.') continue;  // '.' and '..'
+
+                stats->directories++;
+                if (dir.depth + 1 > stats->max_depth) {
+                    stats->max_depth = dir.depth + 1;
+                }
+                if (top == depth_capacity) {
+                    struct PendingDir *grown = realloc(stack, 2 * depth_capacity * sizeof(*stack));
+                    if (!grown) {
+                        fprintf(stderr, "Memory allocation error\n");
+                        rc = -1;
+                        break;
+                    }
+                    stack = grown;
+                    depth_capacity *= 2;
+                }
+                stack[top].cluster = first_cluster;
+                stack[top].depth = dir.depth + 1;
+                top++;
+            } else {  // Regular file
+                stats->files++;
+            }
+        }
+    }
+
+    free(stack);
+    free(visited);
+    return rc;
+}
+
+// Scan the whole FAT for free entries
+static uint32_t count_free_clusters(const struct Fat12Image *img) {
+    FAT12_PHASE(FAT12_PHASE_FAT);
+    FAT12_STAT_READ(img->geo.fat_offset, ((uint64_t)img->geo.total_clusters + 2) * img->geo.fat_bits / 8);
+    return img->codec->count_free(img->fat, 2, img->geo.total_clusters);
+}
+
+// Function to get volume label
+static void get_volume_label(const struct Fat12Image *img, char *label) {
+    const struct BootSectorTail *ext = img->ext;
+
+    // First, check the boot sector
+    if (ext->volume_label[0] != 0 && ext->volume_label[0] != ' ') {
+        strncpy(label, ext->volume_label, 11);
+        label[11] = '\0';
+        return;
+    }
+
+    // If not found in boot sector, search in root directory
+    struct Fat12DirIter it;
+    fat12_dir_open(&it, img, NULL, 0);
+    const struct DirEntry *entry;
+    while ((entry = fat12_dir_next(&it)) != NULL) {
+        if (entry->attributes == 0x08) {  // Volume label attribute
+            strncpy(label, entry->filename, 11);
+            label[11] = '\0';
+            return;
+        }
+    }
+
+    // If still not found, set to "NO NAME"
+    strcpy(label, "NO NAME    ");
+}
+
+// Render the diskinfo report for one image
+int info_render(const struct Fat12Image *img, const char *path, enum OutputFormat format, struct OutBuf *out) {
+    const struct BootSector *bs = img->bs;
+
+    // Get the volume label
+    char volume_label[12];
+    get_volume_label(img, volume_label);
+    
+    // Calculate total disk size
+    unsigned long long total_size = (unsigned long long)img->geo.total_sectors * img->geo.bytes_per_sector;
+
+    // Count free clusters
+    uint32_t free_clusters = count_free_clusters(img);
+    unsigned long long free_size = (unsigned long long)free_clusters * img->geo.cluster_size;
+
+    // Count files across the whole directory tree
+    struct TreeStats tree;
+    if (count_files(img, path, &tree) != 0) {
+        return 1;
+    }
+    if (tree.cycles > 0) {
+        fprintf(stderr, "%s: warning: directory tree links back on itself %u time(s)\n", path, tree.cycles);
+    }
+
+    char os_name[9];
+    snprintf(os_name, sizeof(os_name), "%.8s", bs->oem);
+
+    // Records carry the label without its space padding
+    char label_value[12];
+    strcpy(label_value, volume_label);
+    for (int j = strlen(label_value) - 1; j >= 0 && label_value[j] == ' '; j--) {
+        label_value[j] = '\0';
+    }
+
+    if (format == FORMAT_JSONL) {
+        outbuf_printf(out, "{\"image\":");
+        outbuf_json_string(out, path);
+        outbuf_printf(out, ",\"os_name\":");
+        outbuf_json_string(out, os_name);
+        outbuf_printf(out, ",\"label\":");
+        outbuf_json_string(out, label_value);
+        outbuf_printf(out, ",\"total_size\":%llu,\"free_size\":%llu,\"files\":%u,\"directories\":%u,"
+                      "\"directory_clusters\":%u,\"max_depth\":%u,\"directory_cycles\":%u,"
+                      "\"fat_copies\":%u,\"sectors_per_fat\":%u,\"fat_bits\":%u}\n",
+                      total_size, free_size, tree.files, tree.directories, tree.directory_clusters,
+                      tree.max_depth, tree.cycles, bs->num_fats, img->geo.fat_sectors, img->geo.fat_bits);
+    } else if (format == FORMAT_CSV) {
+        outbuf_csv_field(out, path);
+        outbuf_write(out, ",", 1);
+        outbuf_csv_field(out, os_name);
+        outbuf_write(out, ",", 1);
+        outbuf_csv_field(out, label_value);
+        outbuf_printf(out, ",%llu,%llu,%u,%u,%u,%u,%u,%u,%u,%u\n", total_size, free_size, tree.files,
+                      tree.directories, tree.directory_clusters, tree.max_depth, tree.cycles, bs->num_fats,
+                      img->geo.fat_sectors, img->geo.fat_bits);
+    } else {
+        outbuf_printf(out, "OS Name: %s\n", os_name);
+        outbuf_printf(out, "Label of the disk: %s\n", volume_label);
+        outbuf_printf(out, "Total size of the disk: %llu bytes\n", total_size);
+        outbuf_printf(out, "Free size of the disk: %llu bytes\n", free_size);
+        outbuf_printf(out, "=============\n");
+        outbuf_printf(out, "The number of files in the disk: %u\n", tree.files);
+        outbuf_printf(out, "Number of FAT copies: %u\n", bs->num_fats);
+        outbuf_printf(out, "Sectors per FAT: %u\n", img->geo.fat_sectors);
+        if (img->geo.fat_bits != 12) {
+            outbuf_printf(out, "FAT type: FAT%u\n", img->geo.fat_bits);
+        }
+    }
+
+    return 0;
+}
+
+// Format a FAT date and time as "YYYY-MM-DD HH:MM:SS"
+static void print_datetime(struct OutBuf *out, uint16_t date, uint16_t time, uint8_t tenths) {
+    int year = ((date >> 9) & 0x7F) + 1980;
+    int month = (date >> 5) & 0x0F;
+    int day = date & 0x1F;
+    int hours = (time >> 11) & 0x1F;
+    int minutes = (time >> 5) & 0x3F;
+    int seconds = (time & 0x1F) * 2 + tenths / 100;
+    outbuf_printf(out, "%04d-%02d-%02d %02d:%02d:%02d", year, month, day, hours, minutes, seconds);
+}
+
+struct QueueItem {
+    uint32_t cluster;
+    char *path;                 // Heading used by the text layout
+    char *record_path;          // Full "/DIR/NAME.EXT" path used in records
+};
+
+// Emit one machine-readable record for a directory entry
+static void print_record(struct OutBuf *out, enum OutputFormat format, const struct Fat12Image *img,
+                         const char *image, const char *path, const struct DirEntry *entry) {
+    const char *type = (entry->attributes & 0x10) ? "dir" : "file";
+    uint32_t size = (entry->attributes & 0x10) ? 0 : entry->file_size;
+    uint32_t first_cluster = fat12_entry_cluster(img, entry);
+
+    if (format == FORMAT_JSONL) {
+        outbuf_printf(out, "{\"image\":");
+        outbuf_json_string(out, image);
+        outbuf_printf(out, ",\"path\":");
+        outbuf_json_string(out, path);
+        outbuf_printf(out, ",\"type\":\"%s\",\"size\":%u,\"attributes\":%u,\"first_cluster\":%u,\"created\":\"",
+                      type, size, entry->attributes, first_cluster);
+        print_datetime(out, entry->creation_date, entry->creation_time, entry->creation_time_tenths);
+        outbuf_printf(out, "\"}\n");
+    } else {
+        outbuf_csv_field(out, image);
+        outbuf_write(out, ",", 1);
+        outbuf_csv_field(out, path);
+        outbuf_printf(out, ",%s,%u,%u,%u,", type, size, entry->attributes, first_cluster);
+        print_datetime(out, entry->creation_date, entry->creation_time, entry->creation_time_tenths);
+        outbuf_printf(out, "\n");
+    }
+}
+
+// Name used by the text layout: base name and extension run together, padding removed
+static void text_name(const struct DirEntry *entry, char *filename, size_t size) {
+    snprintf(filename, size, "%.8s%.3s", entry->filename, entry->extension);
+    // Remove trailing spaces
+    for (int j = strlen(filename) - 1; j >= 0 && filename[j] == ' '; j--) {
+        filename[j] = '\0';
+    }
+}
+
+// Name shown for an entry: its long name if it has one, else as text_name
+static void display_name(const struct DirEntry *entry, const char *long_name, char *filename, size_t size) {
+    if (long_name[0]) {
+        snprintf(filename, size, "%s", long_name);
+    } else {
+        text_name(entry, filename, size);
+    }
+}
+
+// Emit one listed entry in the chosen layout
+static void print_entry(struct OutBuf *out, enum OutputFormat format, const struct Fat12Image *img, const char *image,
+                        const char *record_path, const char *filename, const struct DirEntry *entry) {
+    if (format != FORMAT_TEXT) {
+        print_record(out, format, img, image, record_path, entry);
+        return;
+    }
+    if (entry->attributes & 0x10) {
+        outbuf_printf(out, "D %10s %-20s ", "", filename);
+    } else {
+        outbuf_printf(out, "F %10u %-20s ", entry->file_size, filename);
+    }
+    print_datetime(out, entry->creation_date, entry->creation_time, entry->creation_time_tenths);
+    outbuf_printf(out, "\n");
+}
+
+static int list_directory(const struct Fat12Image *img, uint32_t initial_cluster, const char *initial_path,
+                          enum OutputFormat format, const char *image, struct OutBuf *out) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    struct QueueItem *queue = NULL;
+    size_t queue_size = 0, queue_capacity = 0;
+    size_t front = 0;
+    int status = 1;
+
+    // Enqueue the initial directory
+    queue = realloc(queue, (queue_capacity + 1) * sizeof(struct QueueItem));
+    if (!queue) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+    queue_capacity++;
+    queue[queue_size].cluster = initial_cluster;
+    queue[queue_size].path = strdup(initial_path);
+    queue[queue_size].record_path = strdup("");
+    queue_size++;
+
+    while (front < queue_size) {
+        uint32_t cluster = queue[front].cluster;
+        char *path = queue[front].path;
+        char *record_path = queue[front].record_path;
+        front++;
+
+        if (format == FORMAT_TEXT) {
+            outbuf_printf(out, "\n%s\n===================\n", path);
+        }
+
+        struct Fat12DirIter it;
+        fat12_dir_open(&it, img, NULL, cluster);
+        if (it.error) {
+            fprintf(stderr, "%s: Error reading directory: cluster %u out of range\n", image, cluster);
+        }
+
+        const struct DirEntry *next;
+        char long_name[FAT12_NAME_MAX];
+        while ((next = fat12_dir_next_named(&it, long_name)) != NULL) {
+            const struct DirEntry entry = *next;
+
+            // Skip "." and ".." entries
+            if (entry.filename[0] == '.' && (entry.filename[1] == ' ' || (entry.filename[1] == '.' && entry.filename[2] == ' '))) {
+                continue;
+            }
+
+            char filename[FAT12_NAME_MAX];
+            display_name(&entry, long_name, filename, sizeof(filename));
+
+            // Skip invalid entries
+            uint32_t first_cluster = fat12_entry_cluster(img, &entry);
+            if (first_cluster == 0 || first_cluster == 1) continue;
+
+            char full_name[FAT12_NAME_MAX];
+            if (long_name[0]) {
+                strcpy(full_name, long_name);
+            } else {
+                fat12_entry_name(&entry, full_name);
+            }
+            char *new_record_path = malloc(strlen(record_path) + strlen(full_name) + 2);
+            if (!new_record_path) {
+                fprintf(stderr, "Memory allocation error\n");
+                goto cleanup;
+            }
+            sprintf(new_record_path, "%s/%s", record_path, full_name);
+
+            print_entry(out, format, img, image, new_record_path, filename, &entry);
+
+            // Enqueue subdirectories
+            if ((entry.attributes & 0x10) && first_cluster >= 2) {
+                char *new_path = malloc(strlen(path) + strlen(filename) + 2);
+                if (!new_path) {
+                    fprintf(stderr, "Memory allocation error\n");
+                    free(new_record_path);
+                    goto cleanup;
+                }
+                sprintf(new_path, "%s/%s", path, filename);
+
+                queue = realloc(queue, (queue_capacity + 1) * sizeof(struct QueueItem));
+                if (!queue) {
+                    fprintf(stderr, "Memory allocation error\n");
+                    free(new_path);
+                    free(new_record_path);
+                    goto cleanup;
+                }
+                queue_capacity++;
+                queue[queue_size].cluster = first_cluster;
+                queue[queue_size].path = new_path;
+                queue[queue_size].record_path = new_record_path;
+                queue_size++;
+            } else {
+                free(new_record_path);
+            }
+        }
+
+        free(path);  // Free the path strings after processing the directory
+        free(record_path);
+    }
+    status = 0;
+
+cleanup:
+    // Free any remaining paths in the queue
+    for (size_t i = front; i < queue_size; i++) {
+        free(queue[i].path);
+        free(queue[i].record_path);
+    }
+    free(queue);
+    return status;
+}
+
+// Name shown for an indexed entry. Records are named by the long name when there is
+// one, so a last path component other than the 8.3 name is a long name.
+static void indexed_name(const struct Fat12Image *img, const struct Fat12Index *index,
+                         const struct Fat12IndexRecord *record, char *filename, size_t size) {
+    const struct DirEntry *entry = fat12_index_entry(img, record);
+    const char *name = fat12_index_name(index, record);
+    char short_name[13];
+    fat12_entry_name(entry, short_name);
+    display_name(entry, strcmp(name, short_name) != 0 ? name : "", filename, size);
+}
+
+// List from a sidecar index: its directories are already in breadth-first order
+// with the entries of each stored together, so no directory is scanned
+static int list_indexed(const struct Fat12Image *img, const struct Fat12Index *index, enum OutputFormat format,
+                        const char *image, struct OutBuf *out) {
+    FAT12_PHASE(FAT12_PHASE_DIR);
+    uint32_t dir_count = index->header->dir_count;
+    char **headings = calloc(dir_count, sizeof(char *));
+    if (!headings) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+
+    int status = 0;
+    for (uint32_t d = 0; d < dir_count && status == 0; d++) {
+        const struct Fat12IndexDir *dir = &index->dirs[d];
+        char filename[FAT12_NAME_MAX];
+        if (d == 0) {
+            headings[d] = strdup("/");
+        } else {
+            indexed_name(img, index, &index->records[dir->record], filename, sizeof(filename));
+            headings[d] = malloc(strlen(headings[dir->parent]) + strlen(filename) + 2);
+            if (headings[d]) {
+                sprintf(headings[d], "%s/%s", headings[dir->parent], filename);
+            }
+        }
+        if (!headings[d]) {
+            fprintf(stderr, "Memory allocation error\n");
+            status = 1;
+            break;
+        }
+
+        if (format == FORMAT_TEXT) {
+            outbuf_printf(out, "\n%s\n===================\n", headings[d]);
+        }
+        for (uint32_t i = dir->first_child; i < dir->first_child + dir->child_count; i++) {
+            const struct DirEntry *entry = fat12_index_entry(img, &index->records[i]);
+            uint32_t first_cluster = fat12_entry_cluster(img, entry);
+            if (first_cluster == 0 || first_cluster == 1) continue;  // Skip invalid entries
+
+            indexed_name(img, index, &index->records[i], filename, sizeof(filename));
+            print_entry(out, format, img, image, index->strings + index->records[i].path, filename, entry);
+        }
+    }
+
+    for (uint32_t d = 0; d < dir_count; d++) {
+        free(headings[d]);
+    }
+    free(headings);
+    return status;
+}
+
+// Render the disklist listing for one image
+int list_render(const struct Fat12Image *img, const struct Fat12Index *index, const char *path,
+                enum OutputFormat format, struct OutBuf *out) {
+    // A sidecar index already holds the whole tree
+    if (index) {
+        return list_indexed(img, index, format, path, out);
+    }
+
+    // List the contents of the root directory and all subdirectories
+    // The '0' argument represents the root directory (cluster 0)
+    // The '/' argument represents the root path
+    return list_directory(img, 0, "/", format, path, out);
+}
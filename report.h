@@ -0,0 +1,35 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdint.h>
+
+#include "fat12.h"
+#include "batch.h"
+
+/*
+report.h - Image Reports
+
+The diskinfo summary and the disklist listing, rendered from an open image into
+an output buffer so that both the tools and diskd can produce them.
+*/
+
+// Totals gathered while walking the directory tree
+struct TreeStats {
+    uint32_t files;
+    uint32_t directories;       // Subdirectories, not counting the root
+    uint32_t directory_clusters;  // Clusters of subdirectory chains walked
+    uint32_t max_depth;         // Deepest subdirectory level; the root is 0
+    uint32_t cycles;            // Links back to a directory cluster already walked
+};
+
+// Count files and directories across the whole tree, naming path in diagnostics; returns 0 or -1
+int count_files(const struct Fat12Image *img, const char *path, struct TreeStats *stats);
+
+// Render the diskinfo report for img, named path in records; returns an exit status
+int info_render(const struct Fat12Image *img, const char *path, enum OutputFormat format, struct OutBuf *out);
+
+// Render the disklist listing, from index when one is given; returns an exit status
+int list_render(const struct Fat12Image *img, const struct Fat12Index *index, const char *path,
+                enum OutputFormat format, struct OutBuf *out);
+
+#endif